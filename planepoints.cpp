@@ -1,23 +1,151 @@
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 //#include <cmath.h>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "planepoints.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PP_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PP_TARGET_AVX2
+#else
+#define PP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define PP_X86 0
+#endif
 
 #define DEBUG_LOG 0
 
+struct Entity;
+
+// The entity property a filter rule looks at
+enum class FilterField
+{
+	Classname,
+	Editorclass,
+	ScriptFlag,
+	ScriptName,
+	ScrFlagTrueAll,
+	ScrFlagFalseAll,
+	ScrFlagSet,
+	Spawnclass,
+	Targetname,
+	StringFieldCount,
+
+	IsTrigger = StringFieldCount,
+	Unknown,
+};
+
+// One allow/disallow/must/avoid/color line, already picked apart
+struct FilterRule
+{
+	FilterField field = FilterField::Unknown;
+	bool prefix = false; // Only the characters before the * need to match
+	std::string pattern;
+	int color[3] = {};
+
+	bool Matches(const Entity& ent) const;
+};
+
+// Prefix tree of every pattern used on one field
+// Each node holds the lowest rule index that matches exactly there or as a prefix from there
+struct FilterTrie
+{
+	struct Node
+	{
+		char c = 0;
+		int firstChild = -1;
+		int nextSibling = -1;
+		int exactRule = INT_MAX;
+		int prefixRule = INT_MAX;
+	};
+	std::vector<Node> nodes = std::vector<Node>(1);
+
+	void Insert(std::string_view pattern, bool prefix, int iRule);
+
+	// Lowest index of any rule that matches str, or INT_MAX
+	int FirstMatch(std::string_view str) const;
+};
+
+// A list of rules compiled when the settings are read, so checking an entity never has to re-parse the settings lines
+struct RuleSet
+{
+	std::vector<FilterRule> rules;
+	FilterTrie tries[(int)FilterField::StringFieldCount];
+	bool trieUsed[(int)FilterField::StringFieldCount] = {};
+	int isTriggerRule = INT_MAX;
+
+	// Says so on errors if the rule is on a property there's no such thing as. It's still added, and never matches
+	void Add(const std::string& line, std::ostream& errors, bool hasColor = false);
+
+	// Index of the first rule (in the order they were added) that the entity meets, or -1
+	int FirstMatch(const Entity& ent) const;
+	bool AnyMatch(const Entity& ent) const { return FirstMatch(ent) >= 0; }
+	bool AllMatch(const Entity& ent) const;
+};
+
+// Extra areas from "region" and "sphere" settings lines. If there are any, an entity has to overlap at least one of them
+struct RegionBox
+{
+	float mins[3];
+	float maxs[3];
+};
+struct RegionSphere
+{
+	float center[3];
+	float radius;
+};
+
 struct Settings
 {
 	bool defaultAllow = true;
 	bool drawontop = true;
-	std::vector<std::string> allows;
-	std::vector<std::string> disallows;
-	std::vector<std::string> musts;
-	std::vector<std::string> avoids;
-	std::vector<std::string> clrOverrides;
+	RuleSet allows;
+	RuleSet disallows;
+	RuleSet musts;
+	RuleSet avoids;
+	RuleSet clrOverrides;
 	int duration = 60;
 	bool drawTriggerOutlines = true;
 	bool drawEntCubes = false;
@@ -27,6 +155,10 @@ struct Settings
 	float max_y = INFINITY;
 	float min_z = -INFINITY;
 	float max_z = INFINITY;
+	std::vector<RegionBox> regionBoxes;
+	std::vector<RegionSphere> regionSpheres;
+
+	bool HasRegions() const { return !regionBoxes.empty() || !regionSpheres.empty(); }
 };
 // Vector 3
 struct Vector3
@@ -137,6 +269,8 @@ struct Plane
 	bool bbox = false;
 };
 
+constexpr float k_flEpsilon = 0.001f;
+
 struct Edge
 {
 	// Stem is the starting position, tail is the ending position
@@ -145,12 +279,77 @@ struct Edge
 	Vector3 tail;
 };
 
+// What a brush looks like, worked out once it's been read in so the builder can take a shortcut
+enum class BrushShape : uint8_t
+{
+	General,
+	Box,		// Nothing but the 6 bounding box planes, lined up with the axes, so the edges can be read straight off of them
+};
+
 struct Brush
 {
 	std::vector<Plane> planes;
 	std::vector<Edge> edges;
+	BrushShape shape = BrushShape::General;
 };
 
+// Finds which bounding box plane faces which way, iBoxPlanes[axis * 2] for +axis and iBoxPlanes[axis * 2 + 1] for -axis.
+// False unless all 6 are there, lined up with the axes, facing different ways and not skipped
+bool FindBoxPlanes( const Plane* pPlanes, size_t nPlanes, int iBoxPlanes[6] )
+{
+	for ( int i = 0; i < 6; i++ )
+		iBoxPlanes[i] = -1;
+
+	int nFound = 0;
+	for ( size_t iPlane = 0; iPlane < nPlanes; iPlane++ )
+	{
+		const Plane& plane = pPlanes[iPlane];
+		if ( !plane.bbox )
+			continue;
+		if ( plane.skip )
+			return false;
+
+		int iSide = -1;
+		for ( int i = 0; i < 3; i++ )
+		{
+			if ( plane.normal[( i + 1 ) % 3] != 0 || plane.normal[( i + 2 ) % 3] != 0 )
+				continue;
+			if ( plane.normal[i] == 1 )
+				iSide = i * 2;
+			else if ( plane.normal[i] == -1 )
+				iSide = i * 2 + 1;
+		}
+		if ( iSide < 0 || iBoxPlanes[iSide] >= 0 )
+			return false;
+		iBoxPlanes[iSide] = iPlane;
+		nFound++;
+	}
+	return nFound == 6;
+}
+
+BrushShape ClassifyBrush( const Plane* pPlanes, size_t nPlanes )
+{
+	int iBoxPlanes[6];
+	if ( !FindBoxPlanes( pPlanes, nPlanes, iBoxPlanes ) )
+		return BrushShape::General;
+
+	// Anything past the box has to be a clone, which the builder never looks at
+	for ( size_t iPlane = 0; iPlane < nPlanes; iPlane++ )
+	{
+		if ( !pPlanes[iPlane].bbox && !pPlanes[iPlane].skip )
+			return BrushShape::General;
+	}
+
+	// A flat or inside out box would have its corners welded or culled, that's left to the full build. Opposite corners
+	// are only safely apart once they're further than the weld distance, with as much again for rounding
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( !( pPlanes[iBoxPlanes[i * 2]].dist + pPlanes[iBoxPlanes[i * 2 + 1]].dist > 2 * k_flEpsilon ) )
+			return BrushShape::General;
+	}
+	return BrushShape::Box;
+}
+
 struct Entity
 {
 	std::string editorclass;
@@ -171,6 +370,25 @@ struct Entity
 	std::vector<Brush> brushes;
 };
 
+// Every string in Entity, for anything that goes over all of them
+constexpr int k_nEntityStrings = 9;
+
+std::string* EntityStrings( Entity& ent, int i )
+{
+	std::string* strings[k_nEntityStrings] = { &ent.editorclass, &ent.classname, &ent.targetname, &ent.script_flag, &ent.script_name,
+		&ent.scr_flagTrueAll, &ent.scr_flagFalseAll, &ent.scr_flagSet, &ent.spawnclass };
+	return strings[i];
+}
+
+// What each of EntityStrings is called in the lump, in the same order
+constexpr const char* k_entityStringNames[k_nEntityStrings] = { "editorclass", "classname", "targetname", "script_flag", "script_name",
+	"scr_flagTrueAll", "scr_flagFalseAll", "scr_flagSet", "spawnclass" };
+
+const std::string* EntityStrings( const Entity& ent, int i )
+{
+	return EntityStrings( const_cast<Entity&>( ent ), i );
+}
+
 Vector3 crossProduct(const Vector3& l, const Vector3& r)
 {
 	return { l.y * r.z - l.z * r.y, l.z * r.x - l.x * r.z, l.x * r.y - l.y * r.x };
@@ -306,19 +524,46 @@ bool PlaneIntersect(const Plane& plane1, const Plane& plane2, const Plane& plane
 	return false;
 }
 
-Vector3 ParseVector(const std::string& str)
+// Reads one float from [p, end), skipping any whitespace before it. Returns where the number ended.
+// On failure the value is left alone and p is returned
+const char* ParseFloat(const char* p, const char* end, float& out)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	// from_chars doesn't take a leading plus
+	const char* start = p;
+	if (p < end && *p == '+')
+		p++;
+
+	std::from_chars_result res = std::from_chars(p, end, out);
+	if (res.ec != std::errc())
+		return start;
+	return res.ptr;
+}
+
+Vector3 ParseVector(std::string_view str)
 {
 	// Parse the vector 
 	Vector3 v;
-	sscanf_s(str.c_str(), "%f %f %f", &v.x, &v.y, &v.z);
+	const char* p = str.data();
+	const char* end = p + str.size();
+	p = ParseFloat(p, end, v.x);
+	p = ParseFloat(p, end, v.y);
+	p = ParseFloat(p, end, v.z);
 	return v;
 }
 
-Plane ParsePlane(const std::string& str, Vector3 origin)
+Plane ParsePlane(std::string_view str, Vector3 origin)
 {
 	// Parse the plane
 	Plane plane;
-	sscanf_s(str.c_str(), "%f %f %f %f", &plane.normal.x, &plane.normal.y, &plane.normal.z, &plane.dist);
+	const char* p = str.data();
+	const char* end = p + str.size();
+	p = ParseFloat(p, end, plane.normal.x);
+	p = ParseFloat(p, end, plane.normal.y);
+	p = ParseFloat(p, end, plane.normal.z);
+	p = ParseFloat(p, end, plane.dist);
 
 #if DEBUG_LOG
 	//debug
@@ -329,14 +574,301 @@ Plane ParsePlane(const std::string& str, Vector3 origin)
 	return plane;
 }
 
-constexpr float k_flEpsilon = 0.001f;
+// Reads the leading digits of str, throwing like stoi would if there are none
+int ParseIndex(std::string_view str)
+{
+	int i = 0;
+	std::from_chars_result res = std::from_chars(str.data(), str.data() + str.size(), i);
+	if (res.ec != std::errc() || i < 0)
+		throw std::invalid_argument("bad brush or plane number in \"" + std::string(str) + "\"");
+	return i;
+}
 
-void ParseFile(std::ifstream& ReadFile, std::vector<Entity>& entities)
+inline uint64_t HashMix( uint64_t h )
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return h;
+}
+
+// A plane normal an EntityParser has already read, see EntityParser::IsClone
+struct SeenNormal
+{
+	Vector3 normal;
+	uint32_t iBrush;
+	uint32_t iStamp;
+};
+
+// Unit normals with a dot product of exactly 1 are a lot closer than half of this on every axis, so a clone of a
+// normal is always in its cube of this size or the neighbour on the side it's closer to
+constexpr double k_flCloneCellScale = 1.0 / 0.04;
+
+// Normals further than this from unit length can have a dot product of 1 with ones facing well away, so brushes with
+// any of those are still checked plane by plane
+constexpr float k_flCloneLengthSlop = 1e-4f;
+
+// Below this many planes in a brush, going through them all for a clone is quicker than the hash
+constexpr size_t k_nCloneHashPlanes = 32;
+
+// Keeps track of the entity that's being read in
+struct EntityParser
 {
-	std::string textLine;
 	Entity newEntity;
 	int iSkipBB = 0;
 	int iLastBrush = 0;
+
+	// Brushes of an entity that was copied rather than moved out, kept so their planes don't need allocating again
+	std::vector<Brush> spareBrushes;
+
+	// Every normal read in for the entity so far, hashed by brush and roughly where it points,
+	// so clones are found without going through every plane of the brush. Slots from earlier entities have an old stamp
+	std::vector<SeenNormal> seenNormals;
+	size_t nSeenNormals = 0;
+	uint32_t iSeenStamp = 1;
+
+	// How each brush is being checked for clones. Only brushes with lots of planes go in the hash, and any with a normal
+	// that isn't unit length (see k_flCloneLengthSlop) go back to looking at every plane
+	enum class CloneCheck : uint8_t { Scan, Hash, ScanAlways };
+	std::vector<CloneCheck> brushCloneChecks;
+
+	void KeyValue(std::string_view key, std::string_view value);
+
+	// Remembers the normal for the brush. True if it has a dot product of 1 with one the brush already had
+	bool IsClone(int iBrush, const Vector3& normal);
+
+	size_t SeenSlotFor(int64_t x, int64_t y, int64_t z, uint32_t iBrush) const;
+	void AddSeen(int iBrush, const Vector3& normal);
+
+	// Works out the shape of each brush once the entity's closing brace is reached
+	void Finish();
+
+	// Empties newEntity for the next one, keeping any buffers it still has
+	void Reset();
+};
+
+void EntityParser::Finish()
+{
+	for (Brush& brush : newEntity.brushes)
+		brush.shape = ClassifyBrush(brush.planes.data(), brush.planes.size());
+}
+
+size_t EntityParser::SeenSlotFor(int64_t x, int64_t y, int64_t z, uint32_t iBrush) const
+{
+	return HashMix(x * 73856093ull ^ y * 19349663ull ^ z * 83492791ull ^ iBrush * 2654435761ull) & (seenNormals.size() - 1);
+}
+
+void EntityParser::AddSeen(int iBrush, const Vector3& normal)
+{
+	// Kept no more than half full
+	if (seenNormals.size() < (nSeenNormals + 1) * 2)
+	{
+		std::vector<SeenNormal> old = std::move(seenNormals);
+		seenNormals.assign(std::max<size_t>(64, old.size() * 2), {});
+		nSeenNormals = 0;
+		for (const SeenNormal& seen : old)
+		{
+			if (seen.iStamp == iSeenStamp)
+				AddSeen(seen.iBrush, seen.normal);
+		}
+	}
+
+	size_t mask = seenNormals.size() - 1;
+	size_t i = SeenSlotFor((int64_t)floor(normal.x * k_flCloneCellScale), (int64_t)floor(normal.y * k_flCloneCellScale), (int64_t)floor(normal.z * k_flCloneCellScale), iBrush);
+	while (seenNormals[i].iStamp == iSeenStamp)
+		i = (i + 1) & mask;
+	seenNormals[i] = { normal, (uint32_t)iBrush, iSeenStamp };
+	nSeenNormals++;
+}
+
+bool EntityParser::IsClone(int iBrush, const Vector3& normal)
+{
+	Brush& brush = newEntity.brushes[iBrush];
+	if (brushCloneChecks.size() <= (size_t)iBrush)
+		brushCloneChecks.resize(iBrush + 1, CloneCheck::Scan);
+	CloneCheck& check = brushCloneChecks[iBrush];
+	if (fabsf(dotProduct(normal, normal) - 1) > k_flCloneLengthSlop)
+		check = CloneCheck::ScanAlways;
+
+	// Big enough to be worth hashing now, so everything so far goes in
+	if (check == CloneCheck::Scan && brush.planes.size() >= k_nCloneHashPlanes)
+	{
+		for (const Plane& plane2 : brush.planes)
+			AddSeen(iBrush, plane2.normal);
+		check = CloneCheck::Hash;
+	}
+
+	if (check != CloneCheck::Hash)
+	{
+		for (const Plane& plane2 : brush.planes)
+		{
+			if (dotProduct(normal, plane2.normal) == 1)
+				return true;
+		}
+		return false;
+	}
+
+	// The cube the normal is in, and on each axis the neighbour on whichever side it's closer to
+	int64_t cells[3][2];
+	for (int iAxis = 0; iAxis < 3; iAxis++)
+	{
+		double q = normal[iAxis] * k_flCloneCellScale;
+		double cell = floor(q);
+		cells[iAxis][0] = (int64_t)cell;
+		cells[iAxis][1] = (int64_t)cell + (q - cell < 0.5 ? -1 : 1);
+	}
+
+	size_t mask = seenNormals.size() - 1;
+	for (int64_t x : cells[0])
+	{
+		for (int64_t y : cells[1])
+		{
+			for (int64_t z : cells[2])
+			{
+				for (size_t i = SeenSlotFor(x, y, z, iBrush); seenNormals[i].iStamp == iSeenStamp; i = (i + 1) & mask)
+				{
+					if (seenNormals[i].iBrush == (uint32_t)iBrush && dotProduct(normal, seenNormals[i].normal) == 1)
+						return true;
+				}
+			}
+		}
+	}
+
+	AddSeen(iBrush, normal);
+	return false;
+}
+
+void EntityParser::Reset()
+{
+	for (int i = 0; i < k_nEntityStrings; i++)
+		EntityStrings(newEntity, i)->clear();
+	newEntity.origin = {};
+	newEntity.mins = {};
+	newEntity.maxs = {};
+	newEntity.isTrigger = false;
+	for (Brush& brush : newEntity.brushes)
+	{
+		brush.planes.clear();
+		brush.edges.clear();
+		spareBrushes.push_back(std::move(brush));
+	}
+	newEntity.brushes.clear();
+	iSeenStamp++;
+	nSeenNormals = 0;
+	brushCloneChecks.clear();
+}
+
+void EntityParser::KeyValue(std::string_view key, std::string_view value)
+{
+	// Only the keys we care about get copied out of the line
+	if (key == "editorclass")
+		newEntity.editorclass = value;
+
+	else if (key == "origin")
+		newEntity.origin = ParseVector(value);
+
+	else if (key == "targetname")
+		newEntity.targetname = value;
+
+	else if (key == "script_flag")
+		newEntity.script_flag = value;
+
+	else if (key == "script_name")
+		newEntity.script_name = value;
+
+	else if (key == "scr_flagTrueAll")
+		newEntity.scr_flagTrueAll = value;
+
+	else if (key == "scr_flagFalseAll")
+		newEntity.scr_flagFalseAll = value;
+
+	else if (key == "scr_flagSet")
+		newEntity.scr_flagSet = value;
+
+	else if (key == "spawnclass")
+		newEntity.spawnclass = value;
+
+	else if (key == "classname")
+	{
+		newEntity.classname = value;
+		iSkipBB = 0;
+		iLastBrush = 0;
+	}
+	else if (key.find("*trigger_brush_") != std::string_view::npos)
+	{
+		newEntity.isTrigger = true;
+		//std::cout << "string " << key << "\n";
+		constexpr std::string_view token1 = "*trigger_brush_";
+		size_t brushDigitsPos = key.find("_", token1.length());//some triggers have 10+ brushes
+		size_t brushNumDigits = brushDigitsPos - token1.length();
+		int iBrush = ParseIndex(key.substr(token1.length(), brushNumDigits));
+		//std::cout << "brush " << brush << ", ";
+
+		if (iLastBrush != iBrush)
+		{
+			iSkipBB = 0;
+			iLastBrush = iBrush;
+		}
+		constexpr std::string_view token2 = "_plane_";
+		if (token1.length() + brushNumDigits + token2.length() > key.length())
+			throw std::invalid_argument("missing plane number in \"" + std::string(key) + "\"");
+		int iPlane = ParseIndex(key.substr(token1.length() + brushNumDigits + token2.length()));
+		//std::cout << "iPlane " << iPlane << ", ";
+
+		// Parse the plane
+		Plane plane = ParsePlane(value, newEntity.origin);
+
+		if (iSkipBB <= 5)//0-5 are bounding box of the brush
+		{
+			//std::cout << "Found BB plane " << iSkipBB << "\n";
+			iSkipBB++;
+			plane.bbox = true;
+		}
+
+		// Normally, I'd just use pushback, but these have IDs soooo idk
+
+		// Make room for the brush if we haven't yet
+		while (newEntity.brushes.size() <= iBrush)
+		{
+			if (spareBrushes.empty())
+				newEntity.brushes.emplace_back();
+			else
+			{
+				newEntity.brushes.push_back(std::move(spareBrushes.back()));
+				spareBrushes.pop_back();
+			}
+		}
+
+		// Grab the brush
+		Brush& brush = newEntity.brushes[iBrush];
+
+		// Make room for the plane if we haven't yet
+		if (brush.planes.size() <= iPlane)
+			brush.planes.resize(iPlane + 1);
+
+		//don't add plane if clone exists
+		//planes that are only nearly the same get sorted out by BrushBuilder::PreparePlanes
+		if (IsClone(iBrush, plane.normal))
+			plane.skip = true;
+
+		// Set the plane
+		brush.planes[iPlane] = plane;
+#if DEBUG_LOG
+		std::cout << "Add plane " << iPlane << "\n";
+#endif
+	}
+	else if (key == "*trigger_bounds_mins")
+		newEntity.mins = ParseVector(value);
+	else if (key == "*trigger_bounds_maxs")
+		newEntity.maxs = ParseVector(value);
+}
+
+// Line at a time parser that reads through a stream
+// ParseBuffer does the same job in place and is what's normally used, this is kept around as the baseline for -benchparse
+void ParseFile(std::istream& ReadFile, std::vector<Entity>& entities)
+{
+	std::string textLine;
+	EntityParser parser;
 	while (getline(ReadFile, textLine))
 	{
 		// Skip any blank lines
@@ -347,7 +879,7 @@ void ParseFile(std::ifstream& ReadFile, std::vector<Entity>& entities)
 		{
 			// Start of entity
 			// Clear out the entity
-			newEntity = {};
+			parser.Reset();
 			continue;
 		}
 
@@ -355,7 +887,8 @@ void ParseFile(std::ifstream& ReadFile, std::vector<Entity>& entities)
 		{
 			// End of entity
 			// Commit the entity
-			entities.push_back(newEntity);
+			parser.Finish();
+			entities.push_back(parser.newEntity);
 			continue;
 		}
 
@@ -374,112 +907,341 @@ void ParseFile(std::ifstream& ReadFile, std::vector<Entity>& entities)
 		std::string key = textLine.substr(keyStart, keyEnd - keyStart);
 		std::string value = textLine.substr(valueStart, valueEnd - valueStart);
 
-		if (key == "editorclass")
-			newEntity.editorclass = value;
+		parser.KeyValue(key, value);
+	}
+}
 
-		else if (key == "origin")
-			newEntity.origin = ParseVector(value);
+// Parses a whole entity lump that's already in memory, handing each entity to onEntity as soon as its closing brace is reached
+// Keys and values are looked at where they sit in the buffer, nothing is copied unless the entity keeps it
+template <typename Callback>
+void ParseBufferEach(std::string_view data, Callback&& onEntity)
+{
+	EntityParser parser;
+	while (!data.empty())
+	{
+		// Split off the next line
+		size_t lineEnd = data.find('\n');
+		std::string_view textLine = data.substr(0, lineEnd);
+		data.remove_prefix(lineEnd == std::string_view::npos ? data.size() : lineEnd + 1);
 
-		else if (key == "targetname")
-			newEntity.targetname = value;
+		// Skip any blank lines
+		if (textLine.size() == 0)
+			continue;
 
-		else if (key == "script_flag")
-			newEntity.script_flag = value;
+		if (textLine[0] == '{')
+		{
+			// Start of entity
+			parser.Reset();
+			continue;
+		}
 
-		else if (key == "script_name")
-			newEntity.script_name = value;
+		if (textLine[0] == '}')
+		{
+			// End of entity
+			// Usually it's moved out, anything left behind gets used again for the next one
+			parser.Finish();
+			onEntity(std::move(parser.newEntity));
+			parser.Reset();
+			continue;
+		}
 
-		else if (key == "scr_flagTrueAll")
-			newEntity.scr_flagTrueAll = value;
+		// Find everything between the pairs of double quotes, same as ParseFile
+		size_t keyStart = textLine.find('"');
+		if (keyStart == std::string_view::npos)
+			continue;
+		size_t keyEnd = textLine.find('"', keyStart + 1);
+		if (keyEnd == std::string_view::npos)
+			continue;
+		size_t valueStart = textLine.find('"', keyEnd + 1);
+		if (valueStart == std::string_view::npos)
+			continue;
+		size_t valueEnd = textLine.find('"', valueStart + 1);
 
-		else if (key == "scr_flagFalseAll")
-			newEntity.scr_flagFalseAll = value;
+		// Move the string start over the double quote
+		keyStart++;
+		valueStart++;
 
-		else if (key == "scr_flagSet")
-			newEntity.scr_flagSet = value;
+		parser.KeyValue(textLine.substr(keyStart, keyEnd - keyStart), textLine.substr(valueStart, valueEnd - valueStart));
+	}
+}
 
-		else if (key == "spawnclass")
-			newEntity.spawnclass = value;
+void ParseBuffer(std::string_view data, std::vector<Entity>& entities)
+{
+	ParseBufferEach(data, [&entities](Entity&& ent) { entities.push_back(std::move(ent)); });
+}
 
-		else if (key == "classname")
+// Cuts a lump up into the text of each entity without parsing any of it, one piece per entity ParseBufferEach would give.
+// Each piece runs up to and including its closing brace's line, so anything between entities goes with the one after it
+template <typename Callback>
+void SplitEntities(std::string_view data, Callback&& onEntity)
+{
+	size_t iStart = 0;
+	size_t iLine = 0;
+	while (iLine < data.size())
+	{
+		size_t lineEnd = data.find('\n', iLine);
+		size_t iNext = lineEnd == std::string_view::npos ? data.size() : lineEnd + 1;
+		if (data[iLine] == '}')
 		{
-			newEntity.classname = value;
-			iSkipBB = 0;
-			iLastBrush = 0;
+			onEntity(data.substr(iStart, iNext - iStart));
+			iStart = iNext;
 		}
-		else if (key.find("*trigger_brush_") != std::string::npos)
-		{
-			newEntity.isTrigger = true;
-			//std::cout << "string " << key << "\n";
-			const std::string token1 = "*trigger_brush_";
-			size_t brushDigitsPos = key.find("_", token1.length());//some triggers have 10+ brushes
-			size_t brushNumDigits = brushDigitsPos - token1.length();
-			int iBrush = stoi(key.substr(token1.length(), brushNumDigits));
-			//std::cout << "brush " << brush << ", ";
+		iLine = iNext;
+	}
+}
 
-			if (iLastBrush != iBrush)
-			{
-				iSkipBB = 0;
-				iLastBrush = iBrush;
-			}
-			const std::string token2 = "_plane_";
-			int iPlane = stoi(key.substr(token1.length() + brushNumDigits + token2.length()));
-			//std::cout << "iPlane " << iPlane << ", ";
+// Read only view of a whole file, mapped straight into memory
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
 
-			// Parse the plane
-			Plane plane = ParsePlane(value, newEntity.origin);
+	bool Open(const std::string& path);
+	void Close();
 
-			if (iSkipBB <= 5)//0-5 are bounding box of the brush
-			{
-				//std::cout << "Found BB plane " << iSkipBB << "\n";
-				iSkipBB++;
-				plane.bbox = true;
-			}
+	std::string_view View() const { return std::string_view(m_pData, m_nSize); }
 
-			// Normally, I'd just use pushback, but these have IDs soooo idk
+private:
+	const char* m_pData = nullptr;
+	size_t m_nSize = 0;
+#ifdef _WIN32
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = NULL;
+#else
+	int m_fd = -1;
+#endif
+};
 
-			// Make room for the brush if we haven't yet
-			if (newEntity.brushes.size() <= iBrush)
-				newEntity.brushes.resize(iBrush + 1);
+MappedFile::~MappedFile()
+{
+	Close();
+}
 
-			// Grab the brush
-			Brush& brush = newEntity.brushes[iBrush];
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef _WIN32
+	m_hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
 
-			// Make room for the plane if we haven't yet
-			if (brush.planes.size() <= iPlane)
-				brush.planes.resize(iPlane + 1);
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size))
+	{
+		Close();
+		return false;
+	}
+	m_nSize = (size_t)size.QuadPart;
 
-			//don't add plane if clone exists
-			int nPlanes = brush.planes.size();
-			for (int iPlane2 = 0; iPlane2 < nPlanes; iPlane2++)
-			{
-				Plane& plane2 = brush.planes[iPlane2];
-				float f = dotProduct(plane.normal, plane2.normal);
-				//std::cout << "Plane " << iPlane << " and " << iPlane2 << " dot product is " << f << "\n";
+	// Mapping an empty file fails, but an empty file is still a file
+	if (m_nSize == 0)
+		return true;
 
-				if (f == 1)
-				{
-					//std::cout << "Clone Plane: " << iPlane << " and " << iPlane2 << "\n";
-					plane.skip = true;
-				}
-			}
+	m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping == NULL)
+	{
+		Close();
+		return false;
+	}
+	m_pData = (const char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	m_fd = open(path.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		return false;
 
-			// Set the plane
-			brush.planes[iPlane] = plane;
-#if DEBUG_LOG
-			std::cout << "Add plane " << iPlane << "\n";
-#endif
-		}
-		else if (key == "*trigger_bounds_mins")
-			newEntity.mins = ParseVector(value);
-		else if (key == "*trigger_bounds_maxs")
-			newEntity.maxs = ParseVector(value);
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		Close();
+		return false;
 	}
-}
+	m_nSize = (size_t)st.st_size;
 
+	// Mapping an empty file fails, but an empty file is still a file
+	if (m_nSize == 0)
+		return true;
 
-bool IsNear( float a, float b, float eps = k_flEpsilon )
-{
+	void* pData = mmap(nullptr, m_nSize, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (pData == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	madvise(pData, m_nSize, MADV_SEQUENTIAL);
+	m_pData = (const char*)pData;
+#endif
+	if (!m_pData)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_pData)
+		UnmapViewOfFile(m_pData);
+	if (m_hMapping != NULL)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pData)
+		munmap((void*)m_pData, m_nSize);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+#endif
+	m_pData = nullptr;
+	m_nSize = 0;
+}
+
+
+// How long to wait for more changes after one comes in, so a save that touches a file more than once is only acted on once
+constexpr int k_nWatchSettleMs = 50;
+// How often to check the files where there's no inotify
+constexpr int k_nWatchPollMs = 100;
+
+// Waits for files to change, for -watch. It watches the folders they're in rather than the files themselves, since a lot
+// of editors save by writing a new file and renaming it over the old one. Without inotify it just checks every so often
+class FileWatcher
+{
+public:
+	FileWatcher() = default;
+	~FileWatcher();
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	bool Add(const std::string& path);
+
+	// Blocks until at least one of the files changes, then returns every one that did
+	std::vector<std::string> Wait();
+
+private:
+	struct File
+	{
+		std::string path;
+		std::string name;
+		std::filesystem::file_time_type time;
+		uintmax_t size = 0;
+		int wd = -1;
+	};
+
+	std::vector<File> m_files;
+#ifdef __linux__
+	int m_fd = -1;
+#else
+	bool CheckTimes(std::vector<std::string>& changed);
+#endif
+};
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if (m_fd >= 0)
+		close(m_fd);
+#endif
+}
+
+bool FileWatcher::Add(const std::string& path)
+{
+	std::filesystem::path fsPath(path);
+	File file;
+	file.path = path;
+	file.name = fsPath.filename().string();
+	std::error_code ec;
+	file.time = std::filesystem::last_write_time(fsPath, ec);
+	file.size = std::filesystem::file_size(fsPath, ec);
+#ifdef __linux__
+	if (m_fd < 0)
+		m_fd = inotify_init1(IN_CLOEXEC);
+	if (m_fd < 0)
+		return false;
+	std::string dir = fsPath.has_parent_path() ? fsPath.parent_path().string() : ".";
+	// Watching the same folder twice gives back the same wd
+	file.wd = inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (file.wd < 0)
+		return false;
+#endif
+	m_files.push_back(file);
+	return true;
+}
+
+#ifndef __linux__
+// Finds files whose time or size is different from last time, adding them to changed. Returns whether any were
+bool FileWatcher::CheckTimes(std::vector<std::string>& changed)
+{
+	bool any = false;
+	for (File& file : m_files)
+	{
+		std::error_code timeError, sizeError;
+		auto time = std::filesystem::last_write_time(file.path, timeError);
+		uintmax_t size = std::filesystem::file_size(file.path, sizeError);
+		// Probably partway through being replaced, it'll be back
+		if (timeError || sizeError || (time == file.time && size == file.size))
+			continue;
+		file.time = time;
+		file.size = size;
+		any = true;
+		if (std::find(changed.begin(), changed.end(), file.path) == changed.end())
+			changed.push_back(file.path);
+	}
+	return any;
+}
+#endif
+
+std::vector<std::string> FileWatcher::Wait()
+{
+	std::vector<std::string> changed;
+#ifdef __linux__
+	int timeout = -1;
+	for (;;)
+	{
+		pollfd pfd = { m_fd, POLLIN, 0 };
+		int nReady = poll(&pfd, 1, timeout);
+		if (nReady < 0 && errno == EINTR)
+			continue;
+		if (nReady <= 0)
+			return changed;
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t nRead = read(m_fd, buffer, sizeof(buffer));
+		if (nRead <= 0)
+			return changed;
+		for (char* p = buffer; p < buffer + nRead; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+		{
+			const inotify_event* event = (const inotify_event*)p;
+			if (!event->len)
+				continue;
+			for (const File& file : m_files)
+			{
+				if (file.wd == event->wd && file.name == event->name && std::find(changed.begin(), changed.end(), file.path) == changed.end())
+					changed.push_back(file.path);
+			}
+		}
+		if (!changed.empty())
+			timeout = k_nWatchSettleMs;
+	}
+#else
+	for (;;)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(changed.empty() ? k_nWatchPollMs : k_nWatchSettleMs));
+		if (!CheckTimes(changed) && !changed.empty())
+			return changed;
+	}
+#endif
+}
+
+
+bool IsNear( float a, float b, float eps = k_flEpsilon )
+{
 	float c = a - b;
 	return -eps < c && c < eps;
 }
@@ -517,703 +1279,6555 @@ bool TestPointInBrush( const Brush& brush, const Vector3& p )
 }
 
 
-// Each edge pair corresponds to two planes
-constexpr uint32_t k_iInvalidVertex = 0xFFFFFFFF;
-struct EdgePair
+// Batched plane intersection kernels
+// Rather than solving one triple at a time, these take two planes and a block of k_nKernelWidth third planes,
+// solve all of the triples at once with Cramer's rule, and cull the resulting points against the brush in the same pass.
+// Cramer's rule is done in double since in float it wanders far enough from mat3x3_solve to flip points that sit right
+// on another plane. Culling is done in float like TestPointInBrush, except that each point carries a bound on how far off
+// float can be for it. A point that lands within that of k_flEpsilon on any plane is too close to call, and gets culled
+// again in double, where the products of two floats are exact.
+// Every kernel does the same operations in the same order (no FMA), so they all give the same bits.
+// mat3x3_solve and TestPointInBrush stay as the reference path, see -kernel and -verifykernels.
+
+constexpr int k_nKernelWidth = 8;
+
+// Anything closer to zero than this is treated as three planes with no single meeting point
+constexpr float k_flDetEpsilon = FLT_EPSILON;
+
+enum class BuildKernel
 {
-	uint32_t iVertex1;
-	uint32_t iVertex2;
+	Reference,	// mat3x3_solve and TestPointInBrush, one triple at a time
+	Scalar,
+	SSE2,
+	AVX2,
 };
 
-// Util class for building brush edge lists
-class BrushBuilder
+const char* BuildKernelName( BuildKernel kernel )
 {
-public:
-	BrushBuilder();
-	~BrushBuilder();
-
-
-	void Build( Brush& brush );
+	switch ( kernel )
+	{
+	case BuildKernel::Reference:	return "reference";
+	case BuildKernel::Scalar:		return "scalar";
+	case BuildKernel::SSE2:			return "sse2";
+	default:						return "avx2";
+	}
+}
 
-private:
+// Brush planes laid out as structure of arrays for the kernels
+struct BrushSoA
+{
+	// Every plane, padded with zero planes so a block of k_nKernelWidth never runs off the end wherever it starts
+	std::vector<float> nx, ny, nz, dist;
 
-	void BeginBrush( int nPlanes );
+	// Only the planes that points get culled against (skip planes left out)
+	std::vector<float> cullX, cullY, cullZ, cullDist;
 
-	// Returns the edge shared by two planes, x and y
-	EdgePair& GetEdge( int x, int y );
+	// 6 when the first cull planes are the bounding box, facing +x, -x, +y, -y, +z, -z like FindBoxPlanes has them.
+	// Kernels check those first with just a subtract each, then carry on from here through the rest
+	int nBoxCull;
 
-	// Adds a vertex onto a given edge shared by two planes, x and y 
-	// Returns true when the given edge now has two pairs
-	bool PushPartialEdge( int x, int y, uint32_t iVert );
+	// How far off culling in float can be for a point p is flCullNormalError * ( |p.x| + |p.y| + |p.z| ) + flCullDistError
+	float flCullNormalError, flCullDistError;
 
-	// Stores a vertex and returns its index or returns the index of the vertex if it's already stored
-	uint32_t StoreVertex( const Vector3& newVert );
+	void Load( const Brush& brush );
+};
 
-	int m_nPlaneCount;
+void BrushSoA::Load( const Brush& brush )
+{
+	int nPlanes = brush.planes.size();
+	// Blocks start right after the second plane of the pair, not on a multiple of the width
+	int nPadded = nPlanes + k_nKernelWidth - 1;
+	nx.assign( nPadded, 0.0f );
+	ny.assign( nPadded, 0.0f );
+	nz.assign( nPadded, 0.0f );
+	dist.assign( nPadded, 0.0f );
+	cullX.clear();
+	cullY.clear();
+	cullZ.clear();
+	cullDist.clear();
+
+	// Lined up with the axes, the bounding box planes cull exactly the same with x * 1 + y * 0 + z * 0 - d as with x - d
+	int iBoxPlanes[6];
+	nBoxCull = FindBoxPlanes( brush.planes.data(), nPlanes, iBoxPlanes ) ? 6 : 0;
+	for ( int i = 0; i < nBoxCull; i++ )
+	{
+		const Plane& plane = brush.planes[iBoxPlanes[i]];
+		cullX.push_back( plane.normal.x );
+		cullY.push_back( plane.normal.y );
+		cullZ.push_back( plane.normal.z );
+		cullDist.push_back( plane.dist );
+	}
 
-	// This is a triangular array of all potential edge pairings between planes
-	int m_nEdgeCount;
-	int m_nEdgeCapacity;
-	EdgePair* m_pEdgePairs;
+	for ( int i = 0; i < nPlanes; i++ )
+	{
+		const Plane& plane = brush.planes[i];
+		nx[i] = plane.normal.x;
+		ny[i] = plane.normal.y;
+		nz[i] = plane.normal.z;
+		dist[i] = plane.dist;
 
-	// This is a set of all vertices with no duplicates
-	std::vector<Vector3> m_vecVerts;
-};
+		if ( plane.skip || ( nBoxCull && plane.bbox ) )
+			continue;
+		cullX.push_back( plane.normal.x );
+		cullY.push_back( plane.normal.y );
+		cullZ.push_back( plane.normal.z );
+		cullDist.push_back( plane.dist );
+	}
 
+	// Rounding in the three products and the sums comes to less than 2 * FLT_EPSILON * ( |n| * |p| + |d| ) between them
+	float flNormalMax = 0.0f, flDistMax = 0.0f;
+	for ( size_t i = 0; i < cullDist.size(); i++ )
+	{
+		flNormalMax = std::max( { flNormalMax, fabsf( cullX[i] ), fabsf( cullY[i] ), fabsf( cullZ[i] ) } );
+		flDistMax = std::max( flDistMax, fabsf( cullDist[i] ) );
+	}
+	flCullNormalError = 2 * FLT_EPSILON * flNormalMax;
+	flCullDistError = 2 * FLT_EPSILON * flDistMax;
+}
 
-BrushBuilder::BrushBuilder()
+// Culls a point in double, for when float was too close to call
+inline bool PointInsideDouble( const BrushSoA& soa, float x, float y, float z )
 {
-	m_nPlaneCount = 0;
-	m_nEdgeCount = 0;
-	m_nEdgeCapacity = 0;
-	m_pEdgePairs = nullptr;
-
-	// Setup with basic starter data
-	BeginBrush( 6 );
+	int nCull = soa.cullDist.size();
+	for ( int k = 0; k < nCull; k++ )
+	{
+		if ( (double)x * soa.cullX[k] + (double)y * soa.cullY[k] + (double)z * soa.cullZ[k] - soa.cullDist[k] > k_flEpsilon )
+			return false;
+	}
+	return true;
 }
 
-BrushBuilder::~BrushBuilder()
+// Intersects planes 1 and 2 with each of the planes iFirst3 to iFirst3 + k_nKernelWidth - 1.
+// Only lanes set in activeMask are looked at. Writes the points out and returns a mask of the lanes
+// that had a single intersection which is inside of the brush. pSolvedMask gets the lanes that had a single intersection at all,
+// pRecullMask the ones that were too close to a plane to call in float and were culled again in double
+typedef uint32_t ( *PlaneTripleKernel )( const BrushSoA& soa, int iPlane1, int iPlane2, int iFirst3, uint32_t activeMask, float* px, float* py, float* pz, uint32_t* pSolvedMask, uint32_t* pRecullMask );
+
+// Culls the lanes in recullMask again in double, dropping any that are outside from validMask
+inline void RecullDouble( const BrushSoA& soa, uint32_t recullMask, const float* px, const float* py, const float* pz, uint32_t& validMask )
 {
-	delete[] m_pEdgePairs;
+	for ( int lane = 0; recullMask; lane++, recullMask >>= 1 )
+	{
+		if ( ( recullMask & 1 ) && !PointInsideDouble( soa, px[lane], py[lane], pz[lane] ) )
+			validMask &= ~( 1u << lane );
+	}
 }
 
-void BrushBuilder::BeginBrush( int nPlanes )
+uint32_t PlaneTriplesScalar( const BrushSoA& soa, int iPlane1, int iPlane2, int iFirst3, uint32_t activeMask, float* px, float* py, float* pz, uint32_t* pSolvedMask, uint32_t* pRecullMask )
 {
-	// Each plane can share an edge with another plane.
-	// If each plane were to interact with every other plane (including itself), that'd be n^2 edges
-	// We can optimize this down, as an edge between plane1 and plane2 is the same as an edge between plane2 and plane1
-	// We also don't care about interactions between plane1 and plane1, as the a plane cannot intersect with itself
-	// This is just the formula to find the nth triangular number, but we're subtracting 1 off nPlanes
-	int nPotentialEdges = ( nPlanes - 1 ) * nPlanes / 2;
-
-	// If we need more space, then resize our pairs
-	if ( nPotentialEdges > m_nEdgeCapacity )
+	double n1x = soa.nx[iPlane1], n1y = soa.ny[iPlane1], n1z = soa.nz[iPlane1], d1 = soa.dist[iPlane1];
+	double n2x = soa.nx[iPlane2], n2y = soa.ny[iPlane2], n2z = soa.nz[iPlane2], d2 = soa.dist[iPlane2];
+
+	// n1 x n2 is the same for every lane
+	double c12x = n1y * n2z - n1z * n2y;
+	double c12y = n1z * n2x - n1x * n2z;
+	double c12z = n1x * n2y - n1y * n2x;
+
+	uint32_t validMask = 0;
+	uint32_t solvedMask = 0;
+	uint32_t recullMask = 0;
+	for ( int lane = 0; lane < k_nKernelWidth; lane++ )
 	{
-		delete[] m_pEdgePairs;
-		m_pEdgePairs = new EdgePair[nPotentialEdges];
-		m_nEdgeCapacity = nPotentialEdges;
+		if ( !( activeMask & ( 1u << lane ) ) )
+			continue;
+
+		int i3 = iFirst3 + lane;
+		double n3x = soa.nx[i3], n3y = soa.ny[i3], n3z = soa.nz[i3], d3 = soa.dist[i3];
+
+		// n2 x n3 and n3 x n1
+		double c23x = n2y * n3z - n2z * n3y;
+		double c23y = n2z * n3x - n2x * n3z;
+		double c23z = n2x * n3y - n2y * n3x;
+		double c31x = n3y * n1z - n3z * n1y;
+		double c31y = n3z * n1x - n3x * n1z;
+		double c31z = n3x * n1y - n3y * n1x;
+
+		double det = n1x * c23x + n1y * c23y + n1z * c23z;
+		if ( !( fabs( det ) > k_flDetEpsilon ) )
+			continue;
+		solvedMask |= 1u << lane;
+
+		float x = (float)( ( d1 * c23x + d2 * c31x + d3 * c12x ) / det );
+		float y = (float)( ( d1 * c23y + d2 * c31y + d3 * c12y ) / det );
+		float z = (float)( ( d1 * c23z + d2 * c31z + d3 * c12z ) / det );
+
+		// Cull points outside of the solid. Anything that comes within the error of k_flEpsilon is left for double
+		float flError = soa.flCullNormalError * ( fabsf( x ) + fabsf( y ) + fabsf( z ) ) + soa.flCullDistError;
+		float flOutside = k_flEpsilon + flError;
+		float flMaxDist = -FLT_MAX;
+		bool inside = true;
+		if ( soa.nBoxCull )
+		{
+			const float* pBox = soa.cullDist.data();
+			float flBoxDist[6] = { x - pBox[0], -x - pBox[1], y - pBox[2], -y - pBox[3], z - pBox[4], -z - pBox[5] };
+			for ( float flDist : flBoxDist )
+			{
+				if ( flDist > flOutside )
+				{
+					inside = false;
+					break;
+				}
+				flMaxDist = std::max( flMaxDist, flDist );
+			}
+			if ( !inside )
+				continue;
+		}
+		int nCull = soa.cullDist.size();
+		for ( int k = soa.nBoxCull; k < nCull; k++ )
+		{
+			float flDist = x * soa.cullX[k] + y * soa.cullY[k] + z * soa.cullZ[k] - soa.cullDist[k];
+			if ( flDist > flOutside )
+			{
+				inside = false;
+				break;
+			}
+			flMaxDist = std::max( flMaxDist, flDist );
+		}
+		if ( !inside )
+			continue;
+
+		px[lane] = x;
+		py[lane] = y;
+		pz[lane] = z;
+		validMask |= 1u << lane;
+		if ( flMaxDist >= k_flEpsilon - flError )
+			recullMask |= 1u << lane;
 	}
+	RecullDouble( soa, recullMask, px, py, pz, validMask );
+	*pSolvedMask = solvedMask;
+	*pRecullMask = recullMask;
+	return validMask;
+}
 
-	// Store the new values
-	m_nPlaneCount = nPlanes;
-	m_nEdgeCount = nPotentialEdges;
+#if PP_X86
+// Planes 1 and 2 broadcast out for the SSE2 solver
+struct TriplePairSSE2
+{
+	__m128d n1x, n1y, n1z, d1;
+	__m128d n2x, n2y, n2z, d2;
+	__m128d c12x, c12y, c12z;
+};
 
-	// Clear out the old data
-	memset( m_pEdgePairs, 0xFF, nPotentialEdges * sizeof( EdgePair ) );
-	m_vecVerts.clear();
+// Solves two triples in double. Returns a 2 bit mask of the lanes that have a single solution
+inline int SolveTriplesSSE2( const TriplePairSSE2& c, __m128d n3x, __m128d n3y, __m128d n3z, __m128d d3, __m128& x, __m128& y, __m128& z )
+{
+	__m128d c23x = _mm_sub_pd( _mm_mul_pd( c.n2y, n3z ), _mm_mul_pd( c.n2z, n3y ) );
+	__m128d c23y = _mm_sub_pd( _mm_mul_pd( c.n2z, n3x ), _mm_mul_pd( c.n2x, n3z ) );
+	__m128d c23z = _mm_sub_pd( _mm_mul_pd( c.n2x, n3y ), _mm_mul_pd( c.n2y, n3x ) );
+	__m128d c31x = _mm_sub_pd( _mm_mul_pd( n3y, c.n1z ), _mm_mul_pd( n3z, c.n1y ) );
+	__m128d c31y = _mm_sub_pd( _mm_mul_pd( n3z, c.n1x ), _mm_mul_pd( n3x, c.n1z ) );
+	__m128d c31z = _mm_sub_pd( _mm_mul_pd( n3x, c.n1y ), _mm_mul_pd( n3y, c.n1x ) );
+
+	__m128d det = _mm_add_pd( _mm_add_pd( _mm_mul_pd( c.n1x, c23x ), _mm_mul_pd( c.n1y, c23y ) ), _mm_mul_pd( c.n1z, c23z ) );
+	__m128d absDet = _mm_and_pd( det, _mm_castsi128_pd( _mm_set1_epi64x( 0x7FFFFFFFFFFFFFFFLL ) ) );
+	int mask = _mm_movemask_pd( _mm_cmpgt_pd( absDet, _mm_set1_pd( k_flDetEpsilon ) ) );
+
+	x = _mm_cvtpd_ps( _mm_div_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( c.d1, c23x ), _mm_mul_pd( c.d2, c31x ) ), _mm_mul_pd( d3, c.c12x ) ), det ) );
+	y = _mm_cvtpd_ps( _mm_div_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( c.d1, c23y ), _mm_mul_pd( c.d2, c31y ) ), _mm_mul_pd( d3, c.c12y ) ), det ) );
+	z = _mm_cvtpd_ps( _mm_div_pd( _mm_add_pd( _mm_add_pd( _mm_mul_pd( c.d1, c23z ), _mm_mul_pd( c.d2, c31z ) ), _mm_mul_pd( d3, c.c12z ) ), det ) );
+	return mask;
 }
 
-EdgePair& BrushBuilder::GetEdge( int x, int y )
+// Four lanes at a time, twice over
+uint32_t PlaneTriplesSSE2( const BrushSoA& soa, int iPlane1, int iPlane2, int iFirst3, uint32_t activeMask, float* px, float* py, float* pz, uint32_t* pSolvedMask, uint32_t* pRecullMask )
 {
-	// Ensure the lowest is always plane y
-	if ( x < y )
-		std::swap( x, y );
-	
-	// Get the index within our triangular array
-	// I thought indexing into this would be easier, but oh well!
+	double n1x = soa.nx[iPlane1], n1y = soa.ny[iPlane1], n1z = soa.nz[iPlane1];
+	double n2x = soa.nx[iPlane2], n2y = soa.ny[iPlane2], n2z = soa.nz[iPlane2];
+
+	TriplePairSSE2 c;
+	c.n1x = _mm_set1_pd( n1x ); c.n1y = _mm_set1_pd( n1y ); c.n1z = _mm_set1_pd( n1z ); c.d1 = _mm_set1_pd( soa.dist[iPlane1] );
+	c.n2x = _mm_set1_pd( n2x ); c.n2y = _mm_set1_pd( n2y ); c.n2z = _mm_set1_pd( n2z ); c.d2 = _mm_set1_pd( soa.dist[iPlane2] );
+	c.c12x = _mm_set1_pd( n1y * n2z - n1z * n2y );
+	c.c12y = _mm_set1_pd( n1z * n2x - n1x * n2z );
+	c.c12z = _mm_set1_pd( n1x * n2y - n1y * n2x );
+	const __m128 eps = _mm_set1_ps( k_flEpsilon );
+	const __m128 cullNormalError = _mm_set1_ps( soa.flCullNormalError );
+	const __m128 cullDistError = _mm_set1_ps( soa.flCullDistError );
+	const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7FFFFFFF ) );
+	const __m128 signMask = _mm_castsi128_ps( _mm_set1_epi32( 0x80000000 ) );
+
+	uint32_t validMask = 0;
+	uint32_t recullMask = 0;
+	*pSolvedMask = 0;
+	for ( int half = 0; half < k_nKernelWidth; half += 4 )
+	{
+		uint32_t laneMask = ( activeMask >> half ) & 0xF;
+		if ( !laneMask )
+			continue;
 
-	// Sum of an arithmetic series to get the row Y
-	int a1  = m_nPlaneCount - 1;
-	int an  = m_nPlaneCount - y;
-	int n   = y;
-	int sum = y * ( a1 + an ) / 2;
+		int i3 = iFirst3 + half;
+		__m128 n3x = _mm_loadu_ps( &soa.nx[i3] );
+		__m128 n3y = _mm_loadu_ps( &soa.ny[i3] );
+		__m128 n3z = _mm_loadu_ps( &soa.nz[i3] );
+		__m128 d3 = _mm_loadu_ps( &soa.dist[i3] );
+
+		// Low two lanes, then high two lanes
+		__m128 xLo, yLo, zLo, xHi, yHi, zHi;
+		int detMask = SolveTriplesSSE2( c, _mm_cvtps_pd( n3x ), _mm_cvtps_pd( n3y ), _mm_cvtps_pd( n3z ), _mm_cvtps_pd( d3 ), xLo, yLo, zLo );
+		detMask |= SolveTriplesSSE2( c, _mm_cvtps_pd( _mm_movehl_ps( n3x, n3x ) ), _mm_cvtps_pd( _mm_movehl_ps( n3y, n3y ) ),
+			_mm_cvtps_pd( _mm_movehl_ps( n3z, n3z ) ), _mm_cvtps_pd( _mm_movehl_ps( d3, d3 ) ), xHi, yHi, zHi ) << 2;
+		laneMask &= detMask;
+		*pSolvedMask |= laneMask << half;
+		if ( !laneMask )
+			continue;
 
-	// Get the index for column x
-	int idx = sum + (x - y - 1);
+		__m128 x = _mm_movelh_ps( xLo, xHi );
+		__m128 y = _mm_movelh_ps( yLo, yHi );
+		__m128 z = _mm_movelh_ps( zLo, zHi );
 
-	// return the edge!
-	return m_pEdgePairs[idx];
+		// Cull against every plane, dropping lanes as they fall outside and noting the ones too close to call
+		__m128 error = _mm_add_ps( _mm_mul_ps( cullNormalError, _mm_add_ps( _mm_add_ps( _mm_and_ps( x, absMask ), _mm_and_ps( y, absMask ) ), _mm_and_ps( z, absMask ) ) ), cullDistError );
+		__m128 outside = _mm_add_ps( eps, error );
+		__m128 maxDist = _mm_set1_ps( -FLT_MAX );
+		if ( soa.nBoxCull )
+		{
+			const float* pBox = soa.cullDist.data();
+			__m128 boxDist[6] = { x, _mm_xor_ps( x, signMask ), y, _mm_xor_ps( y, signMask ), z, _mm_xor_ps( z, signMask ) };
+			__m128 out = _mm_setzero_ps();
+			for ( int k = 0; k < 6; k++ )
+			{
+				__m128 d = _mm_sub_ps( boxDist[k], _mm_set1_ps( pBox[k] ) );
+				out = _mm_or_ps( out, _mm_cmpgt_ps( d, outside ) );
+				maxDist = _mm_max_ps( maxDist, d );
+			}
+			laneMask &= ~_mm_movemask_ps( out );
+		}
+		int nCull = soa.cullDist.size();
+		for ( int k = soa.nBoxCull; k < nCull && laneMask; k++ )
+		{
+			__m128 d = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, _mm_set1_ps( soa.cullX[k] ) ), _mm_mul_ps( y, _mm_set1_ps( soa.cullY[k] ) ) ), _mm_mul_ps( z, _mm_set1_ps( soa.cullZ[k] ) ) ), _mm_set1_ps( soa.cullDist[k] ) );
+			laneMask &= ~_mm_movemask_ps( _mm_cmpgt_ps( d, outside ) );
+			maxDist = _mm_max_ps( maxDist, d );
+		}
+		uint32_t unsureMask = _mm_movemask_ps( _mm_cmpge_ps( maxDist, _mm_sub_ps( eps, error ) ) );
+
+		_mm_storeu_ps( px + half, x );
+		_mm_storeu_ps( py + half, y );
+		_mm_storeu_ps( pz + half, z );
+		validMask |= laneMask << half;
+		recullMask |= ( laneMask & unsureMask ) << half;
+	}
+	RecullDouble( soa, recullMask, px, py, pz, validMask );
+	*pRecullMask = recullMask;
+	return validMask;
 }
 
-bool BrushBuilder::PushPartialEdge( int x, int y, uint32_t iVertex )
+// Planes 1 and 2 broadcast out for the AVX2 solver
+struct TriplePairAVX2
 {
-	EdgePair& edge = GetEdge( x, y );
-
+	__m256d n1x, n1y, n1z, d1;
+	__m256d n2x, n2y, n2z, d2;
+	__m256d c12x, c12y, c12z;
+};
 
-	// If it's already on the edge, ignore the request
-	if ( edge.iVertex1 == iVertex || edge.iVertex2 == iVertex )
-	{
-		// We need to still return true if the edge is full!
-		// One of the two verts are already valid, we always fill iVertex1 first, so iVertex2 is either valid or invalid
-		return edge.iVertex2 == k_iInvalidVertex ? false : true;
-	}
+// Solves four triples in double. Returns a 4 bit mask of the lanes that have a single solution
+PP_TARGET_AVX2 inline int SolveTriplesAVX2( const TriplePairAVX2& c, __m256d n3x, __m256d n3y, __m256d n3z, __m256d d3, __m128& x, __m128& y, __m128& z )
+{
+	__m256d c23x = _mm256_sub_pd( _mm256_mul_pd( c.n2y, n3z ), _mm256_mul_pd( c.n2z, n3y ) );
+	__m256d c23y = _mm256_sub_pd( _mm256_mul_pd( c.n2z, n3x ), _mm256_mul_pd( c.n2x, n3z ) );
+	__m256d c23z = _mm256_sub_pd( _mm256_mul_pd( c.n2x, n3y ), _mm256_mul_pd( c.n2y, n3x ) );
+	__m256d c31x = _mm256_sub_pd( _mm256_mul_pd( n3y, c.n1z ), _mm256_mul_pd( n3z, c.n1y ) );
+	__m256d c31y = _mm256_sub_pd( _mm256_mul_pd( n3z, c.n1x ), _mm256_mul_pd( n3x, c.n1z ) );
+	__m256d c31z = _mm256_sub_pd( _mm256_mul_pd( n3x, c.n1y ), _mm256_mul_pd( n3y, c.n1x ) );
+
+	__m256d det = _mm256_add_pd( _mm256_add_pd( _mm256_mul_pd( c.n1x, c23x ), _mm256_mul_pd( c.n1y, c23y ) ), _mm256_mul_pd( c.n1z, c23z ) );
+	__m256d absDet = _mm256_and_pd( det, _mm256_castsi256_pd( _mm256_set1_epi64x( 0x7FFFFFFFFFFFFFFFLL ) ) );
+	int mask = _mm256_movemask_pd( _mm256_cmp_pd( absDet, _mm256_set1_pd( k_flDetEpsilon ), _CMP_GT_OQ ) );
+
+	x = _mm256_cvtpd_ps( _mm256_div_pd( _mm256_add_pd( _mm256_add_pd( _mm256_mul_pd( c.d1, c23x ), _mm256_mul_pd( c.d2, c31x ) ), _mm256_mul_pd( d3, c.c12x ) ), det ) );
+	y = _mm256_cvtpd_ps( _mm256_div_pd( _mm256_add_pd( _mm256_add_pd( _mm256_mul_pd( c.d1, c23y ), _mm256_mul_pd( c.d2, c31y ) ), _mm256_mul_pd( d3, c.c12y ) ), det ) );
+	z = _mm256_cvtpd_ps( _mm256_div_pd( _mm256_add_pd( _mm256_add_pd( _mm256_mul_pd( c.d1, c23z ), _mm256_mul_pd( c.d2, c31z ) ), _mm256_mul_pd( d3, c.c12z ) ), det ) );
+	return mask;
+}
 
-	// Fill iVertex1 first
-	if ( edge.iVertex1 == k_iInvalidVertex )
+// All eight lanes at once
+PP_TARGET_AVX2 uint32_t PlaneTriplesAVX2( const BrushSoA& soa, int iPlane1, int iPlane2, int iFirst3, uint32_t activeMask, float* px, float* py, float* pz, uint32_t* pSolvedMask, uint32_t* pRecullMask )
+{
+	double n1x = soa.nx[iPlane1], n1y = soa.ny[iPlane1], n1z = soa.nz[iPlane1];
+	double n2x = soa.nx[iPlane2], n2y = soa.ny[iPlane2], n2z = soa.nz[iPlane2];
+
+	TriplePairAVX2 c;
+	c.n1x = _mm256_set1_pd( n1x ); c.n1y = _mm256_set1_pd( n1y ); c.n1z = _mm256_set1_pd( n1z ); c.d1 = _mm256_set1_pd( soa.dist[iPlane1] );
+	c.n2x = _mm256_set1_pd( n2x ); c.n2y = _mm256_set1_pd( n2y ); c.n2z = _mm256_set1_pd( n2z ); c.d2 = _mm256_set1_pd( soa.dist[iPlane2] );
+	c.c12x = _mm256_set1_pd( n1y * n2z - n1z * n2y );
+	c.c12y = _mm256_set1_pd( n1z * n2x - n1x * n2z );
+	c.c12z = _mm256_set1_pd( n1x * n2y - n1y * n2x );
+	const __m256 eps = _mm256_set1_ps( k_flEpsilon );
+
+	uint32_t laneMask = activeMask & 0xFF;
+	__m256 n3x = _mm256_loadu_ps( &soa.nx[iFirst3] );
+	__m256 n3y = _mm256_loadu_ps( &soa.ny[iFirst3] );
+	__m256 n3z = _mm256_loadu_ps( &soa.nz[iFirst3] );
+	__m256 d3 = _mm256_loadu_ps( &soa.dist[iFirst3] );
+
+	// Low four lanes, then high four lanes
+	__m128 xLo, yLo, zLo, xHi, yHi, zHi;
+	int detMask = SolveTriplesAVX2( c, _mm256_cvtps_pd( _mm256_castps256_ps128( n3x ) ), _mm256_cvtps_pd( _mm256_castps256_ps128( n3y ) ),
+		_mm256_cvtps_pd( _mm256_castps256_ps128( n3z ) ), _mm256_cvtps_pd( _mm256_castps256_ps128( d3 ) ), xLo, yLo, zLo );
+	detMask |= SolveTriplesAVX2( c, _mm256_cvtps_pd( _mm256_extractf128_ps( n3x, 1 ) ), _mm256_cvtps_pd( _mm256_extractf128_ps( n3y, 1 ) ),
+		_mm256_cvtps_pd( _mm256_extractf128_ps( n3z, 1 ) ), _mm256_cvtps_pd( _mm256_extractf128_ps( d3, 1 ) ), xHi, yHi, zHi ) << 4;
+	laneMask &= detMask;
+	*pSolvedMask = laneMask;
+	*pRecullMask = 0;
+	if ( !laneMask )
+		return 0;
+
+	__m256 x = _mm256_insertf128_ps( _mm256_castps128_ps256( xLo ), xHi, 1 );
+	__m256 y = _mm256_insertf128_ps( _mm256_castps128_ps256( yLo ), yHi, 1 );
+	__m256 z = _mm256_insertf128_ps( _mm256_castps128_ps256( zLo ), zHi, 1 );
+
+	// Cull against every plane, dropping lanes as they fall outside and noting the ones too close to call
+	const __m256 absMask = _mm256_castsi256_ps( _mm256_set1_epi32( 0x7FFFFFFF ) );
+	__m256 error = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( soa.flCullNormalError ), _mm256_add_ps( _mm256_add_ps( _mm256_and_ps( x, absMask ), _mm256_and_ps( y, absMask ) ), _mm256_and_ps( z, absMask ) ) ),
+		_mm256_set1_ps( soa.flCullDistError ) );
+	__m256 outside = _mm256_add_ps( eps, error );
+	__m256 maxDist = _mm256_set1_ps( -FLT_MAX );
+	if ( soa.nBoxCull )
 	{
-		edge.iVertex1 = iVertex;
-		return false;
+		const float* pBox = soa.cullDist.data();
+		const __m256 signMask = _mm256_castsi256_ps( _mm256_set1_epi32( 0x80000000 ) );
+		__m256 boxDist[6] = { x, _mm256_xor_ps( x, signMask ), y, _mm256_xor_ps( y, signMask ), z, _mm256_xor_ps( z, signMask ) };
+		__m256 out = _mm256_setzero_ps();
+		for ( int k = 0; k < 6; k++ )
+		{
+			__m256 d = _mm256_sub_ps( boxDist[k], _mm256_set1_ps( pBox[k] ) );
+			out = _mm256_or_ps( out, _mm256_cmp_ps( d, outside, _CMP_GT_OQ ) );
+			maxDist = _mm256_max_ps( maxDist, d );
+		}
+		laneMask &= ~_mm256_movemask_ps( out );
 	}
-	
-	// Fill iVertex2 last
-	if ( edge.iVertex2 == k_iInvalidVertex )
+	int nCull = soa.cullDist.size();
+	for ( int k = soa.nBoxCull; k < nCull && laneMask; k++ )
 	{
-		edge.iVertex2 = iVertex;
-		return true;
+		__m256 d = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( x, _mm256_set1_ps( soa.cullX[k] ) ), _mm256_mul_ps( y, _mm256_set1_ps( soa.cullY[k] ) ) ), _mm256_mul_ps( z, _mm256_set1_ps( soa.cullZ[k] ) ) ), _mm256_set1_ps( soa.cullDist[k] ) );
+		laneMask &= ~_mm256_movemask_ps( _mm256_cmp_ps( d, outside, _CMP_GT_OQ ) );
+		maxDist = _mm256_max_ps( maxDist, d );
 	}
-
-	// Uh oh, pushing a third vert?
-	const Vector3& v1 = m_vecVerts[edge.iVertex1];
-	const Vector3& v2 = m_vecVerts[edge.iVertex2];
-	const Vector3& v3 = m_vecVerts[iVertex];
-	/*
-	std::cout << "Hey!! The edge (" << x << "," << y << ") already has two verts!\n";
-	std::cout << "\t Vertex 1 : " << v1.x << ", " << v1.y << ", " << v1.z << "\n";
-	std::cout << "\t Vertex 2 : " << v2.x << ", " << v2.y << ", " << v2.z << "\n";
-	std::cout << "\t Vertex 3 : " << v3.x << ", " << v3.y << ", " << v3.z << "\n";
-	*/
-	return true;
+	uint32_t unsureMask = _mm256_movemask_ps( _mm256_cmp_ps( maxDist, _mm256_sub_ps( eps, error ), _CMP_GE_OQ ) );
+
+	_mm256_storeu_ps( px, x );
+	_mm256_storeu_ps( py, y );
+	_mm256_storeu_ps( pz, z );
+	uint32_t recullMask = laneMask & unsureMask;
+	RecullDouble( soa, recullMask, px, py, pz, laneMask );
+	*pRecullMask = recullMask;
+	return laneMask;
 }
 
-
-uint32_t BrushBuilder::StoreVertex( const Vector3& newVert )
+bool CPUHasAVX2()
 {
-	// Ideally, we'd just be using std::set or std::unordered_set, but both are being a pain to use..
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid( info, 0 );
+	if ( info[0] < 7 )
+		return false;
 
-	// Find a vert with the value close enough to our newVert
-	int n = m_vecVerts.size();
-	for ( int i = 0; i < n; i++ )
-	{
-		const Vector3& curVert = m_vecVerts[i];
-		if ( IsNear( curVert.x, newVert.x ) && IsNear( curVert.y, newVert.y ) && IsNear( curVert.z, newVert.z ) )
-			return i;
-	}
+	// The OS has to be saving the AVX registers too
+	__cpuid( info, 1 );
+	bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+	bool avx = ( info[2] & ( 1 << 28 ) ) != 0;
+	if ( !osxsave || !avx || ( _xgetbv( 0 ) & 6 ) != 6 )
+		return false;
 
-	// No duplicate found! We'll need to store it then
-	int idx = m_vecVerts.size();
-	m_vecVerts.push_back( newVert );
-	return idx;
+	__cpuidex( info, 7, 0 );
+	return ( info[1] & ( 1 << 5 ) ) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports( "avx2" );
+#endif
 }
+#endif
 
-
-void BrushBuilder::Build( Brush& brush )
+// The fastest kernel this machine can run
+BuildKernel DetectBuildKernel()
 {
-	int nPlanes = brush.planes.size();
+#if PP_X86
+	if ( CPUHasAVX2() )
+		return BuildKernel::AVX2;
+	return BuildKernel::SSE2;
+#else
+	return BuildKernel::Scalar;
+#endif
+}
 
-	// We need at least 4 plans for a brush
-	if (nPlanes < 4)
+bool BuildKernelSupported( BuildKernel kernel )
+{
+	switch ( kernel )
 	{
-		std::cout << "Less than 4 planes!\n";
-		return;
+	case BuildKernel::Reference:
+	case BuildKernel::Scalar:
+		return true;
+#if PP_X86
+	case BuildKernel::SSE2:
+		return true;
+	case BuildKernel::AVX2:
+		return CPUHasAVX2();
+#endif
+	default:
+		return false;
+	}
+}
+
+PlaneTripleKernel GetPlaneTripleKernel( BuildKernel kernel )
+{
+	switch ( kernel )
+	{
+#if PP_X86
+	case BuildKernel::SSE2:	return PlaneTriplesSSE2;
+	case BuildKernel::AVX2:	return PlaneTriplesAVX2;
+#endif
+	default:				return PlaneTriplesScalar;
+	}
+}
+
+// What new BrushBuilders use unless told otherwise
+BuildKernel g_defaultBuildKernel = DetectBuildKernel();
+
+// How a BrushBuilder goes about finding edges
+enum class BuildMethod
+{
+	Triples,	// Intersect every triple of planes and keep the points inside the brush. O(n^4)
+	Clip,		// Clip a huge polygon on each plane to find which others it meets, then only try those triples. Same output
+	Auto,		// Triples for small brushes, clipping from k_nClipPlaneCount planes up
+};
+
+// Below this the batched triple kernels are still quicker than clipping first. They break even around 24 planes
+constexpr int k_nClipPlaneCount = 24;
+
+// Half the width of the polygon every face starts as. Bigger than any map
+constexpr double k_flClipBaseSize = 1048576.0;
+
+// How far past the brush faces are clipped out to when looking for which planes meet. The triple builders keep corners
+// up to k_flEpsilon outside, and their solvers can put a corner a good way further out than that on big coordinates
+constexpr double k_flClipSlack = 0.25;
+
+const char* BuildMethodName( BuildMethod method )
+{
+	switch ( method )
+	{
+	case BuildMethod::Triples:	return "triples";
+	case BuildMethod::Clip:		return "clip";
+	default:					return "auto";
+	}
+}
+
+BuildMethod g_defaultBuildMethod = BuildMethod::Triples;
+
+// Corner of a face polygon while it's being clipped. Done in double since the polygons start out enormous
+struct ClipVertex
+{
+	double x, y, z;
+};
+
+// Each edge pair corresponds to two planes
+constexpr uint32_t k_iInvalidVertex = 0xFFFFFFFF;
+struct EdgePair
+{
+	uint32_t iVertex1;
+	uint32_t iVertex2;
+};
+
+// Past this many vertices, StoreVertex switches from scanning every vertex to the spatial hash.
+// Below it a scan is cheaper than probing 8 cubes, see -benchweld
+constexpr int k_nWeldHashVerts = 64;
+
+// The batched kernels don't put points exactly where mat3x3_solve does, so two corners that are right about k_flEpsilon
+// apart can weld for one and not the other. Comparisons within this of k_flEpsilon are too close to call from a kernel's
+// points, and get settled by solving both points again the reference's way. How far off they can be grows with how far
+// out the point is, so the band does too
+constexpr float k_flWeldBand = 0.5f * k_flEpsilon;
+constexpr float k_flWeldBandScale = 4e-6f;
+
+float WeldBandFor( const Vector3& v )
+{
+	float flMax = std::max( { std::fabs( v.x ), std::fabs( v.y ), std::fabs( v.z ) } );
+	return std::max( k_flWeldBand, flMax * k_flWeldBandScale );
+}
+
+enum class WeldMatch
+{
+	Far,
+	Near,
+	Unsure,		// Within flBand of k_flEpsilon on some axis
+};
+
+// IsNear on every axis, with flBand either side of k_flEpsilon left to be decided some other way. With no band it's
+// exactly IsNear
+WeldMatch CompareForWeld( const Vector3& a, const Vector3& b, float flBand )
+{
+	WeldMatch match = WeldMatch::Near;
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( !IsNear( a[i], b[i], k_flEpsilon + flBand ) )
+			return WeldMatch::Far;
+		if ( !IsNear( a[i], b[i], k_flEpsilon - flBand ) )
+			match = WeldMatch::Unsure;
+	}
+	return match;
+}
+
+// Spatial hash for welding vertices. Space is cut into cubes twice k_flEpsilon plus k_flWeldBand wide. On each axis, anything
+// that close to a point is either in the same cube or the neighbour on whichever side the point is closer to, so only 8
+// cubes are ever looked in.
+// Slots are stamped with the brush they belong to, so moving on to the next brush doesn't wipe the table
+class VertexWeldHash
+{
+public:
+	void Clear() { m_nCount = 0; m_iStamp++; }
+
+	// Returns the lowest index of a vertex IsNear v, same as scanning them in order would, or k_iInvalidVertex.
+	// Comparisons CompareForWeld is unsure of with flBand go to resolve( iVert ). The cubes are only big enough for
+	// a band up to k_flWeldBand
+	template <typename Resolve>
+	uint32_t Find( const std::vector<Vector3>& verts, const Vector3& v, float flBand, Resolve&& resolve ) const;
+
+	// Adds verts[iVert]
+	void Insert( const std::vector<Vector3>& verts, uint32_t iVert );
+
+private:
+	// Slots only hold the vertex index. Cubes that land in the same run of slots just cost an extra IsNear
+	struct Slot
+	{
+		uint32_t iVert;
+		uint32_t iStamp;
+	};
+
+	static constexpr double k_flCellScale = 1.0 / ( 2.0 * ( (double)k_flEpsilon + k_flWeldBand ) );
+
+	size_t SlotFor( int64_t x, int64_t y, int64_t z ) const
+	{
+		return HashMix( x * 73856093ull ^ y * 19349663ull ^ z * 83492791ull ) & ( m_vecSlots.size() - 1 );
+	}
+
+	size_t SlotFor( const Vector3& v ) const
+	{
+		return SlotFor( (int64_t)floor( v.x * k_flCellScale ), (int64_t)floor( v.y * k_flCellScale ), (int64_t)floor( v.z * k_flCellScale ) );
+	}
+
+	void Grow( const std::vector<Vector3>& verts );
+
+	std::vector<Slot> m_vecSlots;
+	size_t m_nCount = 0;
+	uint32_t m_iStamp = 1;
+};
+
+template <typename Resolve>
+uint32_t VertexWeldHash::Find( const std::vector<Vector3>& verts, const Vector3& v, float flBand, Resolve&& resolve ) const
+{
+	if ( m_vecSlots.empty() )
+		return k_iInvalidVertex;
+
+	// The cube v is in, and on each axis the neighbour on whichever side v is closer to
+	int64_t cells[3][2];
+	for ( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		double q = ( iAxis == 0 ? v.x : iAxis == 1 ? v.y : v.z ) * k_flCellScale;
+		double cell = floor( q );
+		cells[iAxis][0] = (int64_t)cell;
+		cells[iAxis][1] = (int64_t)cell + ( q - cell < 0.5 ? -1 : 1 );
+	}
+
+	size_t mask = m_vecSlots.size() - 1;
+	uint32_t iBest = k_iInvalidVertex;
+	for ( int64_t x : cells[0] )
+	{
+		for ( int64_t y : cells[1] )
+		{
+			for ( int64_t z : cells[2] )
+			{
+				// Linear probing. A cube can hold more than one vertex, so keep going to the first empty slot
+				for ( size_t i = SlotFor( x, y, z ); m_vecSlots[i].iStamp == m_iStamp; i = ( i + 1 ) & mask )
+				{
+					uint32_t iVert = m_vecSlots[i].iVert;
+					if ( iVert >= iBest )
+						continue;
+
+					WeldMatch match = CompareForWeld( verts[iVert], v, flBand );
+					if ( match == WeldMatch::Near || ( match == WeldMatch::Unsure && resolve( iVert ) ) )
+						iBest = iVert;
+				}
+			}
+		}
+	}
+	return iBest;
+}
+
+void VertexWeldHash::Insert( const std::vector<Vector3>& verts, uint32_t iVert )
+{
+	// Stay under half full so probe runs stay short
+	if ( ( m_nCount + 1 ) * 2 > m_vecSlots.size() )
+		Grow( verts );
+
+	size_t mask = m_vecSlots.size() - 1;
+	size_t i = SlotFor( verts[iVert] );
+	while ( m_vecSlots[i].iStamp == m_iStamp )
+		i = ( i + 1 ) & mask;
+	m_vecSlots[i] = { iVert, m_iStamp };
+	m_nCount++;
+}
+
+void VertexWeldHash::Grow( const std::vector<Vector3>& verts )
+{
+	std::vector<Slot> old;
+	old.swap( m_vecSlots );
+	m_vecSlots.resize( std::max<size_t>( 64, old.size() * 2 ) );
+
+	// Fresh slots are stamped 0, which is never a live stamp
+	size_t mask = m_vecSlots.size() - 1;
+	for ( const Slot& slot : old )
+	{
+		if ( slot.iStamp != m_iStamp )
+			continue;
+
+		size_t i = SlotFor( verts[slot.iVert] );
+		while ( m_vecSlots[i].iStamp == m_iStamp )
+			i = ( i + 1 ) & mask;
+		m_vecSlots[i] = slot;
+	}
+}
+
+// Returns the index of a vertex in verts that IsNear v, adding v to the end if there isn't one.
+// Given a hash, it's used instead of scanning once there are more than k_nWeldHashVerts vertices.
+// With a band, comparisons within it of k_flEpsilon are decided by resolve( iVert ) instead, see k_flWeldBand
+template <typename Resolve>
+uint32_t WeldVertex( std::vector<Vector3>& verts, VertexWeldHash* pHash, const Vector3& v, float flBand, Resolve&& resolve )
+{
+	int n = verts.size();
+	if ( pHash && n > k_nWeldHashVerts && flBand <= k_flWeldBand )
+	{
+		uint32_t iVert = pHash->Find( verts, v, flBand, resolve );
+		if ( iVert != k_iInvalidVertex )
+			return iVert;
+	}
+	else
+	{
+		// Find a vert with the value close enough to v
+		for ( int i = 0; i < n; i++ )
+		{
+			WeldMatch match = CompareForWeld( verts[i], v, flBand );
+			if ( match == WeldMatch::Near || ( match == WeldMatch::Unsure && resolve( i ) ) )
+				return i;
+		}
+	}
+
+	// No duplicate found! We'll need to store it then
+	int idx = verts.size();
+	verts.push_back( v );
+
+	// Just got big enough for the hash, so it needs everything so far
+	if ( pHash && idx == k_nWeldHashVerts )
+	{
+		for ( int i = 0; i <= idx; i++ )
+			pHash->Insert( verts, i );
+	}
+	else if ( pHash && idx > k_nWeldHashVerts )
+		pHash->Insert( verts, idx );
+	return idx;
+}
+
+uint32_t WeldVertex( std::vector<Vector3>& verts, VertexWeldHash* pHash, const Vector3& v )
+{
+	return WeldVertex( verts, pHash, v, 0.0f, []( uint32_t ) { return false; } );
+}
+
+// Set of edges already emitted for a brush, by vertex index. Welded vertices are never equal
+// unless they're the same vertex, so comparing indices is the same as comparing positions
+class EdgeIndexSet
+{
+public:
+	void Clear() { m_nCount = 0; m_iStamp++; }
+
+	// Returns false if the edge, either way around, was already in the set
+	bool Insert( uint32_t iVert1, uint32_t iVert2 );
+
+private:
+	struct Slot
+	{
+		uint64_t key;
+		uint32_t iStamp;
+	};
+
+	void Grow();
+
+	std::vector<Slot> m_vecSlots;
+	size_t m_nCount = 0;
+	uint32_t m_iStamp = 1;
+};
+
+bool EdgeIndexSet::Insert( uint32_t iVert1, uint32_t iVert2 )
+{
+	if ( ( m_nCount + 1 ) * 2 > m_vecSlots.size() )
+		Grow();
+
+	if ( iVert1 > iVert2 )
+		std::swap( iVert1, iVert2 );
+	uint64_t key = ( (uint64_t)iVert1 << 32 ) | iVert2;
+
+	size_t mask = m_vecSlots.size() - 1;
+	size_t i = HashMix( key ) & mask;
+	for ( ; m_vecSlots[i].iStamp == m_iStamp; i = ( i + 1 ) & mask )
+	{
+		if ( m_vecSlots[i].key == key )
+			return false;
+	}
+	m_vecSlots[i] = { key, m_iStamp };
+	m_nCount++;
+	return true;
+}
+
+void EdgeIndexSet::Grow()
+{
+	std::vector<Slot> old;
+	old.swap( m_vecSlots );
+	m_vecSlots.resize( std::max<size_t>( 64, old.size() * 2 ) );
+
+	size_t mask = m_vecSlots.size() - 1;
+	for ( const Slot& slot : old )
+	{
+		if ( slot.iStamp != m_iStamp )
+			continue;
+
+		size_t i = HashMix( slot.key ) & mask;
+		while ( m_vecSlots[i].iStamp == m_iStamp )
+			i = ( i + 1 ) & mask;
+		m_vecSlots[i] = slot;
+	}
+}
+
+inline int CountBits( uint32_t mask )
+{
+	int n = 0;
+	for ( ; mask; mask &= mask - 1 )
+		n++;
+	return n;
+}
+
+// Highest plane count in each bucket of the per brush cost histogram
+constexpr int k_nStatsBucketLimits[] = { 6, 8, 10, 12, 16, 20, 24, 32, 48, 64, 128, 256, INT_MAX };
+constexpr int k_nStatsBuckets = sizeof( k_nStatsBucketLimits ) / sizeof( k_nStatsBucketLimits[0] );
+
+// What a BrushBuilder has been up to, for -stats. Every builder counts for itself, so nothing is shared between threads
+struct BuildStats
+{
+	uint64_t nBrushes = 0;
+	uint64_t nTooFewPlanes = 0;		// Brushes with less than 4 planes, which aren't built at all
+	uint64_t nBoxBrushes = 0;		// Box brushes that had their edges read straight off of the planes
+	uint64_t nDuplicatePlanes = 0;	// Planes left out for being within epsilon of another one all over the brush's box
+	uint64_t nRedundantPlanes = 0;	// Planes left out for not touching the brush's box at all
+	uint64_t nTriples = 0;			// Triples of planes solved
+	uint64_t nParallelSkips = 0;	// Pairs of planes ShouldSkipPlane turned away, or with clip, that never meet
+	uint64_t nSolveFailures = 0;	// Triples with no single point where they meet
+	uint64_t nPointsCulled = 0;		// Points that TestPointInBrush (or a kernel) found outside of the brush
+	uint64_t nRecullPoints = 0;		// Points a kernel found too close to a plane to call in float and culled again in double
+	uint64_t nClipTests = 0;		// Faces clipped against a plane by the clip builder
+	uint64_t nVertsWelded = 0;		// Points that landed on a vertex already found
+	uint64_t nEdgesDropped = 0;		// Edges found twice
+
+	// Brushes built and the time they took, by plane count. Only timed if the builder was told to, see SetTiming
+	uint64_t nBucketBrushes[k_nStatsBuckets] = {};
+	uint64_t nBucketNanos[k_nStatsBuckets] = {};
+	uint64_t nBucketMaxNanos[k_nStatsBuckets] = {};
+
+	void Add( const BuildStats& other );
+	static int BucketFor( int nPlanes );
+};
+
+void BuildStats::Add( const BuildStats& other )
+{
+	nBrushes += other.nBrushes;
+	nTooFewPlanes += other.nTooFewPlanes;
+	nBoxBrushes += other.nBoxBrushes;
+	nDuplicatePlanes += other.nDuplicatePlanes;
+	nRedundantPlanes += other.nRedundantPlanes;
+	nTriples += other.nTriples;
+	nParallelSkips += other.nParallelSkips;
+	nSolveFailures += other.nSolveFailures;
+	nPointsCulled += other.nPointsCulled;
+	nRecullPoints += other.nRecullPoints;
+	nClipTests += other.nClipTests;
+	nVertsWelded += other.nVertsWelded;
+	nEdgesDropped += other.nEdgesDropped;
+	for ( int i = 0; i < k_nStatsBuckets; i++ )
+	{
+		nBucketBrushes[i] += other.nBucketBrushes[i];
+		nBucketNanos[i] += other.nBucketNanos[i];
+		nBucketMaxNanos[i] = std::max( nBucketMaxNanos[i], other.nBucketMaxNanos[i] );
+	}
+}
+
+int BuildStats::BucketFor( int nPlanes )
+{
+	int i = 0;
+	while ( nPlanes > k_nStatsBucketLimits[i] )
+		i++;
+	return i;
+}
+
+// A point a kernel was too close to a plane to cull in float: the three planes of the prepared brush it's on, and
+// whether it was still inside when culled again in double
+struct RecullPoint
+{
+	int iPlane1, iPlane2, iPlane3;
+	bool inside;
+};
+
+// Util class for building brush edge lists
+class BrushBuilder
+{
+public:
+	BrushBuilder();
+	~BrushBuilder();
+
+
+	void Build( Brush& brush );
+
+	void SetKernel( BuildKernel kernel ) { m_kernel = kernel; }
+	BuildKernel GetKernel() const { return m_kernel; }
+
+	void SetMethod( BuildMethod method ) { m_method = method; }
+	BuildMethod GetMethod() const { return m_method; }
+
+	// Turn off to go back to scanning every vertex and edge for duplicates. Same results, only for -benchweld
+	void SetHashing( bool bHashing ) { m_bHashing = bHashing; }
+
+	// Appends every point a kernel had to cull again in double, kept or not. Only for -verifykernels
+	void SetRecullLog( std::vector<RecullPoint>* pRecullLog ) { m_pRecullLog = pRecullLog; }
+
+	// Has the reference kernel take what double made of these points instead of culling them in float, to see whether
+	// they're all a kernel differs over. Only for -verifykernels
+	void SetCullOverrides( const std::vector<RecullPoint>* pCullOverrides ) { m_pCullOverrides = pCullOverrides; }
+
+	// Counters are always kept, timing each brush for the histogram only happens when turned on
+	void SetTiming( bool bTiming ) { m_bTiming = bTiming; }
+	bool GetTiming() const { return m_bTiming; }
+	const BuildStats& GetStats() const { return m_stats; }
+	void AddStats( const BuildStats& stats ) { m_stats.Add( stats ); }
+	void ResetStats() { m_stats = {}; }
+
+private:
+
+	void BeginBrush( int nPlanes );
+
+	// Copies the planes worth building from into m_prep, in the same order, and works out which pairs of them are parallel
+	void PreparePlanes( const Brush& brush );
+
+	// Would ShouldSkipPlane turn away planes i and j of m_prep? With clip, also whether their faces never meet
+	bool IsParallel( int i, int j ) const { return ( m_parallel[i * m_nParallelWords + ( j >> 6 )] >> ( j & 63 ) ) & 1; }
+
+	// Which of planes iFirst to iFirst + nLanes - 1 of m_prep are parallel to plane i, as a mask
+	uint32_t ParallelMask( int i, int iFirst, int nLanes ) const;
+
+	// Finds the vertices one triple at a time with mat3x3_solve and TestPointInBrush
+	void FindVerticesReference( Brush& brush );
+
+	// Finds the same vertices a block of triples at a time with a PlaneTripleKernel
+	void FindVerticesBatched( Brush& brush );
+
+	// Clips each face polygon against the rest of the brush, with k_flClipSlack to spare, and marks the pairs of planes
+	// whose faces never meet in m_parallel. Nothing they'd skip could have made a corner, so the triple walk after it
+	// finds the same vertices, just without trying every pair
+	void SkipApartPairs( const Brush& brush );
+
+	// Cuts off the part of m_clipPoly more than flSlack in front of a plane, into m_clipScratch, then swaps them
+	void ClipFace( const Plane& plane, double flSlack );
+
+	// Writes out a Box brush's 12 edges from its planes, in the same order and direction as the other builders
+	void EmitBoxEdges( Brush& brush );
+
+	// Turns the filled in edge pairs into the brush's edges, dropping any duplicates
+	void EmitEdges( Brush& brush );
+
+	// Adds the point where three planes meet. Returns true when the edge of planes 1 and 2 is done
+	bool AddIntersection( int iPlane1, int iPlane2, int iPlane3, const Vector3& p );
+
+	// Returns the edge shared by two planes, x and y
+	EdgePair& GetEdge( int x, int y );
+
+	// Adds a vertex onto a given edge shared by two planes, x and y 
+	// Returns true when the given edge now has two pairs
+	bool PushPartialEdge( int x, int y, uint32_t iVert );
+
+	// Stores a vertex and returns its index or returns the index of the vertex if it's already stored.
+	// pPlanes are the three planes of m_prep a kernel solved it from, which welds it the way the reference would
+	uint32_t StoreVertex( const Vector3& newVert, const int* pPlanes = nullptr );
+
+	// Where mat3x3_solve puts the point where three planes of m_prep meet, or fallback if it finds none
+	Vector3 ReferencePoint( const int* pPlanes, const Vector3& fallback ) const;
+
+	int m_nPlaneCount;
+
+	// This is a triangular array of all potential edge pairings between planes
+	int m_nEdgeCount;
+	int m_nEdgeCapacity;
+	EdgePair* m_pEdgePairs;
+
+	// This is a set of all vertices with no duplicates
+	std::vector<Vector3> m_vecVerts;
+	VertexWeldHash m_vertHash;
+
+	// For a kernel's vertices, the planes each was solved from and where the reference solver puts it, once that's needed
+	std::vector<int> m_vertPlanes;
+	std::vector<Vector3> m_vecRefVerts;
+	std::vector<char> m_refSolved;
+	EdgeIndexSet m_edgeSet;
+	bool m_bHashing;
+	std::vector<RecullPoint>* m_pRecullLog;
+	const std::vector<RecullPoint>* m_pCullOverrides;
+
+	// The planes that actually get built from, see PreparePlanes
+	Brush m_prep;
+	std::vector<double> m_prepCanon;	// The same planes scaled to a unit normal, as x, y, z and dist
+	std::vector<uint64_t> m_parallel;	// A row of bits for each plane in m_prep, set for the ones parallel to it, or with clip the ones it never meets
+	int m_nParallelWords;
+
+	BuildKernel m_kernel;
+	BrushSoA m_soa;
+
+	BuildMethod m_method;
+	std::vector<ClipVertex> m_clipPoly;
+	std::vector<ClipVertex> m_clipScratch;
+	std::vector<double> m_clipDists;
+	std::vector<uint64_t> m_clipMeets;	// Same layout as m_parallel, set for the pairs whose faces clipping found meet
+
+	BuildStats m_stats;
+	bool m_bTiming;
+};
+
+
+BrushBuilder::BrushBuilder()
+{
+	m_nPlaneCount = 0;
+	m_nEdgeCount = 0;
+	m_nEdgeCapacity = 0;
+	m_pEdgePairs = nullptr;
+	m_nParallelWords = 0;
+	m_kernel = g_defaultBuildKernel;
+	m_method = g_defaultBuildMethod;
+	m_bHashing = true;
+	m_pRecullLog = nullptr;
+	m_pCullOverrides = nullptr;
+	m_bTiming = false;
+
+	// Setup with basic starter data
+	BeginBrush( 6 );
+}
+
+BrushBuilder::~BrushBuilder()
+{
+	delete[] m_pEdgePairs;
+}
+
+void BrushBuilder::BeginBrush( int nPlanes )
+{
+	// Each plane can share an edge with another plane.
+	// If each plane were to interact with every other plane (including itself), that'd be n^2 edges
+	// We can optimize this down, as an edge between plane1 and plane2 is the same as an edge between plane2 and plane1
+	// We also don't care about interactions between plane1 and plane1, as the a plane cannot intersect with itself
+	// This is just the formula to find the nth triangular number, but we're subtracting 1 off nPlanes
+	int nPotentialEdges = ( nPlanes - 1 ) * nPlanes / 2;
+
+	// If we need more space, then resize our pairs
+	if ( nPotentialEdges > m_nEdgeCapacity )
+	{
+		delete[] m_pEdgePairs;
+		m_pEdgePairs = new EdgePair[nPotentialEdges];
+		m_nEdgeCapacity = nPotentialEdges;
+	}
+
+	// Store the new values
+	m_nPlaneCount = nPlanes;
+	m_nEdgeCount = nPotentialEdges;
+
+	// Clear out the old data
+	memset( m_pEdgePairs, 0xFF, nPotentialEdges * sizeof( EdgePair ) );
+	m_vecVerts.clear();
+	m_vertHash.Clear();
+	m_vertPlanes.clear();
+	m_vecRefVerts.clear();
+	m_refSolved.clear();
+	m_edgeSet.Clear();
+}
+
+// Is a plane entirely outside of the box by more than culling could ever let through? Then any point on it gets culled
+// by the box planes and it never culls anything they don't. The margin is epsilon on each side plus float rounding
+bool IsPlaneOutsideBox( const Plane& plane, const double* mins, const double* maxs )
+{
+	double flMaxDist = -plane.dist, flNormalSum = 0, flReach = 0;
+	for ( int i = 0; i < 3; i++ )
+	{
+		double n = plane.normal[i];
+		flMaxDist += n > 0 ? n * maxs[i] : n * mins[i];
+		flNormalSum += fabs( n );
+		flReach = std::max( { flReach, fabs( mins[i] ), fabs( maxs[i] ) } );
+	}
+	double flMargin = 2 * k_flEpsilon * flNormalSum + 4 * FLT_EPSILON * ( flNormalSum * flReach + fabs( plane.dist ) );
+	return flMaxDist < -flMargin;
+}
+
+// Are two unit planes (x, y, z, dist) within epsilon of each other everywhere in the box?
+bool IsSamePlaneInBox( const double* a, const double* b, const double* mins, const double* maxs )
+{
+	if ( a[0] * b[0] + a[1] * b[1] + a[2] * b[2] <= 0 )
+		return false;
+
+	// How far apart they are changes linearly across the box, so the corners are as far apart as they get
+	double flLow = b[3] - a[3], flHigh = b[3] - a[3];
+	for ( int i = 0; i < 3; i++ )
+	{
+		double n = a[i] - b[i];
+		flLow += std::min( n * mins[i], n * maxs[i] );
+		flHigh += std::max( n * mins[i], n * maxs[i] );
+	}
+	return std::max( -flLow, flHigh ) < k_flEpsilon;
+}
+
+void BrushBuilder::PreparePlanes( const Brush& brush )
+{
+	int nPlanes = brush.planes.size();
+	m_prep.planes.clear();
+	m_prepCanon.clear();
+
+	// Knowing the box, planes only have to be compared where the brush could actually be
+	int iBoxPlanes[6];
+	bool bBox = FindBoxPlanes( brush.planes.data(), nPlanes, iBoxPlanes );
+	double mins[3], maxs[3];
+	double boxCanon[6][4];
+	if ( bBox )
+	{
+		for ( int i = 0; i < 3; i++ )
+		{
+			maxs[i] = brush.planes[iBoxPlanes[i * 2]].dist;
+			mins[i] = -brush.planes[iBoxPlanes[i * 2 + 1]].dist;
+		}
+		for ( int i = 0; i < 6; i++ )
+		{
+			boxCanon[i][0] = boxCanon[i][1] = boxCanon[i][2] = 0;
+			boxCanon[i][i / 2] = ( i & 1 ) ? -1 : 1;
+			boxCanon[i][3] = brush.planes[iBoxPlanes[i]].dist;
+		}
+	}
+
+	for ( int iPlane = 0; iPlane < nPlanes; iPlane++ )
+	{
+		const Plane& plane = brush.planes[iPlane];
+		if ( plane.skip )
+			continue;
+
+		double flLength = sqrt( (double)plane.normal.x * plane.normal.x + (double)plane.normal.y * plane.normal.y + (double)plane.normal.z * plane.normal.z );
+		double canon[4] = { plane.normal.x / flLength, plane.normal.y / flLength, plane.normal.z / flLength, plane.dist / flLength };
+
+		// The box planes always stay, anything else can go if it can't make a face of its own
+		bool bDuplicate = false;
+		if ( bBox && !plane.bbox )
+		{
+			if ( IsPlaneOutsideBox( plane, mins, maxs ) )
+			{
+				m_stats.nRedundantPlanes++;
+				continue;
+			}
+			for ( int i = 0; i < 6 && !bDuplicate; i++ )
+				bDuplicate = IsSamePlaneInBox( canon, boxCanon[i], mins, maxs );
+			for ( size_t i = 0; i < m_prep.planes.size() && !bDuplicate; i++ )
+				bDuplicate = IsSamePlaneInBox( canon, &m_prepCanon[i * 4], mins, maxs );
+		}
+		else if ( !bBox )
+		{
+			// Without a box there's nowhere to compare them over, so only ones that are exactly the same go
+			for ( size_t i = 0; i < m_prep.planes.size() && !bDuplicate; i++ )
+				bDuplicate = std::equal( canon, canon + 4, &m_prepCanon[i * 4] );
+		}
+		if ( bDuplicate )
+		{
+			m_stats.nDuplicatePlanes++;
+			continue;
+		}
+
+		m_prep.planes.push_back( plane );
+		m_prepCanon.insert( m_prepCanon.end(), canon, canon + 4 );
+	}
+
+	// Every pair only gets looked at once here, instead of over and over for each third plane
+	int nPrepared = m_prep.planes.size();
+	m_nParallelWords = ( nPrepared + 63 ) / 64;
+	m_parallel.assign( nPrepared * m_nParallelWords, 0 );
+	for ( int i = 0; i < nPrepared; i++ )
+	{
+		for ( int j = i + 1; j < nPrepared; j++ )
+		{
+			if ( !ShouldSkipPlane( m_prep.planes[i], m_prep.planes[j] ) )
+				continue;
+			m_parallel[i * m_nParallelWords + ( j >> 6 )] |= 1ull << ( j & 63 );
+			m_parallel[j * m_nParallelWords + ( i >> 6 )] |= 1ull << ( i & 63 );
+		}
+	}
+}
+
+uint32_t BrushBuilder::ParallelMask( int i, int iFirst, int nLanes ) const
+{
+	const uint64_t* pRow = &m_parallel[i * m_nParallelWords];
+	int iWord = iFirst >> 6, iBit = iFirst & 63;
+	uint64_t bits = pRow[iWord] >> iBit;
+	if ( iBit && iWord + 1 < m_nParallelWords )
+		bits |= pRow[iWord + 1] << ( 64 - iBit );
+	return (uint32_t)bits & ( ( 1u << nLanes ) - 1 );
+}
+
+EdgePair& BrushBuilder::GetEdge( int x, int y )
+{
+	// Ensure the lowest is always plane y
+	if ( x < y )
+		std::swap( x, y );
+	
+	// Get the index within our triangular array
+	// I thought indexing into this would be easier, but oh well!
+
+	// Sum of an arithmetic series to get the row Y
+	int a1  = m_nPlaneCount - 1;
+	int an  = m_nPlaneCount - y;
+	int n   = y;
+	int sum = y * ( a1 + an ) / 2;
+
+	// Get the index for column x
+	int idx = sum + (x - y - 1);
+
+	// return the edge!
+	return m_pEdgePairs[idx];
+}
+
+bool BrushBuilder::PushPartialEdge( int x, int y, uint32_t iVertex )
+{
+	EdgePair& edge = GetEdge( x, y );
+
+
+	// If it's already on the edge, ignore the request
+	if ( edge.iVertex1 == iVertex || edge.iVertex2 == iVertex )
+	{
+		// We need to still return true if the edge is full!
+		// One of the two verts are already valid, we always fill iVertex1 first, so iVertex2 is either valid or invalid
+		return edge.iVertex2 == k_iInvalidVertex ? false : true;
+	}
+
+	// Fill iVertex1 first
+	if ( edge.iVertex1 == k_iInvalidVertex )
+	{
+		edge.iVertex1 = iVertex;
+		return false;
+	}
+	
+	// Fill iVertex2 last
+	if ( edge.iVertex2 == k_iInvalidVertex )
+	{
+		edge.iVertex2 = iVertex;
+		return true;
+	}
+
+	// Uh oh, pushing a third vert?
+	const Vector3& v1 = m_vecVerts[edge.iVertex1];
+	const Vector3& v2 = m_vecVerts[edge.iVertex2];
+	const Vector3& v3 = m_vecVerts[iVertex];
+	/*
+	std::cout << "Hey!! The edge (" << x << "," << y << ") already has two verts!\n";
+	std::cout << "\t Vertex 1 : " << v1.x << ", " << v1.y << ", " << v1.z << "\n";
+	std::cout << "\t Vertex 2 : " << v2.x << ", " << v2.y << ", " << v2.z << "\n";
+	std::cout << "\t Vertex 3 : " << v3.x << ", " << v3.y << ", " << v3.z << "\n";
+	*/
+	return true;
+}
+
+
+Vector3 BrushBuilder::ReferencePoint( const int* pPlanes, const Vector3& fallback ) const
+{
+	Vector3 p;
+	if ( !PlaneIntersect( m_prep.planes[pPlanes[0]], m_prep.planes[pPlanes[1]], m_prep.planes[pPlanes[2]], &p ) )
+		return fallback;
+	return p;
+}
+
+uint32_t BrushBuilder::StoreVertex( const Vector3& newVert, const int* pPlanes )
+{
+	size_t nVerts = m_vecVerts.size();
+	uint32_t iVert;
+	if ( !pPlanes )
+		iVert = WeldVertex( m_vecVerts, m_bHashing ? &m_vertHash : nullptr, newVert );
+	else
+	{
+		// Too close to call from the kernel's points, so compare them where the reference has them. Only ever solved
+		// again when it comes to that, which is rare
+		bool bSolved = false;
+		Vector3 refVert;
+		auto resolve = [&]( uint32_t iOther )
+		{
+			if ( !bSolved )
+			{
+				refVert = ReferencePoint( pPlanes, newVert );
+				bSolved = true;
+			}
+			if ( !m_refSolved[iOther] )
+			{
+				m_vecRefVerts[iOther] = ReferencePoint( &m_vertPlanes[iOther * 3], m_vecVerts[iOther] );
+				m_refSolved[iOther] = true;
+			}
+			return CompareForWeld( m_vecRefVerts[iOther], refVert, 0.0f ) == WeldMatch::Near;
+		};
+		iVert = WeldVertex( m_vecVerts, m_bHashing ? &m_vertHash : nullptr, newVert, WeldBandFor( newVert ), resolve );
+		if ( iVert == nVerts )
+		{
+			m_vertPlanes.insert( m_vertPlanes.end(), pPlanes, pPlanes + 3 );
+			m_vecRefVerts.push_back( refVert );
+			m_refSolved.push_back( bSolved );
+		}
+	}
+	if ( iVert < nVerts )
+		m_stats.nVertsWelded++;
+	return iVert;
+}
+
+
+bool BrushBuilder::AddIntersection( int iPlane1, int iPlane2, int iPlane3, const Vector3& p )
+{
+	// Only the reference's own points can be welded as they are
+	int planes[3] = { iPlane1, iPlane2, iPlane3 };
+	uint32_t iVert = StoreVertex( p, m_kernel == BuildKernel::Reference ? nullptr : planes );
+
+	PushPartialEdge( iPlane3, iPlane1, iVert );
+	PushPartialEdge( iPlane3, iPlane2, iVert );
+
+	if ( PushPartialEdge( iPlane2, iPlane1, iVert ) )
+	{
+		// Our pair is full! No need to compute more intersections for iPlane1 and iPlane2
+#if DEBUG_LOG
+		std::cout << "Intersection between planes " << iPlane1 << ", " << iPlane2 << " completed edge\n";
+#endif
+		return true;
+	}
+	return false;
+}
+
+// Both of these are given m_prep, which has no skipped planes left in it
+void BrushBuilder::FindVerticesReference( Brush& brush )
+{
+	int nPlanes = brush.planes.size();
+	for (int iPlane1 = 0; iPlane1 < nPlanes - 2; iPlane1++)
+	{
+		Plane& plane1 = brush.planes[iPlane1];
+		
+		for (int iPlane2 = iPlane1 + 1; iPlane2 < nPlanes - 1; iPlane2++)
+		{
+			Plane& plane2 = brush.planes[iPlane2];
+
+			// Is it parallel or opposing?
+			if ( IsParallel( iPlane1, iPlane2 ) )
+			{
+				m_stats.nParallelSkips++;
+				continue;
+			}
+
+			// Loop for the other remaining untested planes
+			for (int iPlane3 = iPlane2 + 1; iPlane3 < nPlanes; iPlane3++)
+			{
+				Plane& plane3 = brush.planes[iPlane3];
+
+				// Is it parallel or opposing?
+				if ( IsParallel( iPlane3, iPlane1 ) || IsParallel( iPlane3, iPlane2 ) )
+				{
+					m_stats.nParallelSkips++;
+					continue;
+				}
+
+				// Do our 3 planes intersect? If not, next plane
+				Vector3 p;
+				m_stats.nTriples++;
+				if (!PlaneIntersect(plane1, plane2, plane3, &p))
+				{
+					m_stats.nSolveFailures++;
+#if DEBUG_LOG
+					std::cout << "Intersection between planes " << iPlane1 << ", " << iPlane2 << ", " << iPlane3 << " skipped because they don't intersect\n";
+#endif
+					continue;
+				}
+
+				// Cull points outside of the solid
+				bool inside = TestPointInBrush( brush, p );
+				for ( size_t i = 0; m_pCullOverrides && i < m_pCullOverrides->size(); i++ )
+				{
+					const RecullPoint& point = ( *m_pCullOverrides )[i];
+					if ( point.iPlane1 == iPlane1 && point.iPlane2 == iPlane2 && point.iPlane3 == iPlane3 )
+						inside = point.inside;
+				}
+				if ( !inside )
+				{
+					m_stats.nPointsCulled++;
+					continue;
+				}
+
+#if DEBUG_LOG
+				std::cout << "Intersection between planes " << iPlane1 << ", " << iPlane2 << ", " << iPlane3 << " found\n";
+#endif
+
+				// Good intersection! Store the point and push the three partial edges
+				if ( AddIntersection( iPlane1, iPlane2, iPlane3, p ) )
+					break;
+			}
+		}
+	}
+}
+
+void BrushBuilder::FindVerticesBatched( Brush& brush )
+{
+	int nPlanes = brush.planes.size();
+	m_soa.Load( brush );
+	PlaneTripleKernel kernel = GetPlaneTripleKernel( m_kernel );
+
+	alignas( 32 ) float px[k_nKernelWidth];
+	alignas( 32 ) float py[k_nKernelWidth];
+	alignas( 32 ) float pz[k_nKernelWidth];
+
+	for ( int iPlane1 = 0; iPlane1 < nPlanes - 2; iPlane1++ )
+	{
+		for ( int iPlane2 = iPlane1 + 1; iPlane2 < nPlanes - 1; iPlane2++ )
+		{
+			// Is it parallel or opposing?
+			if ( IsParallel( iPlane1, iPlane2 ) )
+			{
+				m_stats.nParallelSkips++;
+				continue;
+			}
+
+			// Same walk over the third plane as the reference, just a block at a time
+			bool bEdgeDone = false;
+			for ( int iFirst3 = iPlane2 + 1; iFirst3 < nPlanes && !bEdgeDone; iFirst3 += k_nKernelWidth )
+			{
+				int nLanes = std::min( k_nKernelWidth, nPlanes - iFirst3 );
+
+				// Leave out the planes the reference would skip before it ever solved anything
+				uint32_t parallelMask = ParallelMask( iPlane1, iFirst3, nLanes ) | ParallelMask( iPlane2, iFirst3, nLanes );
+				m_stats.nParallelSkips += CountBits( parallelMask );
+				uint32_t activeMask = ( ( 1u << nLanes ) - 1 ) & ~parallelMask;
+				if ( !activeMask )
+					continue;
+
+				uint32_t solvedMask;
+				uint32_t recullMask;
+				uint32_t validMask = kernel( m_soa, iPlane1, iPlane2, iFirst3, activeMask, px, py, pz, &solvedMask, &recullMask );
+				int nSolved = CountBits( solvedMask );
+				m_stats.nRecullPoints += CountBits( recullMask );
+				m_stats.nTriples += CountBits( activeMask );
+				m_stats.nSolveFailures += CountBits( activeMask ) - nSolved;
+				m_stats.nPointsCulled += nSolved - CountBits( validMask );
+				for ( int lane = 0; m_pRecullLog && lane < nLanes; lane++ )
+				{
+					if ( recullMask & ( 1u << lane ) )
+						m_pRecullLog->push_back( { iPlane1, iPlane2, iFirst3 + lane, ( validMask >> lane ) & 1 ? true : false } );
+				}
+
+				// Points have to go in in order, since finishing the edge stops the search
+				for ( int lane = 0; lane < nLanes && validMask; lane++ )
+				{
+					if ( !( validMask & ( 1u << lane ) ) )
+						continue;
+					validMask &= ~( 1u << lane );
+
+					if ( AddIntersection( iPlane1, iPlane2, iFirst3 + lane, { px[lane], py[lane], pz[lane] } ) )
+					{
+						bEdgeDone = true;
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+void BrushBuilder::ClipFace( const Plane& plane, double flSlack )
+{
+	int n = m_clipPoly.size();
+	m_clipDists.resize( n );
+	bool bCut = false;
+	for ( int i = 0; i < n; i++ )
+	{
+		const ClipVertex& v = m_clipPoly[i];
+		double dist = v.x * plane.normal.x + v.y * plane.normal.y + v.z * plane.normal.z - plane.dist - flSlack;
+		m_clipDists[i] = dist;
+		bCut |= dist > 0;
+	}
+
+	// Most planes don't touch most faces
+	if ( !bCut )
+		return;
+
+	m_clipScratch.clear();
+	for ( int i = 0; i < n; i++ )
+	{
+		int iNext = ( i + 1 ) % n;
+		const ClipVertex& a = m_clipPoly[i];
+		const ClipVertex& b = m_clipPoly[iNext];
+		double da = m_clipDists[i], db = m_clipDists[iNext];
+
+		if ( da <= 0 )
+			m_clipScratch.push_back( a );
+
+		// Split edges that cross the plane
+		if ( ( da <= 0 ) != ( db <= 0 ) )
+		{
+			double t = da / ( da - db );
+			m_clipScratch.push_back( { a.x + ( b.x - a.x ) * t, a.y + ( b.y - a.y ) * t, a.z + ( b.z - a.z ) * t } );
+		}
+	}
+	std::swap( m_clipPoly, m_clipScratch );
+}
+
+void BrushBuilder::SkipApartPairs( const Brush& brush )
+{
+	int nPlanes = brush.planes.size();
+	m_clipMeets.assign( nPlanes * m_nParallelWords, 0 );
+	for ( int iFace = 0; iFace < nPlanes; iFace++ )
+	{
+		const Plane& face = brush.planes[iFace];
+
+		// Build a huge square lying on the plane
+		double nx = face.normal.x, ny = face.normal.y, nz = face.normal.z;
+		double ux, uy, uz;
+		if ( fabs( nx ) < 0.6 )
+		{
+			// n x (1, 0, 0)
+			ux = 0; uy = nz; uz = -ny;
+		}
+		else
+		{
+			// n x (0, 1, 0)
+			ux = -nz; uy = 0; uz = nx;
+		}
+		double len = sqrt( ux * ux + uy * uy + uz * uz );
+		ux /= len; uy /= len; uz /= len;
+		double vx = ny * uz - nz * uy;
+		double vy = nz * ux - nx * uz;
+		double vz = nx * uy - ny * ux;
+
+		// Normals aren't always exactly unit length, so put the center right on the plane
+		double nLenSqr = nx * nx + ny * ny + nz * nz;
+		double cx = nx * face.dist / nLenSqr, cy = ny * face.dist / nLenSqr, cz = nz * face.dist / nLenSqr;
+
+		const double s = k_flClipBaseSize;
+		m_clipPoly.clear();
+		m_clipPoly.push_back( { cx + ( ux + vx ) * s, cy + ( uy + vy ) * s, cz + ( uz + vz ) * s } );
+		m_clipPoly.push_back( { cx + ( -ux + vx ) * s, cy + ( -uy + vy ) * s, cz + ( -uz + vz ) * s } );
+		m_clipPoly.push_back( { cx + ( -ux - vx ) * s, cy + ( -uy - vy ) * s, cz + ( -uz - vz ) * s } );
+		m_clipPoly.push_back( { cx + ( ux - vx ) * s, cy + ( uy - vy ) * s, cz + ( uz - vz ) * s } );
+
+		// Carve it down by everything else in the brush, leaving some room past it
+		for ( int iPlane = 0; iPlane < nPlanes && !m_clipPoly.empty(); iPlane++ )
+		{
+			if ( iPlane == iFace )
+				continue;
+			ClipFace( brush.planes[iPlane], k_flClipSlack );
+			m_stats.nClipTests++;
+		}
+
+		// A plane can only meet this face if the face gets up to it
+		for ( int iPlane = 0; iPlane < nPlanes && !m_clipPoly.empty(); iPlane++ )
+		{
+			const Plane& plane = brush.planes[iPlane];
+			double flMax = -DBL_MAX;
+			for ( const ClipVertex& v : m_clipPoly )
+				flMax = std::max( flMax, v.x * plane.normal.x + v.y * plane.normal.y + v.z * plane.normal.z - plane.dist );
+			if ( iPlane == iFace || flMax < -k_flClipSlack )
+				continue;
+			m_clipMeets[iFace * m_nParallelWords + ( iPlane >> 6 )] |= 1ull << ( iPlane & 63 );
+			m_clipMeets[iPlane * m_nParallelWords + ( iFace >> 6 )] |= 1ull << ( iFace & 63 );
+		}
+	}
+
+	// Pairs that never meet get skipped like parallel ones
+	for ( size_t i = 0; i < m_parallel.size(); i++ )
+		m_parallel[i] |= ~m_clipMeets[i];
+}
+
+void BrushBuilder::Build( Brush& brush )
+{
+	int nPlanes = brush.planes.size();
+
+	// We need at least 4 plans for a brush. Counted rather than printed, the caller says so once per file instead of
+	// several workers printing over each other
+	if (nPlanes < 4)
+	{
+		m_stats.nTooFewPlanes++;
+		return;
+	}
+
+	auto start = m_bTiming ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+	// A box's corners are right there in its planes, nothing needs solving. The reference kernel still goes the long
+	// way around so -verifykernels has something to check this against
+	if ( brush.shape == BrushShape::Box && m_kernel != BuildKernel::Reference )
+	{
+		EmitBoxEdges( brush );
+		m_stats.nBoxBrushes++;
+	}
+	else
+	{
+		// Cut it down to the planes that matter first, the rest is cubic in how many there are.
+		// Which builder to use still goes by how many planes the brush came with, so dropping some never changes that
+		PreparePlanes( brush );
+		int nPrepared = m_prep.planes.size();
+		bool bClip = m_method == BuildMethod::Clip || ( m_method == BuildMethod::Auto && nPlanes >= k_nClipPlaneCount );
+
+		// Good brush! We can begin!
+		BeginBrush( nPrepared );
+
+		// Note: If issues come up with points not combining up properly, then it
+		//       might be worth while to recenter everything for floating point accuracy
+
+		// Get all plane intersections
+		if ( bClip )
+			SkipApartPairs( m_prep );
+		if ( m_kernel == BuildKernel::Reference )
+			FindVerticesReference( m_prep );
+		else
+			FindVerticesBatched( m_prep );
+
+		EmitEdges( brush );
+	}
+
+	m_stats.nBrushes++;
+	int iBucket = BuildStats::BucketFor( nPlanes );
+	m_stats.nBucketBrushes[iBucket]++;
+	if ( m_bTiming )
+	{
+		uint64_t nNanos = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+		m_stats.nBucketNanos[iBucket] += nNanos;
+		m_stats.nBucketMaxNanos[iBucket] = std::max( m_stats.nBucketMaxNanos[iBucket], nNanos );
+	}
+}
+
+void BrushBuilder::EmitBoxEdges( Brush& brush )
+{
+	int iBoxPlanes[6];
+	FindBoxPlanes( brush.planes.data(), brush.planes.size(), iBoxPlanes );
+
+	// Where each plane sits along its axis, which is exactly what solving any three of them would come to
+	float flSide[6];
+	for ( int i = 0; i < 6; i++ )
+		flSide[i] = ( i & 1 ) ? -brush.planes[iBoxPlanes[i]].dist : brush.planes[iBoxPlanes[i]].dist;
+
+	// The sides in plane order, since that's the order the pairs get walked in
+	int iSides[6] = { 0, 1, 2, 3, 4, 5 };
+	std::sort( iSides, iSides + 6, [&iBoxPlanes]( int a, int b ) { return iBoxPlanes[a] < iBoxPlanes[b]; } );
+
+	for ( int i = 0; i < 5; i++ )
+	{
+		for ( int j = i + 1; j < 6; j++ )
+		{
+			int iSide1 = iSides[i], iSide2 = iSides[j];
+			int iAxis1 = iSide1 / 2, iAxis2 = iSide2 / 2;
+			if ( iAxis1 == iAxis2 )
+				continue;
+
+			// The edge runs along the last axis, starting at whichever of its planes comes first, same as the triple walk finds them
+			int iAxis3 = 3 - iAxis1 - iAxis2;
+			int iStart = iAxis3 * 2, iEnd = iAxis3 * 2 + 1;
+			if ( iBoxPlanes[iEnd] < iBoxPlanes[iStart] )
+				std::swap( iStart, iEnd );
+
+			Edge edge;
+			edge.stem[iAxis1] = edge.tail[iAxis1] = flSide[iSide1];
+			edge.stem[iAxis2] = edge.tail[iAxis2] = flSide[iSide2];
+			edge.stem[iAxis3] = flSide[iStart];
+			edge.tail[iAxis3] = flSide[iEnd];
+			brush.edges.push_back( edge );
+		}
+	}
+}
+
+void BrushBuilder::EmitEdges( Brush& brush )
+{
+	int nPlanes = m_nPlaneCount;
+	int iEdge = 0;
+	for ( int iPlane1 = 0; iPlane1 < nPlanes - 1; iPlane1++ )
+	{
+		for ( int iPlane2 = iPlane1 + 1; iPlane2 < nPlanes; iPlane2++ )
+		{
+			EdgePair& edge = m_pEdgePairs[iEdge++];
+
+			// Skip invalid edges
+			if ( edge.iVertex1 == k_iInvalidVertex || edge.iVertex2 == k_iInvalidVertex )
+				continue;
+
+			//weed out duplicates
+			if ( m_bHashing )
+			{
+				if ( !m_edgeSet.Insert( edge.iVertex1, edge.iVertex2 ) )
+				{
+					m_stats.nEdgesDropped++;
+					continue;
+				}
+				brush.edges.push_back( { m_vecVerts[edge.iVertex1], m_vecVerts[edge.iVertex2] } );
+				continue;
+			}
+
+			bool dupe = false;
+			for (Edge& existingEdge : brush.edges)
+			{
+				//stems match and tails match
+				if (m_vecVerts[edge.iVertex1] == existingEdge.stem && m_vecVerts[edge.iVertex2] == existingEdge.tail)
+					dupe = true;
+				//inverse match
+				if (m_vecVerts[edge.iVertex1] == existingEdge.tail && m_vecVerts[edge.iVertex2] == existingEdge.stem)
+					dupe = true;
+			}
+			if (dupe)
+			{
+				m_stats.nEdgesDropped++;
+				continue;
+			}
+
+			// Emit!
+			brush.edges.push_back( { m_vecVerts[edge.iVertex1], m_vecVerts[edge.iVertex2] } );
+		}
+	}
+}
+
+
+// A run of brush indices owned by one worker. The owner eats from the front, thieves take from the back
+struct BrushQueue
+{
+	std::mutex mutex;
+	size_t begin = 0;
+	size_t end = 0;
+};
+
+// Builds every brush given, spread across nThreads threads
+// Build is cubic in the plane count, so a single bevel-heavy brush can cost as much as hundreds of boxes.
+// Rather than trusting an even split, idle workers steal half of whatever another worker has left.
+// Each brush is still built start to finish by one BrushBuilder, so the edges come out exactly as they would serially
+// The calling thread joins in with bb, every other thread gets its own
+void BuildBrushes( const std::vector<Brush*>& brushes, BrushBuilder& bb, int nThreads )
+{
+	if ( nThreads <= 0 )
+		nThreads = std::max( 1u, std::thread::hardware_concurrency() );
+	nThreads = std::min<int>( nThreads, (int)brushes.size() );
+
+	if ( nThreads <= 1 )
+	{
+		for ( Brush* brush : brushes )
+			bb.Build( *brush );
+		return;
+	}
+
+	// Start everyone off with an even share
+	std::vector<BrushQueue> queues( nThreads );
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		queues[i].begin = brushes.size() * i / nThreads;
+		queues[i].end = brushes.size() * ( i + 1 ) / nThreads;
+	}
+
+	auto worker = [&]( int iSelf, BrushBuilder& bb )
+	{
+		BrushQueue& own = queues[iSelf];
+		while ( true )
+		{
+			size_t iBrush;
+			{
+				std::lock_guard<std::mutex> lock( own.mutex );
+				iBrush = own.begin < own.end ? own.begin++ : SIZE_MAX;
+			}
+
+			if ( iBrush != SIZE_MAX )
+			{
+				bb.Build( *brushes[iBrush] );
+				continue;
+			}
+
+			// Out of our own work, go look for someone to steal from
+			bool stole = false;
+			for ( int iOffset = 1; iOffset < nThreads && !stole; iOffset++ )
+			{
+				BrushQueue& victim = queues[( iSelf + iOffset ) % nThreads];
+				std::scoped_lock lock( victim.mutex, own.mutex );
+				size_t nLeft = victim.end - victim.begin;
+				if ( nLeft == 0 )
+					continue;
+
+				size_t nTake = ( nLeft + 1 ) / 2;
+				own.begin = victim.end - nTake;
+				own.end = victim.end;
+				victim.end -= nTake;
+				stole = true;
+			}
+
+			// Nothing left anywhere
+			if ( !stole )
+				return;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<BuildStats> threadStats( nThreads );
+	for ( int i = 1; i < nThreads; i++ )
+	{
+		threads.emplace_back( [&worker, &threadStats, &bb, i]()
+		{
+			// Scratch space stays with the thread
+			BrushBuilder threadBuilder;
+			threadBuilder.SetKernel( bb.GetKernel() );
+			threadBuilder.SetMethod( bb.GetMethod() );
+			threadBuilder.SetTiming( bb.GetTiming() );
+			worker( i, threadBuilder );
+			threadStats[i] = threadBuilder.GetStats();
+		} );
+	}
+	worker( 0, bb );
+	for ( std::thread& thread : threads )
+		thread.join();
+	for ( int i = 1; i < nThreads; i++ )
+		bb.AddStats( threadStats[i] );
+}
+
+// What EdgeMerger has dropped, for the summary and -stats
+struct MergeStats
+{
+	uint64_t nEdgesBefore = 0;
+	uint64_t nEdgesAfter = 0;
+	uint64_t nDuplicates = 0;	// Drawn by more than one brush
+	uint64_t nInterior = 0;		// On a flat part of the outline where brushes meet
+	uint64_t nCollinear = 0;	// Joined onto the line they carry on from
+
+	void Add( const MergeStats& other )
+	{
+		nEdgesBefore += other.nEdgesBefore;
+		nEdgesAfter += other.nEdgesAfter;
+		nDuplicates += other.nDuplicates;
+		nInterior += other.nInterior;
+		nCollinear += other.nCollinear;
+	}
+};
+
+// How far off a full turn the brushes around an edge can add up to and still count as closing it, in radians
+constexpr double k_flMergeAngleTolerance = 0.01;
+
+// Turns the edges of every brush of an entity into one outline, for -merge.
+// Corners are welded across brushes, edges that more than one brush draws are drawn once, edges where brushes meet
+// that don't have a crease in the outline are dropped, and straight runs of edges are joined into one line.
+// Only edges that line up exactly, corner to corner, are merged. An edge that only partly overlaps another is left alone
+class EdgeMerger
+{
+public:
+	// The whole outline ends up in the first brush, the other brushes are left with no edges
+	void Merge( Entity& ent );
+
+	const MergeStats& GetStats() const { return m_stats; }
+	void ResetStats() { m_stats = {}; }
+
+private:
+	struct MergedEdge
+	{
+		uint32_t iVert1;
+		uint32_t iVert2;
+		int nBrushes;			// How many brushes drew it
+		int iFirstPlane;		// Run of m_edgePlanes, linked through next
+		bool alive;
+	};
+
+	// A plane of some brush that the edge lies on
+	struct EdgePlane
+	{
+		const Plane* pPlane;
+		int iBrush;
+		int iNext;
+	};
+
+	bool IsInterior( const MergedEdge& edge );
+	bool IsSurrounded( const MergedEdge& edge ) const;
+	bool IsStraight( uint32_t iVert1, uint32_t iVert, uint32_t iVert2 ) const;
+
+	std::vector<Vector3> m_verts;
+	VertexWeldHash m_vertHash;
+	std::vector<MergedEdge> m_edges;
+	std::vector<EdgePlane> m_edgePlanes;
+	std::unordered_map<uint64_t, uint32_t> m_edgeIndex;
+	std::vector<const Plane*> m_scratchPlanes;
+	std::vector<std::vector<uint32_t>> m_vertEdges;
+	MergeStats m_stats;
+};
+
+void EdgeMerger::Merge( Entity& ent )
+{
+	size_t nEdges = 0;
+	for ( const Brush& brush : ent.brushes )
+		nEdges += brush.edges.size();
+	m_stats.nEdgesBefore += nEdges;
+
+	// One brush already has no duplicates and no flat edges, and every corner has at least three edges
+	if ( ent.brushes.size() < 2 )
+	{
+		m_stats.nEdgesAfter += nEdges;
+		return;
+	}
+
+	m_verts.clear();
+	m_vertHash.Clear();
+	m_edges.clear();
+	m_edgePlanes.clear();
+	m_edgeIndex.clear();
+
+	for ( size_t iBrush = 0; iBrush < ent.brushes.size(); iBrush++ )
+	{
+		const Brush& brush = ent.brushes[iBrush];
+		for ( const Edge& edge : brush.edges )
+		{
+			uint32_t iVert1 = WeldVertex( m_verts, &m_vertHash, edge.stem );
+			uint32_t iVert2 = WeldVertex( m_verts, &m_vertHash, edge.tail );
+			if ( iVert1 == iVert2 )
+				continue;
+
+			uint64_t key = ( (uint64_t)std::min( iVert1, iVert2 ) << 32 ) | std::max( iVert1, iVert2 );
+			auto inserted = m_edgeIndex.try_emplace( key, (uint32_t)m_edges.size() );
+			if ( inserted.second )
+				m_edges.push_back( { iVert1, iVert2, 0, -1, true } );
+			else
+				m_stats.nDuplicates++;
+			MergedEdge& merged = m_edges[inserted.first->second];
+			merged.nBrushes++;
+
+			// The faces of this brush the edge runs along
+			for ( const Plane& plane : brush.planes )
+			{
+				if ( plane.skip )
+					continue;
+				if ( fabsf( dotProduct( edge.stem, plane.normal ) - plane.dist ) > k_flEpsilon || fabsf( dotProduct( edge.tail, plane.normal ) - plane.dist ) > k_flEpsilon )
+					continue;
+				m_edgePlanes.push_back( { &plane, (int)iBrush, merged.iFirstPlane } );
+				merged.iFirstPlane = m_edgePlanes.size() - 1;
+			}
+		}
+	}
+
+	// Drop the edges in the middle of a flat patch, then see which corners are left with just two edges
+	m_vertEdges.resize( std::max( m_vertEdges.size(), m_verts.size() ) );
+	for ( size_t i = 0; i < m_verts.size(); i++ )
+		m_vertEdges[i].clear();
+	for ( uint32_t iEdge = 0; iEdge < m_edges.size(); iEdge++ )
+	{
+		MergedEdge& edge = m_edges[iEdge];
+		if ( edge.nBrushes > 1 && IsInterior( edge ) )
+		{
+			edge.alive = false;
+			m_stats.nInterior++;
+			continue;
+		}
+		m_vertEdges[edge.iVert1].push_back( iEdge );
+		m_vertEdges[edge.iVert2].push_back( iEdge );
+	}
+
+	// Join straight runs. The far ends keep their own edge counts, so one pass does it
+	for ( uint32_t iVert = 0; iVert < m_verts.size(); iVert++ )
+	{
+		std::vector<uint32_t>& vertEdges = m_vertEdges[iVert];
+		if ( vertEdges.size() != 2 )
+			continue;
+		MergedEdge& keep = m_edges[vertEdges[0]];
+		MergedEdge& drop = m_edges[vertEdges[1]];
+		uint32_t iFar1 = keep.iVert1 == iVert ? keep.iVert2 : keep.iVert1;
+		uint32_t iFar2 = drop.iVert1 == iVert ? drop.iVert2 : drop.iVert1;
+		if ( iFar1 == iFar2 || !IsStraight( iFar1, iVert, iFar2 ) )
+			continue;
+
+		keep.iVert1 = iFar1;
+		keep.iVert2 = iFar2;
+		drop.alive = false;
+		m_stats.nCollinear++;
+
+		// The far end of the dropped edge now belongs to the kept one
+		for ( uint32_t& iEdge : m_vertEdges[iFar2] )
+		{
+			if ( iEdge == vertEdges[1] )
+				iEdge = vertEdges[0];
+		}
+		vertEdges.clear();
+	}
+
+	for ( Brush& brush : ent.brushes )
+		brush.edges.clear();
+	std::vector<Edge>& outline = ent.brushes[0].edges;
+	for ( const MergedEdge& edge : m_edges )
+	{
+		if ( edge.alive )
+			outline.push_back( { m_verts[edge.iVert1], m_verts[edge.iVert2] } );
+	}
+	m_stats.nEdgesAfter += outline.size();
+}
+
+bool EdgeMerger::IsInterior( const MergedEdge& edge )
+{
+	m_scratchPlanes.clear();
+	for ( int i = edge.iFirstPlane; i >= 0; i = m_edgePlanes[i].iNext )
+		m_scratchPlanes.push_back( m_edgePlanes[i].pPlane );
+
+	// Two brushes with faces against each other hide both faces, so they don't count
+	auto same = []( const Plane& a, const Plane& b, float flSign )
+	{
+		return IsNear( dotProduct( a.normal, b.normal ), flSign ) && IsNear( a.dist, flSign * b.dist );
+	};
+	size_t n = m_scratchPlanes.size();
+	for ( size_t i = 0; i < n; i++ )
+	{
+		for ( size_t j = i + 1; j < n && m_scratchPlanes[i]; j++ )
+		{
+			if ( m_scratchPlanes[j] && same( *m_scratchPlanes[i], *m_scratchPlanes[j], -1.0f ) )
+			{
+				m_scratchPlanes[i] = nullptr;
+				m_scratchPlanes[j] = nullptr;
+			}
+		}
+	}
+
+	// What's left is the outside of the outline here. Unless it turns a corner, there's no line to draw
+	const Plane* pFirst = nullptr;
+	for ( const Plane* pPlane : m_scratchPlanes )
+	{
+		if ( !pPlane )
+			continue;
+		if ( !pFirst )
+			pFirst = pPlane;
+		else if ( !same( *pFirst, *pPlane, 1.0f ) )
+			return false;
+	}
+
+	// Nothing left either happens deep inside, or where brushes only touch along the edge, like two boxes corner to
+	// corner. Only the first has no line
+	return pFirst || IsSurrounded( edge );
+}
+
+// Do the brushes on an edge fill all the way around it? Each one fills the angle between its two faces there
+bool EdgeMerger::IsSurrounded( const MergedEdge& edge ) const
+{
+	double flTotal = 0;
+	for ( int i = edge.iFirstPlane; i >= 0; )
+	{
+		// A brush's planes on the edge are all together. Normally two, but take the two furthest apart if there are more
+		int iBrush = m_edgePlanes[i].iBrush;
+		double flMinDot = 1.0;
+		int iEnd = i;
+		for ( ; iEnd >= 0 && m_edgePlanes[iEnd].iBrush == iBrush; iEnd = m_edgePlanes[iEnd].iNext )
+		{
+			for ( int j = m_edgePlanes[iEnd].iNext; j >= 0 && m_edgePlanes[j].iBrush == iBrush; j = m_edgePlanes[j].iNext )
+				flMinDot = std::min( flMinDot, (double)dotProduct( m_edgePlanes[iEnd].pPlane->normal, m_edgePlanes[j].pPlane->normal ) );
+		}
+		flTotal += acos( std::min( 1.0, -flMinDot ) );
+		i = iEnd;
+	}
+	return fabs( flTotal - 2 * acos( -1.0 ) ) < k_flMergeAngleTolerance;
+}
+
+bool EdgeMerger::IsStraight( uint32_t iVert1, uint32_t iVert, uint32_t iVert2 ) const
+{
+	const Vector3& a = m_verts[iVert1];
+	const Vector3& b = m_verts[iVert];
+	const Vector3& c = m_verts[iVert2];
+	double ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+	double vx = c.x - b.x, vy = c.y - b.y, vz = c.z - b.z;
+
+	// Has to carry on the same way, not double back
+	double dot = ux * vx + uy * vy + uz * vz;
+	if ( dot <= 0 )
+		return false;
+
+	// How far b is off the line from a to c
+	double cx = uy * vz - uz * vy, cy = uz * vx - ux * vz, cz = ux * vy - uy * vx;
+	double wx = c.x - a.x, wy = c.y - a.y, wz = c.z - a.z;
+	double flLenSqr = wx * wx + wy * wy + wz * wz;
+	return ( cx * cx + cy * cy + cz * cz ) < k_flEpsilon * k_flEpsilon * flLenSqr;
+}
+
+// Blocking queue with a fixed capacity, for passing work between the stages of a pipeline.
+// Producers wait while it's full, so a fast stage can't run off and fill memory ahead of a slow one
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue( size_t nCapacity ) : m_nCapacity( nCapacity ) {}
+
+	// Waits for room. Returns false if the queue has been closed
+	bool Push( T&& item )
+	{
+		std::unique_lock<std::mutex> lock( m_mutex );
+		m_notFull.wait( lock, [this]() { return m_bClosed || m_items.size() < m_nCapacity; } );
+		if ( m_bClosed )
+			return false;
+		m_items.push_back( std::move( item ) );
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// Waits for an item. Returns false once the queue is closed and nothing is left in it
+	bool Pop( T& item )
+	{
+		std::unique_lock<std::mutex> lock( m_mutex );
+		m_notEmpty.wait( lock, [this]() { return m_bClosed || !m_items.empty(); } );
+		if ( m_items.empty() )
+			return false;
+		item = std::move( m_items.front() );
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// No more pushes. Whatever is already queued can still be popped
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_bClosed = true;
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+	std::deque<T> m_items;
+	size_t m_nCapacity;
+	bool m_bClosed = false;
+};
+
+// Problems with the settings are written to errors, which is the console unless the library's reading them
+int ReadSettings(std::istream& ReadFile, Settings& settings, std::ostream& errors = std::cout)
+{
+	std::string textLine;
+	bool inComment = false;
+	while (getline(ReadFile, textLine))
+	{
+		//std::cout << textLine << "\n";
+		if (textLine.size() == 0)
+			continue;
+
+		//comments
+		if (textLine[0] == '/' && textLine[1] == '/')
+			continue;
+		else if (textLine[0] == '/' && textLine[1] == '*')//decent but not as good as c++
+			inComment = true;
+		else if (textLine[0] == '*' && textLine[1] == '/')
+			inComment = false;
+		if (inComment)
+			continue;
+
+		size_t keyStart = textLine.find('"');
+		size_t keyEnd = textLine.find('"', keyStart + 1);
+		size_t valueStart = textLine.find('"', keyEnd + 1);
+		size_t valueEnd = textLine.find('"', valueStart + 1);
+
+		keyStart++;
+		valueStart++;
+
+		std::string key = textLine.substr(keyStart, keyEnd - keyStart);
+		std::string value = textLine.substr(valueStart, valueEnd - valueStart);
+		//std::cout << "key " << key << " value " << value << "\n";
+		if (key == "default")
+		{
+			if (!strcmp(value.c_str(), "allow"))
+				settings.defaultAllow = true;
+			else if (!strcmp(value.c_str(), "disallow"))
+				settings.defaultAllow = false;
+			else
+			{
+				errors << "Unknown setting for " << key << ". Should be either 'allow' or 'disallow'.\n";
+				return 0;
+			}
+		}
+		else if (key == "drawontop")
+		{
+			if (!strcmp(value.c_str(), "yes"))
+				settings.drawontop = true;
+			else if (!strcmp(value.c_str(), "no"))
+				settings.drawontop = false;
+			else
+			{
+				errors << "Unknown setting for " << key << ". Should be either 'yes' or 'no'.\n";
+				return 0;
+			}
+		}
+		else if (key == "drawtriggeroutlines")
+		{
+			if (!strcmp(value.c_str(), "yes"))
+				settings.drawTriggerOutlines = true;
+			else if (!strcmp(value.c_str(), "no"))
+				settings.drawTriggerOutlines = false;
+			else
+			{
+				errors << "Unknown setting for " << key << ". Should be either 'yes' or 'no'.\n";
+				return 0;
+			}
+		}
+		else if (key == "drawentcubes")
+		{
+			if (!strcmp(value.c_str(), "yes"))
+				settings.drawEntCubes = true;
+			else if (!strcmp(value.c_str(), "no"))
+				settings.drawEntCubes = false;
+			else
+			{
+				errors << "Unknown setting for " << key << ". Should be either 'yes' or 'no'.\n";
+				return 0;
+			}
+		}
+		else if (key == "duration")
+			settings.duration = stoi(value);
+
+		else if (key == "allow" && !settings.defaultAllow)
+			settings.allows.Add(value, errors);
+
+		else if (key == "disallow" && settings.defaultAllow)
+			settings.disallows.Add(value, errors);
+
+		else if (key == "must")
+			settings.musts.Add(value, errors);
+
+		else if (key == "avoid")
+			settings.avoids.Add(value, errors);
+
+		else if (key == "color")
+			settings.clrOverrides.Add(value, errors, true);
+
+		else if (key == "min_x")
+				settings.min_x = stof(value);
+		else if (key == "max_x")
+				settings.max_x = stof(value);
+		else if (key == "min_y")
+				settings.min_y = stof(value);
+		else if (key == "max_y")
+				settings.max_y = stof(value);
+		else if (key == "min_z")
+				settings.min_z = stof(value);
+		else if (key == "max_z")
+				settings.max_z = stof(value);
+
+		else if (key == "region" || key == "sphere")
+		{
+			// Six numbers for the two corners of a box, or four for the center and radius of a sphere
+			float values[6];
+			int nWanted = key == "region" ? 6 : 4;
+			const char* p = value.data();
+			const char* end = p + value.size();
+			int nFound = 0;
+			for (; nFound < nWanted; nFound++)
+			{
+				while (p < end && (*p == ' ' || *p == '\t'))
+					p++;
+				const char* next = ParseFloat(p, end, values[nFound]);
+				if (next == p)
+					break;
+				p = next;
+			}
+			if (nFound != nWanted)
+			{
+				errors << "Couldn't read " << key << " \"" << value << "\". Should be " << (nWanted == 6 ? "'min_x min_y min_z max_x max_y max_z'" : "'x y z radius'") << ".\n";
+				return 0;
+			}
+			if (nWanted == 6)
+			{
+				RegionBox box;
+				for (int i = 0; i < 3; i++)
+				{
+					box.mins[i] = std::min(values[i], values[i + 3]);
+					box.maxs[i] = std::max(values[i], values[i + 3]);
+				}
+				settings.regionBoxes.push_back(box);
+			}
+			else
+				settings.regionSpheres.push_back({ { values[0], values[1], values[2] }, values[3] });
+		}
+	}
+	return 1;
+}
+
+int BaseColorOffCoord(float coord)
+{
+	return (((abs((int)coord % 64) * 4) + 128) / 1.5);
+}
+
+// World space box around everything an entity covers
+struct Bounds
+{
+	Vector3 mins;
+	Vector3 maxs;
+
+	void Add(const Bounds& other)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			mins[i] = std::min(mins[i], other.mins[i]);
+			maxs[i] = std::max(maxs[i], other.maxs[i]);
+		}
+	}
+	bool Overlaps(const RegionBox& box) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			if (maxs[i] < box.mins[i] || mins[i] > box.maxs[i])
+				return false;
+		}
+		return true;
+	}
+	bool Overlaps(const RegionSphere& sphere) const
+	{
+		// Distance from the center to the nearest point of the box
+		float flDistSqr = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			float d = std::max(mins[i] - sphere.center[i], std::max(0.0f, sphere.center[i] - maxs[i]));
+			flDistSqr += d * d;
+		}
+		return flDistSqr <= sphere.radius * sphere.radius;
+	}
+};
+
+// The box made by a brush's 6 bounding box planes, relative to its entity's origin. False if they aren't all lined up with the axes
+bool BrushBoxFromPlanes(const Plane* pPlanes, size_t nPlanes, Bounds& box)
+{
+	box = { { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY } };
+	int nSides = 0;
+	for (size_t iPlane = 0; iPlane < nPlanes; iPlane++)
+	{
+		const Plane& plane = pPlanes[iPlane];
+		if (!plane.bbox)
+			break;
+		for (int i = 0; i < 3; i++)
+		{
+			if (plane.normal[(i + 1) % 3] != 0 || plane.normal[(i + 2) % 3] != 0)
+				continue;
+			if (plane.normal[i] == 1)
+				box.maxs[i] = plane.dist;
+			else if (plane.normal[i] == -1)
+				box.mins[i] = -plane.dist;
+			else
+				continue;
+			nSides++;
+		}
+	}
+	return nSides == 6;
+}
+
+// Moves brush bounds gathered relative to the entity out to where it is. useTriggerBounds is for brushes that couldn't be worked out
+Bounds PlaceEntityBounds(const Entity& ent, Bounds bounds, bool useTriggerBounds)
+{
+	if (useTriggerBounds)
+		bounds.Add({ ent.mins, ent.maxs });
+	if (bounds.mins.x > bounds.maxs.x)
+		return { ent.origin, ent.origin };
+	return { ent.origin + bounds.mins, ent.origin + bounds.maxs };
+}
+
+// The bounds of an entity's brushes, which are known before anything's built from the 6 bounding box planes at the
+// start of each brush. Brushes where those aren't all lined up with the axes use their edges if they've been built,
+// or *trigger_bounds_mins/maxs if not. Entities with no brushes are just their origin
+Bounds EntityBounds(const Entity& ent)
+{
+	Bounds bounds = { { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY } };
+	bool useTriggerBounds = false;
+	for (const Brush& brush : ent.brushes)
+	{
+		Bounds box;
+		if (BrushBoxFromPlanes(brush.planes.data(), brush.planes.size(), box))
+		{
+			bounds.Add(box);
+			continue;
+		}
+		if (brush.edges.empty())
+		{
+			useTriggerBounds = true;
+			continue;
+		}
+		for (const Edge& edge : brush.edges)
+		{
+			bounds.Add({ edge.stem, edge.stem });
+			bounds.Add({ edge.tail, edge.tail });
+		}
+	}
+	return PlaceEntityBounds(ent, bounds, useTriggerBounds);
+}
+
+bool FilterXYZ(const Settings& settings, const Bounds& bounds)
+{
+	if (settings.min_x > bounds.maxs.x ||
+		settings.min_y > bounds.maxs.y ||
+		settings.min_z > bounds.maxs.z ||
+		settings.max_x < bounds.mins.x ||
+		settings.max_y < bounds.mins.y ||
+		settings.max_z < bounds.mins.z)
+		return false;
+	return true;
+}
+
+// Does the entity overlap any region from the settings? One at a time, for when there's no BoundsTree to ask
+bool InRegions(const Settings& settings, const Bounds& bounds)
+{
+	if (!settings.HasRegions())
+		return true;
+	for (const RegionBox& box : settings.regionBoxes)
+	{
+		if (bounds.Overlaps(box))
+			return true;
+	}
+	for (const RegionSphere& sphere : settings.regionSpheres)
+	{
+		if (bounds.Overlaps(sphere))
+			return true;
+	}
+	return false;
+}
+
+// Bounding volume hierarchy over the bounds of every entity in a file, so each region only has to look at the
+// entities near it rather than all of them
+class BoundsTree
+{
+public:
+	void Build(const std::vector<Bounds>& bounds);
+
+	// Calls onItem with the index of every item whose bounds overlap the box or sphere
+	template <typename Shape, typename Callback>
+	void Query(const Shape& shape, Callback&& onItem) const;
+
+private:
+	struct Node
+	{
+		Bounds bounds;
+		int iFirst;		// Leaves: first of m_items. Otherwise: the second child, the first is always right after this node
+		int nItems;		// 0 for nodes that aren't leaves
+	};
+
+	struct BuildItem
+	{
+		float centre[3];
+		int iItem;
+	};
+
+	int BuildNode(std::vector<BuildItem>& items, int iFirst, int nItems);
+
+	const std::vector<Bounds>* m_pBounds = nullptr;
+	std::vector<int> m_items;
+	std::vector<Node> m_nodes;
+};
+
+// Items per leaf
+constexpr int k_nBoundsTreeLeaf = 4;
+
+void BoundsTree::Build(const std::vector<Bounds>& bounds)
+{
+	m_pBounds = &bounds;
+	m_nodes.clear();
+	m_items.resize(bounds.size());
+	if (bounds.empty())
+		return;
+
+	// Sorting these directly is a lot quicker than sorting indices and looking up the bounds every comparison
+	std::vector<BuildItem> items(bounds.size());
+	for (size_t i = 0; i < bounds.size(); i++)
+	{
+		for (int j = 0; j < 3; j++)
+			items[i].centre[j] = bounds[i].mins[j] + bounds[i].maxs[j];
+		items[i].iItem = i;
+	}
+	m_nodes.reserve(bounds.size() / k_nBoundsTreeLeaf * 2 + 1);
+	BuildNode(items, 0, bounds.size());
+}
+
+int BoundsTree::BuildNode(std::vector<BuildItem>& items, int iFirst, int nItems)
+{
+	int iNode = m_nodes.size();
+	m_nodes.push_back({ {}, iFirst, nItems });
+	if (nItems <= k_nBoundsTreeLeaf)
+	{
+		const std::vector<Bounds>& bounds = *m_pBounds;
+		Bounds nodeBounds = bounds[items[iFirst].iItem];
+		for (int i = iFirst; i < iFirst + nItems; i++)
+		{
+			m_items[i] = items[i].iItem;
+			nodeBounds.Add(bounds[m_items[i]]);
+		}
+		m_nodes[iNode].bounds = nodeBounds;
+		return iNode;
+	}
+
+	// Split down the middle of the longest side of the centres
+	float mins[3] = { INFINITY, INFINITY, INFINITY };
+	float maxs[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (int i = iFirst; i < iFirst + nItems; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			mins[j] = std::min(mins[j], items[i].centre[j]);
+			maxs[j] = std::max(maxs[j], items[i].centre[j]);
+		}
+	}
+	int iAxis = 0;
+	if (maxs[1] - mins[1] > maxs[iAxis] - mins[iAxis])
+		iAxis = 1;
+	if (maxs[2] - mins[2] > maxs[iAxis] - mins[iAxis])
+		iAxis = 2;
+	int nLeft = nItems / 2;
+	std::nth_element(items.begin() + iFirst, items.begin() + iFirst + nLeft, items.begin() + iFirst + nItems, [iAxis](const BuildItem& a, const BuildItem& b)
+	{
+		return a.centre[iAxis] < b.centre[iAxis];
+	});
+
+	BuildNode(items, iFirst, nLeft);
+	int iRight = BuildNode(items, iFirst + nLeft, nItems - nLeft);
+	Bounds nodeBounds = m_nodes[iNode + 1].bounds;
+	nodeBounds.Add(m_nodes[iRight].bounds);
+	m_nodes[iNode] = { nodeBounds, iRight, 0 };
+	return iNode;
+}
+
+template <typename Shape, typename Callback>
+void BoundsTree::Query(const Shape& shape, Callback&& onItem) const
+{
+	if (m_nodes.empty())
+		return;
+	int stack[64];
+	int nStack = 0;
+	stack[nStack++] = 0;
+	while (nStack)
+	{
+		int iNode = stack[--nStack];
+		const Node& node = m_nodes[iNode];
+		if (!node.bounds.Overlaps(shape))
+			continue;
+		if (!node.nItems)
+		{
+			stack[nStack++] = node.iFirst;
+			stack[nStack++] = iNode + 1;
+			continue;
+		}
+		for (int i = node.iFirst; i < node.iFirst + node.nItems; i++)
+		{
+			if ((*m_pBounds)[m_items[i]].Overlaps(shape))
+				onItem(m_items[i]);
+		}
+	}
+}
+
+// Below this many regions it's quicker to just check each one than to build a BoundsTree
+constexpr size_t k_nRegionsForTree = 64;
+
+// Which of the entities overlap any region, looked up through a BoundsTree
+std::vector<char> FindEntitiesInRegions(const Settings& settings, const std::vector<Bounds>& bounds)
+{
+	std::vector<char> inRegion(bounds.size(), !settings.HasRegions());
+	if (!settings.HasRegions())
+		return inRegion;
+	if (settings.regionBoxes.size() + settings.regionSpheres.size() < k_nRegionsForTree)
+	{
+		for (size_t i = 0; i < bounds.size(); i++)
+			inRegion[i] = InRegions(settings, bounds[i]);
+		return inRegion;
+	}
+
+	BoundsTree tree;
+	tree.Build(bounds);
+	auto mark = [&inRegion](int i) { inRegion[i] = true; };
+	for (const RegionBox& box : settings.regionBoxes)
+		tree.Query(box, mark);
+	for (const RegionSphere& sphere : settings.regionSpheres)
+		tree.Query(sphere, mark);
+	return inRegion;
+}
+
+// Gives each distinct corner one index. BrushBuilder has already welded them, so the same corner is always exactly the same.
+// Open addressing in a table at least twice the size of the most corners there could be
+class CornerIndex
+{
+public:
+	// Starts over for up to nMaxVerts corners, which get added on to the end of verts as they're found
+	void Reset(std::vector<Vector3>& verts, size_t nMaxVerts)
+	{
+		m_pVerts = &verts;
+		m_iFirstVert = verts.size();
+		size_t nTable = 16;
+		while (nTable < nMaxVerts * 2)
+			nTable *= 2;
+		m_table.assign(nTable, k_iInvalidVertex);
+	}
+
+	// Counting from where verts ended at Reset
+	uint32_t IndexOf(const Vector3& v)
+	{
+		uint32_t bits[3];
+		memcpy(bits, &v, sizeof(bits));
+		size_t nMask = m_table.size() - 1;
+		size_t iSlot = HashMix(((uint64_t)bits[0] << 32 | bits[1]) ^ HashMix(bits[2])) & nMask;
+		while (m_table[iSlot] != k_iInvalidVertex)
+		{
+			if ((*m_pVerts)[m_iFirstVert + m_table[iSlot]] == v)
+				return m_table[iSlot];
+			iSlot = (iSlot + 1) & nMask;
+		}
+		m_table[iSlot] = m_pVerts->size() - m_iFirstVert;
+		m_pVerts->push_back(v);
+		return m_table[iSlot];
+	}
+
+private:
+	std::vector<Vector3>* m_pVerts = nullptr;
+	size_t m_iFirstVert = 0;
+	std::vector<uint32_t> m_table;
+};
+
+// A brush in a FlatMap, as runs of the map's planes, vertices and edges
+struct FlatBrush
+{
+	uint32_t iFirstPlane;
+	uint32_t nPlanes;
+	uint32_t iFirstVert;
+	uint32_t nVerts;
+	uint32_t iFirstEdge;
+	uint32_t nEdges;
+	BrushShape shape;
+};
+
+// Indices into the vertices of the edge's brush
+struct FlatEdge
+{
+	uint16_t iVert1;
+	uint16_t iVert2;
+};
+
+// How many brushes a FlatMap build thread takes at a time
+constexpr size_t k_nFlatBuildChunk = 16;
+
+// A whole map in one array each of planes, vertices and edges, with brushes and entities as runs of them.
+// Filling one of these takes a handful of allocations that grow now and then, rather than a few for every brush like
+// Entity does, and edges share their brush's vertices instead of each holding two. Keyvalues are kept as an Entity
+// with no brushes, so filters can look at them as they are
+class FlatMap
+{
+public:
+	// Empties the map and frees its arrays
+	void Clear();
+
+	// Makes room up front so the arrays aren't copied over and over while they grow
+	void Reserve(size_t nEntities, size_t nPlanes);
+
+	// Copies an entity in. It's left alone, so the parser can use its buffers again
+	void Add(const Entity& ent);
+
+	size_t EntityCount() const { return m_entities.size(); }
+	size_t BrushCount() const { return m_brushes.size(); }
+	size_t PlaneCount() const { return m_planes.size(); }
+	size_t VertCount() const { return m_verts.size(); }
+	size_t EdgeCount() const { return m_edges.size(); }
+
+	// Just the keyvalues, brushes is always empty
+	const Entity& GetEntity(size_t iEntity) const { return m_entities[iEntity]; }
+
+	uint32_t FirstBrush(size_t iEntity) const { return m_firstBrush[iEntity]; }
+	uint32_t EndBrush(size_t iEntity) const { return m_firstBrush[iEntity + 1]; }
+	const FlatBrush& GetBrush(size_t iBrush) const { return m_brushes[iBrush]; }
+	const Plane* Planes(const FlatBrush& brush) const { return m_planes.data() + brush.iFirstPlane; }
+	const Vector3* Verts(const FlatBrush& brush) const { return m_verts.data() + brush.iFirstVert; }
+	const FlatEdge* Edges(const FlatBrush& brush) const { return m_edges.data() + brush.iFirstEdge; }
+	Edge GetEdge(const FlatBrush& brush, uint32_t iEdge) const
+	{
+		const FlatEdge& edge = m_edges[brush.iFirstEdge + iEdge];
+		return { m_verts[brush.iFirstVert + edge.iVert1], m_verts[brush.iFirstVert + edge.iVert2] };
+	}
+
+	// Same as EntityBounds on the entity as it was added
+	Bounds EntityBounds(size_t iEntity) const;
+
+	// Moves the entities where keep is set back out as Entity objects with their brushes, and edges if they're built.
+	// The map is left empty. The keyvalues array is handed over as it is, so there's never a second one
+	std::vector<Entity> TakeEntities(const std::vector<char>& keep);
+
+	// Builds every brush, replacing any vertices and edges there were. Each thread builds with its own BrushBuilder set up like bb.
+	// With pBuild, only brushes of entities it's set for are built and the rest are left with no edges
+	void Build(BrushBuilder& bb, int nThreads, const std::vector<char>* pBuild = nullptr);
+
+	// Bytes in use by the arrays, not counting keyvalue strings
+	size_t BytesUsed() const;
+
+private:
+	std::vector<Entity> m_entities;
+	std::vector<uint32_t> m_firstBrush = { 0 };		// One per entity, plus one more on the end
+	std::vector<FlatBrush> m_brushes;
+	std::vector<Plane> m_planes;
+	std::vector<Vector3> m_verts;
+	std::vector<FlatEdge> m_edges;
+};
+
+void FlatMap::Clear()
+{
+	// Gives the memory back too, a map this big isn't going to be filled again any time soon
+	*this = FlatMap();
+}
+
+void FlatMap::Reserve(size_t nEntities, size_t nPlanes)
+{
+	m_entities.reserve(nEntities);
+	m_firstBrush.reserve(nEntities + 1);
+	m_planes.reserve(nPlanes);
+}
+
+void FlatMap::Add(const Entity& ent)
+{
+	Entity& keyvalues = m_entities.emplace_back();
+	for (int i = 0; i < k_nEntityStrings; i++)
+		*EntityStrings(keyvalues, i) = *EntityStrings(ent, i);
+	keyvalues.origin = ent.origin;
+	keyvalues.mins = ent.mins;
+	keyvalues.maxs = ent.maxs;
+	keyvalues.isTrigger = ent.isTrigger;
+
+	for (const Brush& brush : ent.brushes)
+	{
+		m_brushes.push_back({ (uint32_t)m_planes.size(), (uint32_t)brush.planes.size(), (uint32_t)m_verts.size(), 0, (uint32_t)m_edges.size(), 0, brush.shape });
+		m_planes.insert(m_planes.end(), brush.planes.begin(), brush.planes.end());
+	}
+	m_firstBrush.push_back(m_brushes.size());
+}
+
+Bounds FlatMap::EntityBounds(size_t iEntity) const
+{
+	Bounds bounds = { { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY } };
+	bool useTriggerBounds = false;
+	for (uint32_t iBrush = FirstBrush(iEntity); iBrush < EndBrush(iEntity); iBrush++)
+	{
+		const FlatBrush& brush = m_brushes[iBrush];
+		Bounds box;
+		if (BrushBoxFromPlanes(Planes(brush), brush.nPlanes, box))
+		{
+			bounds.Add(box);
+			continue;
+		}
+		if (!brush.nEdges)
+		{
+			useTriggerBounds = true;
+			continue;
+		}
+		for (uint32_t iVert = 0; iVert < brush.nVerts; iVert++)
+		{
+			const Vector3& vert = m_verts[brush.iFirstVert + iVert];
+			bounds.Add({ vert, vert });
+		}
+	}
+	return PlaceEntityBounds(m_entities[iEntity], bounds, useTriggerBounds);
+}
+
+std::vector<Entity> FlatMap::TakeEntities(const std::vector<char>& keep)
+{
+	std::vector<Entity> entities = std::move(m_entities);
+	size_t nKept = 0;
+	for (size_t iEntity = 0; iEntity < entities.size(); iEntity++)
+	{
+		if (!keep[iEntity])
+			continue;
+		Entity& ent = entities[nKept];
+		if (nKept != iEntity)
+			ent = std::move(entities[iEntity]);
+		nKept++;
+
+		ent.brushes.resize(EndBrush(iEntity) - FirstBrush(iEntity));
+		for (uint32_t iBrush = FirstBrush(iEntity); iBrush < EndBrush(iEntity); iBrush++)
+		{
+			const FlatBrush& flat = m_brushes[iBrush];
+			Brush& brush = ent.brushes[iBrush - FirstBrush(iEntity)];
+			brush.planes.assign(Planes(flat), Planes(flat) + flat.nPlanes);
+			brush.shape = flat.shape;
+			brush.edges.resize(flat.nEdges);
+			for (uint32_t iEdge = 0; iEdge < flat.nEdges; iEdge++)
+				brush.edges[iEdge] = GetEdge(flat, iEdge);
+		}
+	}
+	entities.resize(nKept);
+	Clear();
+	return entities;
+}
+
+void FlatMap::Build(BrushBuilder& bb, int nThreads, const std::vector<char>* pBuild)
+{
+	std::vector<char> buildBrush;
+	if (pBuild)
+	{
+		buildBrush.resize(m_brushes.size());
+		for (size_t iEntity = 0; iEntity < m_entities.size(); iEntity++)
+			std::fill(buildBrush.begin() + FirstBrush(iEntity), buildBrush.begin() + EndBrush(iEntity), (*pBuild)[iEntity]);
+	}
+
+	// Each chunk of brushes is built into arrays of its own, then they're all copied in one after another
+	struct Chunk
+	{
+		std::vector<Vector3> verts;
+		std::vector<FlatEdge> edges;
+		std::vector<uint32_t> counts;	// Vertex then edge count, for each brush
+	};
+	size_t nChunks = (m_brushes.size() + k_nFlatBuildChunk - 1) / k_nFlatBuildChunk;
+	std::vector<Chunk> chunks(nChunks);
+	std::atomic<size_t> nextChunk = 0;
+	std::mutex errorMutex;
+	std::string error;
+
+	auto worker = [&](BrushBuilder& builder)
+	{
+		Brush scratch;
+		CornerIndex corners;
+		for (size_t iChunk = nextChunk++; iChunk < nChunks; iChunk = nextChunk++)
+		{
+			Chunk& chunk = chunks[iChunk];
+			size_t iEnd = std::min(m_brushes.size(), (iChunk + 1) * k_nFlatBuildChunk);
+			for (size_t iBrush = iChunk * k_nFlatBuildChunk; iBrush < iEnd; iBrush++)
+			{
+				if (pBuild && !buildBrush[iBrush])
+				{
+					chunk.counts.push_back(0);
+					chunk.counts.push_back(0);
+					continue;
+				}
+
+				const FlatBrush& brush = m_brushes[iBrush];
+				scratch.planes.assign(Planes(brush), Planes(brush) + brush.nPlanes);
+				scratch.shape = brush.shape;
+				scratch.edges.clear();
+				builder.Build(scratch);
+
+				size_t iFirstVert = chunk.verts.size();
+				corners.Reset(chunk.verts, scratch.edges.size() * 2);
+				for (const Edge& edge : scratch.edges)
+				{
+					uint32_t iVert1 = corners.IndexOf(edge.stem);
+					uint32_t iVert2 = corners.IndexOf(edge.tail);
+					chunk.edges.push_back({ (uint16_t)iVert1, (uint16_t)iVert2 });
+				}
+				size_t nVerts = chunk.verts.size() - iFirstVert;
+				if (nVerts > UINT16_MAX)
+				{
+					std::lock_guard<std::mutex> lock(errorMutex);
+					error = "brush with more than 65535 corners";
+				}
+				chunk.counts.push_back(nVerts);
+				chunk.counts.push_back(scratch.edges.size());
+			}
+		}
+	};
+
+	if (nThreads <= 0)
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+	nThreads = std::max(1, std::min<int>(nThreads, nChunks));
+	std::vector<std::thread> threads;
+	std::vector<BuildStats> threadStats(nThreads);
+	for (int i = 1; i < nThreads; i++)
+	{
+		threads.emplace_back([&worker, &threadStats, &bb, i]()
+		{
+			BrushBuilder threadBuilder;
+			threadBuilder.SetKernel(bb.GetKernel());
+			threadBuilder.SetMethod(bb.GetMethod());
+			threadBuilder.SetTiming(bb.GetTiming());
+			worker(threadBuilder);
+			threadStats[i] = threadBuilder.GetStats();
+		});
+	}
+	worker(bb);
+	for (std::thread& thread : threads)
+		thread.join();
+	for (int i = 1; i < nThreads; i++)
+		bb.AddStats(threadStats[i]);
+	if (!error.empty())
+		throw std::length_error(error);
+
+	size_t nVerts = 0, nEdges = 0;
+	for (const Chunk& chunk : chunks)
+	{
+		nVerts += chunk.verts.size();
+		nEdges += chunk.edges.size();
+	}
+	m_verts.clear();
+	m_edges.clear();
+	m_verts.reserve(nVerts);
+	m_edges.reserve(nEdges);
+	size_t iBrush = 0;
+	for (const Chunk& chunk : chunks)
+	{
+		// Each brush starts where the one before it in the chunk ended, not where the chunk does
+		size_t iFirstVert = m_verts.size();
+		size_t iFirstEdge = m_edges.size();
+		for (size_t i = 0; i < chunk.counts.size(); i += 2, iBrush++)
+		{
+			FlatBrush& brush = m_brushes[iBrush];
+			brush.iFirstVert = iFirstVert;
+			brush.nVerts = chunk.counts[i];
+			brush.iFirstEdge = iFirstEdge;
+			brush.nEdges = chunk.counts[i + 1];
+			iFirstVert += brush.nVerts;
+			iFirstEdge += brush.nEdges;
+		}
+		m_verts.insert(m_verts.end(), chunk.verts.begin(), chunk.verts.end());
+		m_edges.insert(m_edges.end(), chunk.edges.begin(), chunk.edges.end());
+	}
+}
+
+size_t FlatMap::BytesUsed() const
+{
+	return m_entities.size() * sizeof(Entity) + m_firstBrush.size() * sizeof(uint32_t) + m_brushes.size() * sizeof(FlatBrush)
+		+ m_planes.size() * sizeof(Plane) + m_verts.size() * sizeof(Vector3) + m_edges.size() * sizeof(FlatEdge);
+}
+
+// Parses a whole lump straight into a FlatMap
+void ParseBufferFlat(std::string_view data, FlatMap& map)
+{
+	// Counting is a lot quicker than parsing, and gets an upper bound on both without ever growing the arrays
+	size_t nEntities = std::count(data.begin(), data.end(), '{');
+	size_t nPlanes = 0;
+	for (size_t i = data.find("*trigger_brush_"); i != std::string_view::npos; i = data.find("*trigger_brush_", i + 1))
+		nPlanes++;
+	map.Reserve(nEntities, nPlanes);
+
+	ParseBufferEach(data, [&map](Entity&& ent) { map.Add(ent); });
+}
+
+//monstrosity
+void ParsePair(const std::string& line, std::string& key, std::string& value, char c1, char c2, char c3, std::string* rest = NULL)
+{
+	size_t keyStart = line.find(c1);
+	size_t keyEnd = line.find(c2, keyStart + 1);
+	size_t valueEnd = line.find(c3, keyEnd + 1);
+
+	keyStart++;
+	key = line.substr(keyStart, keyEnd - keyStart);
+
+	keyEnd++;
+	value = line.substr(keyEnd, valueEnd - keyEnd);
+
+	if (rest != NULL)
+		*rest = line.substr(valueEnd);
+}
+
+const std::string& FilterFieldValue(const Entity& ent, FilterField field)
+{
+	switch (field)
+	{
+	case FilterField::Classname:		return ent.classname;
+	case FilterField::Editorclass:		return ent.editorclass;
+	case FilterField::ScriptFlag:		return ent.script_flag;
+	case FilterField::ScriptName:		return ent.script_name;
+	case FilterField::ScrFlagTrueAll:	return ent.scr_flagTrueAll;
+	case FilterField::ScrFlagFalseAll:	return ent.scr_flagFalseAll;
+	case FilterField::ScrFlagSet:		return ent.scr_flagSet;
+	case FilterField::Spawnclass:		return ent.spawnclass;
+	default:							return ent.targetname;
+	}
+}
+
+FilterField FilterFieldFromName(const std::string& key)
+{
+	if (key == "classname")
+		return FilterField::Classname;
+	else if (key == "editorclass")
+		return FilterField::Editorclass;
+	else if (key == "script_flag")
+		return FilterField::ScriptFlag;
+	else if (key == "script_name")
+		return FilterField::ScriptName;
+	else if (key == "scr_flagTrueAll")
+		return FilterField::ScrFlagTrueAll;
+	else if (key == "scr_flagFalseAll")
+		return FilterField::ScrFlagFalseAll;
+	else if (key == "scr_flagSet")
+		return FilterField::ScrFlagSet;
+	else if (key == "spawnclass")
+		return FilterField::Spawnclass;
+	else if (key == "targetname")
+		return FilterField::Targetname;
+	else if (key == "_istrigger")
+		return FilterField::IsTrigger;
+	return FilterField::Unknown;
+}
+
+bool FilterRule::Matches(const Entity& ent) const
+{
+	if (field == FilterField::IsTrigger)
+		return ent.isTrigger;
+	if (field == FilterField::Unknown)
+		return false;
+
+	const std::string& value = FilterFieldValue(ent, field);
+	if (!prefix)
+		return value == pattern;
+
+	// A * on its own still needs something to be there
+	return !value.empty() && value.compare(0, pattern.size(), pattern) == 0;
+}
+
+void FilterTrie::Insert(std::string_view pattern, bool prefix, int iRule)
+{
+	int iNode = 0;
+	for (char c : pattern)
+	{
+		int iChild = nodes[iNode].firstChild;
+		while (iChild != -1 && nodes[iChild].c != c)
+			iChild = nodes[iChild].nextSibling;
+
+		if (iChild == -1)
+		{
+			Node child;
+			child.c = c;
+			child.nextSibling = nodes[iNode].firstChild;
+			iChild = nodes.size();
+			nodes.push_back(child);
+			nodes[iNode].firstChild = iChild;
+		}
+		iNode = iChild;
+	}
+
+	int& iStored = prefix ? nodes[iNode].prefixRule : nodes[iNode].exactRule;
+	iStored = std::min(iStored, iRule);
+}
+
+int FilterTrie::FirstMatch(std::string_view str) const
+{
+	// Prefix patterns never match an empty value
+	bool allowPrefix = !str.empty();
+	int iBest = INT_MAX;
+	int iNode = 0;
+	for (char c : str)
+	{
+		// Every node we pass through is a prefix of str
+		if (allowPrefix)
+			iBest = std::min(iBest, nodes[iNode].prefixRule);
+
+		int iChild = nodes[iNode].firstChild;
+		while (iChild != -1 && nodes[iChild].c != c)
+			iChild = nodes[iChild].nextSibling;
+
+		if (iChild == -1)
+			return iBest;
+		iNode = iChild;
+	}
+
+	// Made it to the end of str, so exact patterns ending here count too
+	if (allowPrefix)
+		iBest = std::min(iBest, nodes[iNode].prefixRule);
+	return std::min(iBest, nodes[iNode].exactRule);
+}
+
+void RuleSet::Add(const std::string& line, std::ostream& errors, bool hasColor)
+{
+	FilterRule rule;
+	std::string key;
+	std::string value;
+	if (hasColor)
+	{
+		std::string rest;
+		ParsePair(line, key, value, '"', ' ', ' ', &rest);
+		Vector3 vecClr = ParseVector(rest);
+		rule.color[0] = vecClr.x;
+		rule.color[1] = vecClr.y;
+		rule.color[2] = vecClr.z;
+	}
+	else
+		ParsePair(line, key, value, '"', ' ', '"');
+
+	rule.field = FilterFieldFromName(key);
+	if (rule.field == FilterField::Unknown)
+		errors << "Did not recognize property named " << key << ".\n";
+
+	// Anything after a * doesn't matter
+	size_t star = value.find('*');
+	rule.prefix = star != std::string::npos;
+	rule.pattern = value.substr(0, star);
+
+	int iRule = rules.size();
+	if (rule.field == FilterField::IsTrigger)
+		isTriggerRule = std::min(isTriggerRule, iRule);
+	else if (rule.field != FilterField::Unknown)
+	{
+		tries[(int)rule.field].Insert(rule.pattern, rule.prefix, iRule);
+		trieUsed[(int)rule.field] = true;
+	}
+	rules.push_back(rule);
+}
+
+int RuleSet::FirstMatch(const Entity& ent) const
+{
+	int iBest = ent.isTrigger ? isTriggerRule : INT_MAX;
+	for (int iField = 0; iField < (int)FilterField::StringFieldCount; iField++)
+	{
+		if (trieUsed[iField])
+			iBest = std::min(iBest, tries[iField].FirstMatch(FilterFieldValue(ent, (FilterField)iField)));
+	}
+	return iBest == INT_MAX ? -1 : iBest;
+}
+
+bool RuleSet::AllMatch(const Entity& ent) const
+{
+	for (const FilterRule& rule : rules)
+	{
+		if (!rule.Matches(ent))
+			return false;
+	}
+	return true;
+}
+
+// Everything but the regions, which ProcessFile looks up for every entity at once
+bool PassesRules(const Settings& settings, const Entity& ent, const Bounds& bounds)
+{
+	//filtering
+	if (settings.defaultAllow)
+	{
+		//disallow for whitelist, then re-allow
+		if (settings.disallows.AnyMatch(ent) && !settings.allows.AnyMatch(ent))
+			return false;//got disallowed, no re-allow
+	}
+	else
+	{
+		//allow for blacklist
+		if (!settings.allows.AnyMatch(ent))
+			return false;//never was allowed
+	}
+
+	if (!settings.musts.AllMatch(ent))
+		return false;
+
+	if (settings.avoids.AnyMatch(ent))
+		return false;
+
+	if (!FilterXYZ(settings, bounds))
+		return false;
+
+	return true;
+}
+
+bool PassesFilters(const Settings& settings, const Entity& ent)
+{
+	Bounds bounds = EntityBounds(ent);
+	return PassesRules(settings, ent, bounds) && InRegions(settings, bounds);
+}
+
+bool ColorOverride(const Settings& settings, const Entity& ent, int* color)
+{
+	int iRule = settings.clrOverrides.FirstMatch(ent);
+	if (iRule < 0)
+		return false;
+
+	const FilterRule& rule = settings.clrOverrides.rules[iRule];
+	color[0] = rule.color[0];
+	color[1] = rule.color[1];
+	color[2] = rule.color[2];
+	return true;
+}
+
+// A color rule's color if there is one, otherwise one worked out from where the entity is
+void EntityColor(const Settings& settings, const Entity& ent, int* color)
+{
+	if (ColorOverride(settings, ent, color))
+		return;
+	color[0] = BaseColorOffCoord(ent.origin.x);
+	color[1] = BaseColorOffCoord(ent.origin.y);
+	color[2] = BaseColorOffCoord(ent.origin.z);
+}
+
+// Are the entity's brushes going to be drawn, so need building? Only worth asking once it's passed the filters
+bool DrawsBrushes(const Settings& settings, const Entity& ent)
+{
+	return ent.isTrigger && settings.drawTriggerOutlines;
+}
+
+// How CfgWriter writes floats
+enum class FloatStyle
+{
+	Shortest,	// As few digits as it takes to read back as exactly the same float, never with an exponent
+	Fixed,		// A set number of decimal places
+	Legacy,		// 6 significant digits, same as std::ostream. Coordinates past 100000 lose digits
+};
+
+// Buffer that grows past this only when there's nowhere to flush to
+constexpr size_t k_nCfgBufferSize = 1 << 20;
+
+// Builds cfg text in a big reusable buffer, with std::to_chars doing the numbers, and hands it to a stream a block at a time.
+// Without a stream it just collects the text for TakeText.
+// Takes << like a stream so WriteEntity doesn't care which it's writing to
+class CfgWriter
+{
+public:
+	explicit CfgWriter( std::ostream* pOut = nullptr, FloatStyle style = FloatStyle::Shortest, int nDecimals = 0 )
+		: m_pOut( pOut ), m_style( style ), m_nDecimals( nDecimals )
+	{
+		m_buffer.resize( k_nCfgBufferSize );
+	}
+	~CfgWriter() { Flush(); }
+
+	CfgWriter& operator<<( std::string_view text )
+	{
+		char* p = Reserve( text.size() );
+		memcpy( p, text.data(), text.size() );
+		m_nUsed += text.size();
+		return *this;
+	}
+	CfgWriter& operator<<( const char* text ) { return *this << std::string_view( text ); }
+	CfgWriter& operator<<( char c ) { return *this << std::string_view( &c, 1 ); }
+	CfgWriter& operator<<( const std::string& text ) { return *this << std::string_view( text ); }
+
+	CfgWriter& operator<<( int value )
+	{
+		char* p = Reserve( 16 );
+		m_nUsed = std::to_chars( p, p + 16, value ).ptr - m_buffer.data();
+		return *this;
+	}
+
+	CfgWriter& operator<<( float value );
+
+	// Raw bytes, for the binary formats
+	void Write( const void* pData, size_t nBytes ) { *this << std::string_view( (const char*)pData, nBytes ); }
+
+	// Sends everything so far to the stream, if there is one
+	void Flush();
+
+	// Everything written so far, emptying the buffer. Only for writers without a stream
+	std::string TakeText();
+
+private:
+	// Returns somewhere to put n more bytes
+	char* Reserve( size_t n )
+	{
+		if ( m_nUsed + n > m_buffer.size() )
+		{
+			Flush();
+			if ( m_nUsed + n > m_buffer.size() )
+				m_buffer.resize( std::max( m_buffer.size() * 2, m_nUsed + n ) );
+		}
+		return m_buffer.data() + m_nUsed;
+	}
+
+	std::ostream* m_pOut;
+	FloatStyle m_style;
+	int m_nDecimals;
+	std::vector<char> m_buffer;
+	size_t m_nUsed = 0;
+};
+
+CfgWriter& CfgWriter::operator<<( float value )
+{
+	// Enough for any float in fixed notation, which can run to 39 digits before the point
+	constexpr size_t nMaxChars = 64;
+	char* p = Reserve( nMaxChars );
+	std::to_chars_result result;
+	switch ( m_style )
+	{
+	case FloatStyle::Shortest:
+		result = std::to_chars( p, p + nMaxChars, value, std::chars_format::fixed );
+		break;
+	case FloatStyle::Fixed:
+		result = std::to_chars( p, p + nMaxChars, value, std::chars_format::fixed, m_nDecimals );
+		break;
+	default:
+		result = std::to_chars( p, p + nMaxChars, value, std::chars_format::general, 6 );
+		break;
+	}
+
+	// Only way for this to fail is a huge value with lots of decimals, fall back on the short form
+	if ( result.ec != std::errc() )
+		result = std::to_chars( p, p + nMaxChars, value );
+	m_nUsed = result.ptr - m_buffer.data();
+	return *this;
+}
+
+void CfgWriter::Flush()
+{
+	if ( !m_pOut || m_nUsed == 0 )
+		return;
+	m_pOut->write( m_buffer.data(), m_nUsed );
+	m_nUsed = 0;
+}
+
+std::string CfgWriter::TakeText()
+{
+	std::string text( m_buffer.data(), m_nUsed );
+	m_nUsed = 0;
+	return text;
+}
+
+// Brushes drawn more than once with exactly the same edges relative to their entity's origin, for -instance.
+// Each of those shapes is written once as an array, and every brush with it becomes a single call that draws the array at its origin
+class ShapeTable
+{
+public:
+	// Finds the shapes among the brushes of every entity given that gets its brushes drawn
+	void Find(const Settings& settings, const std::vector<Entity>& entities);
+
+	// Index of the shape a brush is drawn with, or -1 if it's drawn line by line as usual
+	int ShapeOf(const Brush& brush) const
+	{
+		auto it = m_brushShapes.find(&brush);
+		return it == m_brushShapes.end() ? -1 : it->second;
+	}
+
+	size_t ShapeCount() const { return m_shapes.size(); }
+	size_t PlacementCount() const { return m_brushShapes.size(); }
+
+	// DebugDrawLine calls a normal cfg would have had for the brushes that were instanced, and the lines written for them instead
+	size_t LinesBefore() const { return m_nLinesBefore; }
+	size_t LinesAfter() const { return m_nLinesAfter; }
+
+	// The drawing function and every shape's array, which have to come before anything uses them
+	template <typename Output>
+	void WriteShapes(Output& writingFile) const;
+
+private:
+	static uint64_t HashEdges(const std::vector<Edge>& edges);
+
+	std::vector<const Brush*> m_shapes;
+	std::unordered_map<const Brush*, int> m_brushShapes;
+	size_t m_nLinesBefore = 0;
+	size_t m_nLinesAfter = 0;
+};
+
+// Edges per line of a shape's array, to keep lines well short of what the console will take
+constexpr int k_nShapeEdgesPerLine = 8;
+
+uint64_t ShapeTable::HashEdges(const std::vector<Edge>& edges)
+{
+	uint64_t h = HashMix(edges.size());
+	for (const Edge& edge : edges)
+	{
+		const float values[6] = { edge.stem.x, edge.stem.y, edge.stem.z, edge.tail.x, edge.tail.y, edge.tail.z };
+		for (float value : values)
+		{
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			h = HashMix(h ^ bits);
+		}
+	}
+	return h;
+}
+
+void ShapeTable::Find(const Settings& settings, const std::vector<Entity>& entities)
+{
+	// Group every drawn brush with the others that match it exactly
+	std::unordered_map<uint64_t, std::vector<size_t>> groupsByHash;
+	std::vector<std::vector<const Brush*>> groups;
+	for (const Entity& ent : entities)
+	{
+		if (!DrawsBrushes(settings, ent))
+			continue;
+		for (const Brush& brush : ent.brushes)
+		{
+			if (brush.edges.empty())
+				continue;
+
+			std::vector<size_t>& candidates = groupsByHash[HashEdges(brush.edges)];
+			bool found = false;
+			for (size_t iGroup : candidates)
+			{
+				const std::vector<Edge>& edges = groups[iGroup][0]->edges;
+				if (edges.size() == brush.edges.size() && !memcmp(edges.data(), brush.edges.data(), edges.size() * sizeof(Edge)))
+				{
+					groups[iGroup].push_back(&brush);
+					found = true;
+					break;
+				}
+			}
+			if (!found)
+			{
+				candidates.push_back(groups.size());
+				groups.push_back({ &brush });
+			}
+		}
+	}
+
+	// Anything only drawn once is cheaper as plain lines
+	for (const std::vector<const Brush*>& group : groups)
+	{
+		if (group.size() < 2)
+			continue;
+		int iShape = m_shapes.size();
+		m_shapes.push_back(group[0]);
+		for (const Brush* pBrush : group)
+			m_brushShapes[pBrush] = iShape;
+
+		size_t nEdges = group[0]->edges.size();
+		m_nLinesBefore += nEdges * group.size();
+		m_nLinesAfter += 1 + (nEdges + k_nShapeEdgesPerLine - 1) / k_nShapeEdgesPerLine + group.size();
+	}
+	if (!m_shapes.empty())
+		m_nLinesAfter++;
+}
+
+template <typename Output>
+void ShapeTable::WriteShapes(Output& writingFile) const
+{
+	if (m_shapes.empty())
+		return;
+
+	// Each shape is a flat array of stem and tail coordinates, six to an edge
+	writingFile << "script_client ::PP_DrawShape <- function(s, x, y, z, r, g, b, t, d) { for (local i = 0; i < s.len(); i += 6) "
+		"DebugDrawLine(Vector(x + s[i], y + s[i + 1], z + s[i + 2]), Vector(x + s[i + 3], y + s[i + 4], z + s[i + 5]), r, g, b, t, d) }\n";
+	for (size_t iShape = 0; iShape < m_shapes.size(); iShape++)
+	{
+		const std::vector<Edge>& edges = m_shapes[iShape]->edges;
+		writingFile << "script_client ::PP_Shape" << (int)iShape << " <- []\n";
+		for (size_t iFirst = 0; iFirst < edges.size(); iFirst += k_nShapeEdgesPerLine)
+		{
+			writingFile << "script_client ::PP_Shape" << (int)iShape << ".extend([";
+			size_t iEnd = std::min(edges.size(), iFirst + k_nShapeEdgesPerLine);
+			for (size_t i = iFirst; i < iEnd; i++)
+			{
+				const Edge& edge = edges[i];
+				writingFile << (i == iFirst ? "" : ", ") << edge.stem.x << ", " << edge.stem.y << ", " << edge.stem.z << ", "
+					<< edge.tail.x << ", " << edge.tail.y << ", " << edge.tail.z;
+			}
+			writingFile << "])\n";
+		}
+	}
+}
+
+// Writes the lines and cube for one entity that has passed the filters, to a CfgWriter or any std::ostream.
+// This is only the cfg, other formats are written by the emitters in k_outputFormats.
+// pShapes is only given with -instance, see ShapeTable
+template <typename Output>
+void WriteEntity(Output& writingFile, const Settings& settings, const Entity& ent, const ShapeTable* pShapes = nullptr)
+{
+	int color[3];
+	EntityColor(settings, ent, color);
+	if (!ent.spawnclass.empty()) writingFile << "//Spawn Class: " << ent.spawnclass << "\n";
+	if (!ent.editorclass.empty()) writingFile << "//Editor Class: " << ent.editorclass << "\n";
+	if (!ent.classname.empty()) writingFile << "//Class Name: " << ent.classname << "\n";
+	if (!ent.targetname.empty()) writingFile << "//Target Name: " << ent.targetname << "\n";
+	if (!ent.script_flag.empty()) writingFile << "//Script Flag: " << ent.script_flag << "\n";
+	if (!ent.script_name.empty()) writingFile << "//Script Name: " << ent.script_name << "\n";
+	if (!ent.scr_flagTrueAll.empty()) writingFile << "//scr_flagTrueAll: " << ent.scr_flagTrueAll << "\n";
+	if (!ent.scr_flagFalseAll.empty()) writingFile << "//scr_flagFalseAll: " << ent.scr_flagFalseAll << "\n";
+	if (!ent.scr_flagSet.empty()) writingFile << "//scr_flagSet: " << ent.scr_flagSet << "\n";
+	if (DrawsBrushes(settings, ent))
+	{
+		for (const Brush& brush : ent.brushes)
+		{
+			int iShape = pShapes ? pShapes->ShapeOf(brush) : -1;
+			if (iShape >= 0)
+			{
+				writingFile << "script_client ::PP_DrawShape(::PP_Shape" << iShape << ", "
+					<< ent.origin.x << ", " << ent.origin.y << ", " << ent.origin.z << ", "
+					<< color[0] << ", "
+					<< color[1] << ", "
+					<< color[2] << ", "
+					<< (!settings.drawontop ? "true" : "false") << ", "
+					<< settings.duration << ");\n";
+				continue;
+			}
+
+			for (const Edge& edge : brush.edges)
+			{
+				Vector3 stem = ent.origin + edge.stem;
+				Vector3 tail = ent.origin + edge.tail;
+				writingFile << "script_client DebugDrawLine("
+					<< "Vector(" << stem.x << ", " << stem.y << ", " << stem.z << "), "
+					<< "Vector(" << tail.x << ", " << tail.y << ", " << tail.z << "), "
+					<< color[0] << ", "
+					<< color[1] << ", "
+					<< color[2] << ", "
+					<< (!settings.drawontop ? "true" : "false") << ", "
+					<< settings.duration << ");\n";
+			}
+		}
+	}
+	if (settings.drawEntCubes)
+	{
+		writingFile << "script_client DebugDrawCube("
+			<< "Vector(" << ent.origin.x << ", " << ent.origin.y << ", " << ent.origin.z << "), "
+			<< "16, "
+			<< color[0] << ", "
+			<< color[1] << ", "
+			<< color[2] << ", "
+			<< (!settings.drawontop ? "true" : "false") << ", "
+			<< settings.duration << ");\n";
+	}
+}
+
+// Writes every entity given. Filtering has to have been done already
+template <typename Output>
+void WriteCfg(Output& writingFile, const Settings& settings, const std::vector<Entity>& entities, const ShapeTable* pShapes = nullptr)
+{
+	writingFile << "sv_cheats 1;enable_debug_overlays 1;\n";
+	if (pShapes)
+		pShapes->WriteShapes(writingFile);
+	//write drawlines
+	for (const Entity& ent : entities)
+		WriteEntity(writingFile, settings, ent, pShapes);
+}
+
+// The cfg goes next to the working directory unless an output folder is given. Other formats only change the extension
+std::string CfgPathFor(const std::string& path, const std::string& outDir, const char* extension = ".cfg")
+{
+	std::string base_filename = path.substr(path.find_last_of("/\\") + 1);
+	std::string::size_type const p(base_filename.find_last_of('.'));
+	std::string file_without_extension = base_filename.substr(0, p);
+	if (outDir.empty())
+		return file_without_extension + extension;
+	return (std::filesystem::path(outDir) / (file_without_extension + extension)).string();
+}
+
+// What -format writes
+enum class OutputFormat
+{
+	Cfg,	// DebugDrawLine calls, to exec in game
+	Ply,	// Binary PLY, a vertex and an edge element, with colors and which entity each line is from
+	Gltf,	// Binary glTF (.glb), a node for each entity with its keyvalues and a line mesh, everything in one buffer
+	Obj,	// Text OBJ, an object for each entity made of l lines, for anything that reads neither of the others
+	Count,
+};
+
+// Everything besides the entities that decides what gets written
+struct EmitOptions
+{
+	FloatStyle floatStyle = FloatStyle::Shortest;	// Text formats only
+	int nDecimals = 0;
+	const ShapeTable* pShapes = nullptr;			// Cfg only, with -instance
+};
+
+// Writes every entity given to out, which is open in binary mode if the format is. Filtering has to have been done already
+typedef void (*Emitter)(std::ostream& out, const Settings& settings, const std::vector<Entity>& entities, const EmitOptions& options);
+
+// Every line being drawn, in flat arrays the mesh formats write out as they are instead of formatting each line.
+// Each entity's corners get an index like FlatMap gives a brush's, but over all its brushes, and stay relative to its origin
+class LineMesh
+{
+public:
+	// An entity and its run of corners and lines
+	struct Part
+	{
+		const Entity* pEnt;
+		int color[3];		// Clamped to what fits in a byte
+		uint32_t iFirstVert;
+		uint32_t nVerts;
+		uint32_t iFirstLine;
+		uint32_t nLines;
+		Vector3 mins;		// Of its corners, relative to its origin
+		Vector3 maxs;
+	};
+
+	// Adds a part for every entity, with lines for the ones whose brushes are drawn
+	void Build(const Settings& settings, const std::vector<Entity>& entities);
+
+	const std::vector<Part>& Parts() const { return m_parts; }
+	const std::vector<Vector3>& Verts() const { return m_verts; }
+
+	// Two for each line, indices into its part's corners
+	const std::vector<uint32_t>& Lines() const { return m_lines; }
+
+private:
+	std::vector<Part> m_parts;
+	std::vector<Vector3> m_verts;
+	std::vector<uint32_t> m_lines;
+};
+
+void LineMesh::Build(const Settings& settings, const std::vector<Entity>& entities)
+{
+	m_parts.clear();
+	m_verts.clear();
+	m_lines.clear();
+	m_parts.reserve(entities.size());
+
+	CornerIndex corners;
+	for (const Entity& ent : entities)
+	{
+		Part& part = m_parts.emplace_back();
+		part.pEnt = &ent;
+		EntityColor(settings, ent, part.color);
+		for (int i = 0; i < 3; i++)
+			part.color[i] = std::clamp(part.color[i], 0, 255);
+		part.iFirstVert = m_verts.size();
+		part.iFirstLine = m_lines.size() / 2;
+
+		if (DrawsBrushes(settings, ent))
+		{
+			size_t nEdges = 0;
+			for (const Brush& brush : ent.brushes)
+				nEdges += brush.edges.size();
+			corners.Reset(m_verts, nEdges * 2);
+			for (const Brush& brush : ent.brushes)
+			{
+				for (const Edge& edge : brush.edges)
+				{
+					m_lines.push_back(corners.IndexOf(edge.stem));
+					m_lines.push_back(corners.IndexOf(edge.tail));
+				}
+			}
+		}
+
+		part.nVerts = m_verts.size() - part.iFirstVert;
+		part.nLines = m_lines.size() / 2 - part.iFirstLine;
+		if (part.nVerts)
+			part.mins = part.maxs = m_verts[part.iFirstVert];
+		for (uint32_t iVert = part.iFirstVert; iVert < part.iFirstVert + part.nVerts; iVert++)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				part.mins[i] = std::min(part.mins[i], m_verts[iVert][i]);
+				part.maxs[i] = std::max(part.maxs[i], m_verts[iVert][i]);
+			}
+		}
+	}
+}
+
+template <typename Output>
+void WriteJsonString(Output& out, std::string_view str)
+{
+	out << '"';
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			out << '\\';
+		out << c;
+	}
+	out << '"';
+}
+
+// What a node or object is called: its targetname, or its classname if it hasn't got one
+std::string_view EntityLabel(const Entity& ent)
+{
+	return ent.targetname.empty() ? ent.classname : ent.targetname;
+}
+
+bool IsLittleEndian()
+{
+	uint16_t one = 1;
+	uint8_t first;
+	memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+void EmitCfg(std::ostream& out, const Settings& settings, const std::vector<Entity>& entities, const EmitOptions& options)
+{
+	CfgWriter writer(&out, options.floatStyle, options.nDecimals);
+	WriteCfg(writer, settings, entities, options.pShapes);
+}
+
+// Vertices in world space with their entity's color, edges with the entity they belong to. The keyvalues of each
+// entity go in a comment, numbered the same way
+void EmitPly(std::ostream& out, const Settings& settings, const std::vector<Entity>& entities, const EmitOptions&)
+{
+	LineMesh mesh;
+	mesh.Build(settings, entities);
+
+	CfgWriter writer(&out);
+	writer << "ply\nformat " << (IsLittleEndian() ? "binary_little_endian" : "binary_big_endian") << " 1.0\ncomment Written by planepoints\n";
+	for (size_t iPart = 0; iPart < mesh.Parts().size(); iPart++)
+	{
+		const Entity& ent = *mesh.Parts()[iPart].pEnt;
+		writer << "comment entity " << (int)iPart;
+		for (int i = 0; i < k_nEntityStrings; i++)
+		{
+			const std::string& value = *EntityStrings(ent, i);
+			if (!value.empty())
+				writer << " " << k_entityStringNames[i] << "=" << value;
+		}
+		writer << "\n";
+	}
+	writer << "element vertex " << (int)mesh.Verts().size() << "\n"
+		<< "property float x\nproperty float y\nproperty float z\nproperty uchar red\nproperty uchar green\nproperty uchar blue\n"
+		<< "element edge " << (int)(mesh.Lines().size() / 2) << "\n"
+		<< "property int vertex1\nproperty int vertex2\nproperty int entity\nend_header\n";
+
+	for (const LineMesh::Part& part : mesh.Parts())
+	{
+		uint8_t color[3] = { (uint8_t)part.color[0], (uint8_t)part.color[1], (uint8_t)part.color[2] };
+		for (uint32_t iVert = part.iFirstVert; iVert < part.iFirstVert + part.nVerts; iVert++)
+		{
+			Vector3 vert = part.pEnt->origin + mesh.Verts()[iVert];
+			writer.Write(&vert, sizeof(vert));
+			writer.Write(color, sizeof(color));
+		}
+	}
+	for (size_t iPart = 0; iPart < mesh.Parts().size(); iPart++)
+	{
+		const LineMesh::Part& part = mesh.Parts()[iPart];
+		for (uint32_t iLine = part.iFirstLine; iLine < part.iFirstLine + part.nLines; iLine++)
+		{
+			int32_t edge[3] = { (int32_t)( part.iFirstVert + mesh.Lines()[iLine * 2] ), (int32_t)( part.iFirstVert + mesh.Lines()[iLine * 2 + 1] ), (int32_t)iPart };
+			writer.Write(edge, sizeof(edge));
+		}
+	}
+}
+
+// The game is Z up and glTF is Y up with -Z forward, so x, y, z in the map is x, z, -y in glTF
+Vector3 GltfFromWorld(const Vector3& v)
+{
+	return { v.x, v.z, -v.y };
+}
+
+// A node for every entity, placed at its origin with its keyvalues and color in extras. Entities with lines get a mesh of
+// them too, all sharing one buffer that's the corners turned Y up and then the line indices exactly as LineMesh has them
+void EmitGltf(std::ostream& out, const Settings& settings, const std::vector<Entity>& entities, const EmitOptions&)
+{
+	LineMesh mesh;
+	mesh.Build(settings, entities);
+	const std::vector<LineMesh::Part>& parts = mesh.Parts();
+	std::vector<Vector3> verts(mesh.Verts().size());
+	for (size_t i = 0; i < verts.size(); i++)
+		verts[i] = GltfFromWorld(mesh.Verts()[i]);
+	uint32_t nVertBytes = verts.size() * sizeof(Vector3);
+	uint32_t nLineBytes = mesh.Lines().size() * sizeof(uint32_t);
+
+	// One unlit material for each color, so lines show up as exactly that color
+	std::unordered_map<uint32_t, int> materialFor;
+	std::vector<int> partMaterials(parts.size());
+	for (size_t iPart = 0; iPart < parts.size(); iPart++)
+	{
+		const LineMesh::Part& part = parts[iPart];
+		uint32_t rgb = part.color[0] << 16 | part.color[1] << 8 | part.color[2];
+		partMaterials[iPart] = materialFor.emplace(rgb, (int)materialFor.size()).first->second;
+	}
+
+	// glTF doesn't allow empty arrays, so anything there's none of is left out
+	CfgWriter json;
+	json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"planepoints\"},\"scene\":0,\"scenes\":[{";
+	if (!parts.empty())
+	{
+		json << "\"nodes\":[";
+		for (size_t iPart = 0; iPart < parts.size(); iPart++)
+			json << (iPart ? "," : "") << (int)iPart;
+		json << "]";
+	}
+	json << "}]";
+
+	if (!parts.empty())
+	{
+		json << ",\"nodes\":[";
+		int iMesh = 0;
+		for (size_t iPart = 0; iPart < parts.size(); iPart++)
+		{
+			const LineMesh::Part& part = parts[iPart];
+			const Entity& ent = *part.pEnt;
+			json << (iPart ? "," : "") << "{\"name\":";
+			WriteJsonString(json, EntityLabel(ent));
+			Vector3 translation = GltfFromWorld(ent.origin);
+			json << ",\"translation\":[" << translation.x << "," << translation.y << "," << translation.z << "]";
+			if (part.nLines)
+				json << ",\"mesh\":" << iMesh++;
+			json << ",\"extras\":{\"is_trigger\":" << (ent.isTrigger ? "true" : "false")
+				<< ",\"color\":[" << part.color[0] << "," << part.color[1] << "," << part.color[2] << "]";
+			for (int i = 0; i < k_nEntityStrings; i++)
+			{
+				const std::string& value = *EntityStrings(ent, i);
+				if (value.empty())
+					continue;
+				json << ",\"" << k_entityStringNames[i] << "\":";
+				WriteJsonString(json, value);
+			}
+			json << "}}";
+		}
+		json << "]";
+	}
+
+	if (!mesh.Lines().empty())
+	{
+		// Each mesh has a position accessor then an index accessor
+		json << ",\"meshes\":[";
+		int iMesh = 0;
+		for (size_t iPart = 0; iPart < parts.size(); iPart++)
+		{
+			if (!parts[iPart].nLines)
+				continue;
+			json << (iMesh ? "," : "") << "{\"primitives\":[{\"attributes\":{\"POSITION\":" << iMesh * 2 << "},\"indices\":" << iMesh * 2 + 1
+				<< ",\"mode\":1,\"material\":" << partMaterials[iPart] << "}]}";
+			iMesh++;
+		}
+		json << "],\"materials\":[";
+		std::vector<uint32_t> colors(materialFor.size());
+		for (const auto& [rgb, iMaterial] : materialFor)
+			colors[iMaterial] = rgb;
+		for (size_t iMaterial = 0; iMaterial < colors.size(); iMaterial++)
+		{
+			json << (iMaterial ? "," : "") << "{\"pbrMetallicRoughness\":{\"baseColorFactor\":["
+				<< ( colors[iMaterial] >> 16 ) / 255.0f << "," << ( ( colors[iMaterial] >> 8 ) & 0xFF ) / 255.0f << "," << ( colors[iMaterial] & 0xFF ) / 255.0f
+				<< ",1],\"metallicFactor\":0},\"extensions\":{\"KHR_materials_unlit\":{}}}";
+		}
+		json << "],\"extensionsUsed\":[\"KHR_materials_unlit\"],\"accessors\":[";
+		bool first = true;
+		for (const LineMesh::Part& part : parts)
+		{
+			if (!part.nLines)
+				continue;
+			// Y up flips the map's Y over, so its max becomes the min
+			Vector3 mins = { part.mins.x, part.mins.z, -part.maxs.y };
+			Vector3 maxs = { part.maxs.x, part.maxs.z, -part.mins.y };
+			json << (first ? "" : ",") << "{\"bufferView\":0,\"byteOffset\":" << (int)( part.iFirstVert * sizeof(Vector3) )
+				<< ",\"componentType\":5126,\"count\":" << (int)part.nVerts << ",\"type\":\"VEC3\""
+				<< ",\"min\":[" << mins.x << "," << mins.y << "," << mins.z << "]"
+				<< ",\"max\":[" << maxs.x << "," << maxs.y << "," << maxs.z << "]}"
+				<< ",{\"bufferView\":1,\"byteOffset\":" << (int)( part.iFirstLine * 2 * sizeof(uint32_t) )
+				<< ",\"componentType\":5125,\"count\":" << (int)( part.nLines * 2 ) << ",\"type\":\"SCALAR\"}";
+			first = false;
+		}
+		json << "],\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << (int)nVertBytes << ",\"target\":34962},"
+			<< "{\"buffer\":0,\"byteOffset\":" << (int)nVertBytes << ",\"byteLength\":" << (int)nLineBytes << ",\"target\":34963}],"
+			<< "\"buffers\":[{\"byteLength\":" << (int)( nVertBytes + nLineBytes ) << "}]";
+	}
+	json << "}";
+
+	// Chunks have to be a multiple of 4 bytes. The binary one already is, it's all floats and ints.
+	// Everything in a .glb is little endian, same as every machine this builds for
+	std::string text = json.TakeText();
+	text.resize((text.size() + 3) / 4 * 4, ' ');
+	uint32_t nBinBytes = mesh.Lines().empty() ? 0 : nVertBytes + nLineBytes;
+	uint32_t header[3] = { 0x46546C67, 2, (uint32_t)( 12 + 8 + text.size() + ( nBinBytes ? 8 + nBinBytes : 0 ) ) };	// "glTF", version 2
+	uint32_t jsonChunk[2] = { (uint32_t)text.size(), 0x4E4F534A };	// "JSON"
+	out.write((const char*)header, sizeof(header));
+	out.write((const char*)jsonChunk, sizeof(jsonChunk));
+	out.write(text.data(), text.size());
+	if (nBinBytes)
+	{
+		uint32_t binChunk[2] = { nBinBytes, 0x004E4942 };	// "BIN"
+		out.write((const char*)binChunk, sizeof(binChunk));
+		out.write((const char*)verts.data(), nVertBytes);
+		out.write((const char*)mesh.Lines().data(), nLineBytes);
+	}
+}
+
+// World space corners with their entity's color after them, which most things that read OBJ understand, and keyvalues in
+// comments. Objects are named like glTF nodes, with any spaces made underscores
+void EmitObj(std::ostream& out, const Settings& settings, const std::vector<Entity>& entities, const EmitOptions& options)
+{
+	LineMesh mesh;
+	mesh.Build(settings, entities);
+
+	CfgWriter writer(&out, options.floatStyle, options.nDecimals);
+	writer << "# Written by planepoints\n";
+	int iBase = 1;
+	for (const LineMesh::Part& part : mesh.Parts())
+	{
+		if (!part.nLines)
+			continue;
+		const Entity& ent = *part.pEnt;
+		std::string name(EntityLabel(ent));
+		std::replace_if(name.begin(), name.end(), [](char c) { return isspace((unsigned char)c); }, '_');
+		writer << "o " << (name.empty() ? "entity" : name) << "\n";
+		for (int i = 0; i < k_nEntityStrings; i++)
+		{
+			const std::string& value = *EntityStrings(ent, i);
+			if (!value.empty())
+				writer << "# " << k_entityStringNames[i] << " " << value << "\n";
+		}
+
+		float color[3] = { part.color[0] / 255.0f, part.color[1] / 255.0f, part.color[2] / 255.0f };
+		for (uint32_t iVert = part.iFirstVert; iVert < part.iFirstVert + part.nVerts; iVert++)
+		{
+			Vector3 vert = ent.origin + mesh.Verts()[iVert];
+			writer << "v " << vert.x << " " << vert.y << " " << vert.z << " " << color[0] << " " << color[1] << " " << color[2] << "\n";
+		}
+		for (uint32_t iLine = part.iFirstLine; iLine < part.iFirstLine + part.nLines; iLine++)
+			writer << "l " << iBase + (int)mesh.Lines()[iLine * 2] << " " << iBase + (int)mesh.Lines()[iLine * 2 + 1] << "\n";
+		iBase += part.nVerts;
+	}
+}
+
+struct OutputFormatInfo
+{
+	const char* name;		// For -format
+	const char* extension;
+	bool binary;			// Opened in binary mode so no \n turns into \r\n
+	Emitter emit;
+};
+
+// Indexed by OutputFormat. Adding a format is an emitter and a line here
+constexpr OutputFormatInfo k_outputFormats[(int)OutputFormat::Count] =
+{
+	{ "cfg", ".cfg", false, EmitCfg },
+	{ "ply", ".ply", true, EmitPly },
+	{ "gltf", ".glb", true, EmitGltf },
+	{ "obj", ".obj", false, EmitObj },
+};
+
+const OutputFormatInfo& GetOutputFormat(OutputFormat format)
+{
+	return k_outputFormats[(int)format];
+}
+
+
+// Bump whenever a change to BrushBuilder changes the edges it makes, so old caches get thrown out
+constexpr uint32_t k_nBuilderVersion = 5;
+
+// Edges of brushes built on earlier runs, so rerunning a map with different settings doesn't rebuild it.
+// Brushes are looked up by a hash of their planes exactly as parsed, and the planes are kept too so a hit is only
+// trusted if they're the same, so any change to a brush just misses.
+// The file is a header then one record per brush: key, plane count, edge count, the planes, then the edges, all as
+// raw floats and ints (native byte order)
+class GeometryCache
+{
+public:
+	// Everything the edges depend on besides the planes: builder version, kernel and build method
+	static uint32_t ConfigFor( const BrushBuilder& bb );
+
+	static uint64_t KeyFor( const Brush& brush ) { return KeyFor( brush.planes.data(), brush.planes.size() ); }
+	static uint64_t KeyFor( const Plane* pPlanes, size_t nPlanes );
+
+	// Whether two brushes have the same planes, bit for bit, as far as KeyFor can tell them apart
+	static bool SamePlanes( const Plane* pPlanesA, size_t nPlanesA, const Plane* pPlanesB, size_t nPlanesB );
+
+	// Returns false if there was no cache, or it was made by a different builder. Either way the cache is usable, just empty
+	bool Load( const std::string& path, uint32_t config );
+
+	// Fills in the brush's edges if they're cached under key for the same planes. Thread safe against other Finds.
+	// Only finds what Load read in
+	bool Find( uint64_t key, Brush& brush ) const;
+
+	// Thread safe. Does nothing if key is already cached, even for other planes, so a brush that collides just gets
+	// built every time
+	void Store( uint64_t key, const Brush& brush );
+
+	// Whether Save would write anything different from what was loaded
+	bool HasChanges( const std::unordered_set<uint64_t>& live ) const;
+
+	// Writes out everything stored, plus whatever was loaded that's still in live.
+	// Brushes that have since been edited or deleted are dropped, so the file doesn't grow forever
+	bool Save( const std::string& path, const std::unordered_set<uint64_t>& live ) const;
+
+private:
+	// A plane the way it's hashed, and written to the file
+	struct PlaneBits
+	{
+		float values[4];
+		uint32_t skip;
+	};
+	static_assert( sizeof( PlaneBits ) == 5 * 4, "PlaneBits has padding" );
+
+	struct Record
+	{
+		uint32_t iFirstPlane;
+		uint32_t nPlanes;
+		uint32_t iFirstEdge;
+		uint32_t nEdges;
+	};
+
+	struct Added
+	{
+		uint64_t key;
+		std::vector<PlaneBits> planes;
+		std::vector<Edge> edges;
+	};
+
+	static PlaneBits BitsOf( const Plane& plane );
+
+	uint32_t m_config = 0;
+	std::unordered_map<uint64_t, Record> m_records;
+	std::vector<PlaneBits> m_planes;
+	std::vector<Edge> m_edges;
+
+	std::mutex m_addedMutex;
+	std::unordered_set<uint64_t> m_addedKeys;
+	std::vector<Added> m_added;
+};
+
+// Was PPGC before records kept their planes
+constexpr char k_szCacheMagic[4] = { 'P', 'P', 'G', '2' };
+
+// Edges and planes go in and out of the file as raw floats
+static_assert( sizeof( Edge ) == 6 * sizeof( float ), "Edge has padding" );
+
+uint32_t GeometryCache::ConfigFor( const BrushBuilder& bb )
+{
+	return ( k_nBuilderVersion << 16 ) | ( (uint32_t)bb.GetKernel() << 8 ) | (uint32_t)bb.GetMethod();
+}
+
+uint64_t GeometryCache::KeyFor( const Plane* pPlanes, size_t nPlanes )
+{
+	// FNV-1a over the plane count and every plane's bits
+	uint64_t h = 0xCBF29CE484222325ull;
+	auto add = [&h]( const void* data, size_t size )
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for ( size_t i = 0; i < size; i++ )
+		{
+			h ^= bytes[i];
+			h *= 0x100000001B3ull;
+		}
+	};
+
+	uint32_t nPlanesKey = nPlanes;
+	add( &nPlanesKey, sizeof( nPlanesKey ) );
+	for ( size_t i = 0; i < nPlanes; i++ )
+	{
+		const Plane& plane = pPlanes[i];
+		float values[4] = { plane.normal.x, plane.normal.y, plane.normal.z, plane.dist };
+		add( values, sizeof( values ) );
+		add( &plane.skip, sizeof( plane.skip ) );
+	}
+	return h;
+}
+
+GeometryCache::PlaneBits GeometryCache::BitsOf( const Plane& plane )
+{
+	return { { plane.normal.x, plane.normal.y, plane.normal.z, plane.dist }, plane.skip };
+}
+
+bool GeometryCache::SamePlanes( const Plane* pPlanesA, size_t nPlanesA, const Plane* pPlanesB, size_t nPlanesB )
+{
+	if ( nPlanesA != nPlanesB )
+		return false;
+	for ( size_t i = 0; i < nPlanesA; i++ )
+	{
+		// Compared as bits like KeyFor hashes them, so -0 and 0 differ
+		PlaneBits a = BitsOf( pPlanesA[i] ), b = BitsOf( pPlanesB[i] );
+		if ( memcmp( &a, &b, sizeof( a ) ) != 0 )
+			return false;
+	}
+	return true;
+}
+
+bool GeometryCache::Load( const std::string& path, uint32_t config )
+{
+	m_config = config;
+	m_records.clear();
+	m_planes.clear();
+	m_edges.clear();
+
+	MappedFile file;
+	if ( !file.Open( path ) )
+		return false;
+
+	std::string_view data = file.View();
+	auto read = [&data]( void* out, size_t size )
+	{
+		if ( data.size() < size )
+			return false;
+		memcpy( out, data.data(), size );
+		data.remove_prefix( size );
+		return true;
+	};
+
+	char magic[4];
+	uint32_t fileConfig;
+	uint32_t nRecords;
+	if ( !read( magic, sizeof( magic ) ) || memcmp( magic, k_szCacheMagic, sizeof( magic ) ) != 0 )
+		return false;
+	if ( !read( &fileConfig, sizeof( fileConfig ) ) || fileConfig != config || !read( &nRecords, sizeof( nRecords ) ) )
+		return false;
+
+	for ( uint32_t i = 0; i < nRecords; i++ )
+	{
+		uint64_t key;
+		uint32_t nPlanes, nEdges;
+		if ( !read( &key, sizeof( key ) ) || !read( &nPlanes, sizeof( nPlanes ) ) || !read( &nEdges, sizeof( nEdges ) )
+			|| data.size() < (size_t)nPlanes * sizeof( PlaneBits ) + (size_t)nEdges * sizeof( Edge ) )
+		{
+			// Cut off partway, keep nothing rather than trust it
+			m_records.clear();
+			m_planes.clear();
+			m_edges.clear();
+			return false;
+		}
+
+		size_t iFirstPlane = m_planes.size();
+		size_t iFirstEdge = m_edges.size();
+		m_planes.resize( iFirstPlane + nPlanes );
+		m_edges.resize( iFirstEdge + nEdges );
+		read( m_planes.data() + iFirstPlane, nPlanes * sizeof( PlaneBits ) );
+		read( m_edges.data() + iFirstEdge, nEdges * sizeof( Edge ) );
+
+		// Only the first of any repeated key counts, it's what Save would have kept
+		if ( !m_records.emplace( key, Record{ (uint32_t)iFirstPlane, nPlanes, (uint32_t)iFirstEdge, nEdges } ).second )
+		{
+			m_planes.resize( iFirstPlane );
+			m_edges.resize( iFirstEdge );
+		}
+	}
+	return true;
+}
+
+bool GeometryCache::Find( uint64_t key, Brush& brush ) const
+{
+	auto it = m_records.find( key );
+	if ( it == m_records.end() )
+		return false;
+
+	// A different brush that happens to hash the same doesn't get its edges
+	const Record& record = it->second;
+	if ( record.nPlanes != brush.planes.size() )
+		return false;
+	for ( uint32_t i = 0; i < record.nPlanes; i++ )
+	{
+		PlaneBits bits = BitsOf( brush.planes[i] );
+		if ( memcmp( &bits, &m_planes[record.iFirstPlane + i], sizeof( bits ) ) != 0 )
+			return false;
+	}
+
+	brush.edges.assign( m_edges.begin() + record.iFirstEdge, m_edges.begin() + record.iFirstEdge + record.nEdges );
+	return true;
+}
+
+void GeometryCache::Store( uint64_t key, const Brush& brush )
+{
+	if ( m_records.count( key ) )
+		return;
+
+	std::lock_guard<std::mutex> lock( m_addedMutex );
+	if ( !m_addedKeys.insert( key ).second )
+		return;
+	Added added = { key, {}, brush.edges };
+	added.planes.reserve( brush.planes.size() );
+	for ( const Plane& plane : brush.planes )
+		added.planes.push_back( BitsOf( plane ) );
+	m_added.push_back( std::move( added ) );
+}
+
+bool GeometryCache::HasChanges( const std::unordered_set<uint64_t>& live ) const
+{
+	if ( !m_added.empty() )
+		return true;
+	for ( const auto& [key, record] : m_records )
+	{
+		if ( !live.count( key ) )
+			return true;
+	}
+	return false;
+}
+
+bool GeometryCache::Save( const std::string& path, const std::unordered_set<uint64_t>& live ) const
+{
+	// Write next to it and swap it in, so a run that dies halfway doesn't leave a broken cache
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file( tempPath, std::ios::binary );
+		if ( !file.is_open() )
+			return false;
+
+		uint32_t nRecords = m_added.size();
+		for ( const auto& [key, record] : m_records )
+			nRecords += live.count( key );
+		file.write( k_szCacheMagic, sizeof( k_szCacheMagic ) );
+		file.write( (const char*)&m_config, sizeof( m_config ) );
+		file.write( (const char*)&nRecords, sizeof( nRecords ) );
+
+		auto write = [&file]( uint64_t key, const PlaneBits* planes, uint32_t nPlanes, const Edge* edges, uint32_t nEdges )
+		{
+			file.write( (const char*)&key, sizeof( key ) );
+			file.write( (const char*)&nPlanes, sizeof( nPlanes ) );
+			file.write( (const char*)&nEdges, sizeof( nEdges ) );
+			file.write( (const char*)planes, nPlanes * sizeof( PlaneBits ) );
+			file.write( (const char*)edges, nEdges * sizeof( Edge ) );
+		};
+		for ( const auto& [key, record] : m_records )
+		{
+			if ( live.count( key ) )
+				write( key, m_planes.data() + record.iFirstPlane, record.nPlanes, m_edges.data() + record.iFirstEdge, record.nEdges );
+		}
+		for ( const Added& added : m_added )
+			write( added.key, added.planes.data(), added.planes.size(), added.edges.data(), added.edges.size() );
+
+		if ( !file )
+			return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename( tempPath, path, ec );
+	return !ec;
+}
+
+// .ppbin: a whole map, parsed and built, laid out so loading it is a matter of mapping it and copying arrays out.
+// All sections are arrays of 4 byte values, so everything stays aligned within the mapping.
+//   header, string offsets (nStrings + 1), string bytes (padded to 4), entities, brushes, planes, edges
+// Strings are interned, index 0 is always the empty string.
+// Edges are only trusted if builderConfig matches the current builder, otherwise the planes get built again
+constexpr char k_szBinaryMagic[4] = { 'P', 'P', 'B', 'N' };
+constexpr uint32_t k_nBinaryVersion = 1;
+constexpr uint32_t k_nBinaryByteOrder = 0x01020304;
+
+struct BinaryHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t builderConfig;
+	uint32_t nStrings;
+	uint32_t nStringBytes;
+	uint32_t nEntities;
+	uint32_t nBrushes;
+	uint32_t nPlanes;
+	uint32_t nEdges;
+};
+
+struct BinaryEntity
+{
+	uint32_t strings[k_nEntityStrings];
+	Vector3 origin;
+	Vector3 mins;
+	Vector3 maxs;
+	uint32_t isTrigger;
+	uint32_t iFirstBrush;
+	uint32_t nBrushes;
+};
+
+struct BinaryBrush
+{
+	uint32_t iFirstPlane;
+	uint32_t nPlanes;
+	uint32_t iFirstEdge;
+	uint32_t nEdges;
+};
+
+struct BinaryPlane
+{
+	Vector3 normal;
+	float dist;
+	uint32_t flags;
+};
+
+constexpr uint32_t k_nBinaryPlaneSkip = 1;
+constexpr uint32_t k_nBinaryPlaneBBox = 2;
+
+static_assert( sizeof( Vector3 ) == 3 * sizeof( float ), "Vector3 has padding" );
+static_assert( sizeof( BinaryEntity ) % 4 == 0 && sizeof( BinaryPlane ) == 20, "binary map structs have padding" );
+
+bool IsBinaryMap( const std::string& path )
+{
+	return std::filesystem::path( path ).extension() == ".ppbin";
+}
+
+// Writes entities, with their brushes already built, as a .ppbin
+bool WriteBinaryMap( const std::string& path, std::vector<Entity>& entities, uint32_t builderConfig )
+{
+	BinaryHeader header = {};
+	memcpy( header.magic, k_szBinaryMagic, sizeof( header.magic ) );
+	header.version = k_nBinaryVersion;
+	header.byteOrder = k_nBinaryByteOrder;
+	header.builderConfig = builderConfig;
+
+	std::unordered_map<std::string, uint32_t> stringIndices;
+	std::vector<uint32_t> stringOffsets = { 0 };
+	std::string stringBytes;
+	auto intern = [&]( const std::string& str )
+	{
+		auto [it, added] = stringIndices.emplace( str, (uint32_t)stringOffsets.size() - 1 );
+		if ( added )
+		{
+			stringBytes += str;
+			stringOffsets.push_back( stringBytes.size() );
+		}
+		return it->second;
+	};
+	intern( "" );
+
+	std::vector<BinaryEntity> binEntities;
+	std::vector<BinaryBrush> binBrushes;
+	std::vector<BinaryPlane> binPlanes;
+	std::vector<Edge> binEdges;
+	for ( Entity& ent : entities )
+	{
+		BinaryEntity binEnt;
+		for ( int i = 0; i < k_nEntityStrings; i++ )
+			binEnt.strings[i] = intern( *EntityStrings( ent, i ) );
+		binEnt.origin = ent.origin;
+		binEnt.mins = ent.mins;
+		binEnt.maxs = ent.maxs;
+		binEnt.isTrigger = ent.isTrigger;
+		binEnt.iFirstBrush = binBrushes.size();
+		binEnt.nBrushes = ent.brushes.size();
+		binEntities.push_back( binEnt );
+
+		for ( const Brush& brush : ent.brushes )
+		{
+			binBrushes.push_back( { (uint32_t)binPlanes.size(), (uint32_t)brush.planes.size(), (uint32_t)binEdges.size(), (uint32_t)brush.edges.size() } );
+			for ( const Plane& plane : brush.planes )
+				binPlanes.push_back( { plane.normal, plane.dist, ( plane.skip ? k_nBinaryPlaneSkip : 0 ) | ( plane.bbox ? k_nBinaryPlaneBBox : 0 ) } );
+			binEdges.insert( binEdges.end(), brush.edges.begin(), brush.edges.end() );
+		}
+	}
+
+	header.nStrings = stringOffsets.size() - 1;
+	header.nStringBytes = stringBytes.size();
+	header.nEntities = binEntities.size();
+	header.nBrushes = binBrushes.size();
+	header.nPlanes = binPlanes.size();
+	header.nEdges = binEdges.size();
+
+	std::ofstream file( path, std::ios::binary );
+	if ( !file.is_open() )
+		return false;
+
+	auto write = [&file]( const void* data, size_t size ) { file.write( (const char*)data, size ); };
+	write( &header, sizeof( header ) );
+	write( stringOffsets.data(), stringOffsets.size() * sizeof( uint32_t ) );
+	stringBytes.resize( ( stringBytes.size() + 3 ) & ~3 );
+	write( stringBytes.data(), stringBytes.size() );
+	write( binEntities.data(), binEntities.size() * sizeof( BinaryEntity ) );
+	write( binBrushes.data(), binBrushes.size() * sizeof( BinaryBrush ) );
+	write( binPlanes.data(), binPlanes.size() * sizeof( BinaryPlane ) );
+	write( binEdges.data(), binEdges.size() * sizeof( Edge ) );
+	file.close();
+	return !file.fail();
+}
+
+// Loads a .ppbin that's been mapped into memory. Throws std::runtime_error if it's broken or from another version.
+// Returns true if the edges came from the current builder and can be used as they are
+bool LoadBinaryMap( std::string_view data, std::vector<Entity>& entities, uint32_t builderConfig )
+{
+	if ( data.size() < sizeof( BinaryHeader ) )
+		throw std::runtime_error( "too small to be a .ppbin" );
+
+	const BinaryHeader& header = *(const BinaryHeader*)data.data();
+	if ( memcmp( header.magic, k_szBinaryMagic, sizeof( header.magic ) ) != 0 )
+		throw std::runtime_error( "not a .ppbin" );
+	if ( header.version != k_nBinaryVersion || header.byteOrder != k_nBinaryByteOrder )
+		throw std::runtime_error( "made by a different version, convert it again" );
+
+	// Find every section, making sure it's all actually there. Counts are done in size_t, the header's could be
+	// anything and wrap around in 32 bits
+	if ( header.nStrings == UINT32_MAX )
+		throw std::runtime_error( "bad string table" );
+	size_t offset = sizeof( BinaryHeader );
+	auto section = [&]( size_t count, size_t size )
+	{
+		if ( count > ( data.size() - offset ) / size )
+			throw std::runtime_error( "file is cut short" );
+		const char* p = data.data() + offset;
+		offset += count * size;
+		return p;
+	};
+	const uint32_t* stringOffsets = (const uint32_t*)section( (size_t)header.nStrings + 1, sizeof( uint32_t ) );
+	const char* stringBytes = section( ( (size_t)header.nStringBytes + 3 ) & ~(size_t)3, 1 );
+	const BinaryEntity* binEntities = (const BinaryEntity*)section( header.nEntities, sizeof( BinaryEntity ) );
+	const BinaryBrush* binBrushes = (const BinaryBrush*)section( header.nBrushes, sizeof( BinaryBrush ) );
+	const BinaryPlane* binPlanes = (const BinaryPlane*)section( header.nPlanes, sizeof( BinaryPlane ) );
+	const Edge* binEdges = (const Edge*)section( header.nEdges, sizeof( Edge ) );
+
+	// Indices only get checked once each, everything below can trust them
+	if ( stringOffsets[header.nStrings] != header.nStringBytes )
+		throw std::runtime_error( "bad string table" );
+	for ( uint32_t i = 0; i < header.nStrings; i++ )
+	{
+		if ( stringOffsets[i] > stringOffsets[i + 1] )
+			throw std::runtime_error( "bad string table" );
+	}
+	for ( uint32_t i = 0; i < header.nBrushes; i++ )
+	{
+		const BinaryBrush& brush = binBrushes[i];
+		if ( brush.iFirstPlane > header.nPlanes || brush.nPlanes > header.nPlanes - brush.iFirstPlane
+			|| brush.iFirstEdge > header.nEdges || brush.nEdges > header.nEdges - brush.iFirstEdge )
+			throw std::runtime_error( "bad brush" );
+	}
+
+	bool edgesValid = header.builderConfig == builderConfig;
+	entities.resize( header.nEntities );
+	for ( uint32_t iEnt = 0; iEnt < header.nEntities; iEnt++ )
+	{
+		const BinaryEntity& binEnt = binEntities[iEnt];
+		if ( binEnt.iFirstBrush > header.nBrushes || binEnt.nBrushes > header.nBrushes - binEnt.iFirstBrush )
+			throw std::runtime_error( "bad entity" );
+
+		Entity& ent = entities[iEnt];
+		for ( int i = 0; i < k_nEntityStrings; i++ )
+		{
+			uint32_t iString = binEnt.strings[i];
+			if ( iString >= header.nStrings )
+				throw std::runtime_error( "bad string index" );
+			EntityStrings( ent, i )->assign( stringBytes + stringOffsets[iString], stringOffsets[iString + 1] - stringOffsets[iString] );
+		}
+		ent.origin = binEnt.origin;
+		ent.mins = binEnt.mins;
+		ent.maxs = binEnt.maxs;
+		ent.isTrigger = binEnt.isTrigger != 0;
+
+		ent.brushes.resize( binEnt.nBrushes );
+		for ( uint32_t iBrush = 0; iBrush < binEnt.nBrushes; iBrush++ )
+		{
+			const BinaryBrush& binBrush = binBrushes[binEnt.iFirstBrush + iBrush];
+			Brush& brush = ent.brushes[iBrush];
+			brush.planes.resize( binBrush.nPlanes );
+			for ( uint32_t iPlane = 0; iPlane < binBrush.nPlanes; iPlane++ )
+			{
+				const BinaryPlane& binPlane = binPlanes[binBrush.iFirstPlane + iPlane];
+				Plane& plane = brush.planes[iPlane];
+				plane.normal = binPlane.normal;
+				plane.dist = binPlane.dist;
+				plane.skip = ( binPlane.flags & k_nBinaryPlaneSkip ) != 0;
+				plane.bbox = ( binPlane.flags & k_nBinaryPlaneBBox ) != 0;
+			}
+			brush.shape = ClassifyBrush( brush.planes.data(), brush.planes.size() );
+			if ( edgesValid )
+				brush.edges.assign( binEdges + binBrush.iFirstEdge, binEdges + binBrush.iFirstEdge + binBrush.nEdges );
+		}
+	}
+	return edgesValid;
+}
+
+// Where the geometry cache for an input file lives: next to it, or in cacheDir if there is one
+std::string CachePathFor(const std::string& path, const std::string& cacheDir)
+{
+	if (cacheDir.empty())
+		return path + ".ppcache";
+	return (std::filesystem::path(cacheDir) / (std::filesystem::path(path).filename().string() + ".ppcache")).string();
+}
+
+// How ProcessFile goes about its work, mostly from the command line
+struct ProcessOptions
+{
+	int nBuildThreads = 0;		// 0 for one per core
+	bool stream = false;
+	bool useCache = true;
+	bool clearCache = false;	// Throw away any existing cache and start a new one
+	std::string cacheDir;		// Empty puts each cache next to its input
+	FloatStyle floatStyle = FloatStyle::Shortest;
+	int nDecimals = 0;			// For FloatStyle::Fixed
+	bool instance = false;		// Write repeated brush shapes once, see ShapeTable. Not for streaming
+	bool merge = false;			// Draw each entity's brushes as one outline, see EdgeMerger
+	OutputFormat format = OutputFormat::Cfg;	// Anything but cfg can't be streamed or instanced
+};
+
+struct FileResult
+{
+	std::string path;
+	std::string cfgPath;
+	bool ok = false;
+	std::string error;
+	size_t nEntities = 0;
+	double flSeconds = 0;
+
+	// How much was actually drawn. Brushes of entities that aren't drawn, or whose outlines aren't, never get built
+	size_t nEntitiesDrawn = 0;
+	size_t nBrushes = 0;
+	size_t nBrushesBuilt = 0;
+	size_t nBrushesCached = 0;
+
+	// With -instance, how many distinct shapes were written and how many brushes were drawn with them
+	size_t nShapes = 0;
+	size_t nPlacements = 0;
+	size_t nLinesBefore = 0;
+	size_t nLinesAfter = 0;
+
+	// Where the time went, for -stats. When streaming, the stages overlap and filter, build and emit are added up over every worker
+	double flParseSeconds = 0;
+	double flFilterSeconds = 0;
+	double flBuildSeconds = 0;
+	double flEmitSeconds = 0;
+	double flCacheSeconds = 0;
+	double flMergeSeconds = 0;
+	BuildStats build;
+	MergeStats merge;
+};
+
+// Adds the seconds since last onto stage, then moves last up to now
+inline void LapTime(std::chrono::steady_clock::time_point& last, double& stage)
+{
+	auto now = std::chrono::steady_clock::now();
+	stage += std::chrono::duration<double>(now - last).count();
+	last = now;
+}
+
+// How many entities can be between the parser and the writer at once when streaming
+constexpr size_t k_nStreamDepth = 256;
+
+// An entity on its way through the streaming pipeline, and where its text goes once it's built
+struct StreamJob
+{
+	Entity ent;
+	std::promise<std::string> text;
+};
+
+// Same as ProcessFile's parse, build, write, but as a pipeline: each entity is filtered, built and formatted as soon as
+// it's parsed, by nWorkers threads, while this thread keeps parsing and another writes finished entities out in order.
+// Only k_nStreamDepth entities are ever held at once, however big the file is
+bool StreamFile(const MappedFile& ReadFile, std::ofstream& writingFile, const Settings& settings, BrushBuilder& bb, const ProcessOptions& options,
+	GeometryCache* pCache, std::unordered_set<uint64_t>& live, FileResult& result)
+{
+	int nWorkers = options.nBuildThreads;
+	if (nWorkers <= 0)
+		nWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+	// The writer waits on each entity's text in file order, which also caps how far ahead the parser can get
+	BoundedQueue<StreamJob> jobs(k_nStreamDepth);
+	BoundedQueue<std::future<std::string>> pending(k_nStreamDepth);
+
+	std::atomic<size_t> nEntitiesDrawn = 0;
+	std::atomic<size_t> nBrushesBuilt = 0;
+	std::atomic<size_t> nBrushesCached = 0;
+
+	// Each worker keeps its own times and counts, they're added up once everyone's done
+	std::vector<FileResult> workerTimes(nWorkers);
+	auto worker = [&](BrushBuilder& builder, FileResult& times)
+	{
+		CfgWriter out(nullptr, options.floatStyle, options.nDecimals);
+		EdgeMerger merger;
+		StreamJob job;
+		while (jobs.Pop(job))
+		{
+			std::string text;
+			auto last = std::chrono::steady_clock::now();
+			bool passes = PassesFilters(settings, job.ent);
+			LapTime(last, times.flFilterSeconds);
+			if (passes)
+			{
+				nEntitiesDrawn++;
+				if (DrawsBrushes(settings, job.ent))
+				{
+					for (Brush& brush : job.ent.brushes)
+					{
+						uint64_t key = pCache ? GeometryCache::KeyFor(brush) : 0;
+						if (pCache && pCache->Find(key, brush))
+						{
+							nBrushesCached++;
+							continue;
+						}
+
+						builder.Build(brush);
+						nBrushesBuilt++;
+						if (pCache)
+							pCache->Store(key, brush);
+					}
+					LapTime(last, times.flBuildSeconds);
+					if (options.merge)
+					{
+						merger.Merge(job.ent);
+						LapTime(last, times.flMergeSeconds);
+					}
+				}
+
+				WriteEntity(out, settings, job.ent);
+				text = out.TakeText();
+				LapTime(last, times.flEmitSeconds);
+			}
+			job.text.set_value(std::move(text));
+		}
+		times.merge = merger.GetStats();
+	};
+
+	std::thread writer([&]()
+	{
+		CfgWriter out(&writingFile);
+		out << "sv_cheats 1;enable_debug_overlays 1;\n";
+		std::future<std::string> text;
+		while (pending.Pop(text))
+			out << text.get();
+	});
+
+	std::vector<std::thread> workers;
+	workers.emplace_back(worker, std::ref(bb), std::ref(workerTimes[0]));
+	for (int i = 1; i < nWorkers; i++)
+	{
+		workers.emplace_back([&worker, &workerTimes, &bb, i]()
+		{
+			BrushBuilder threadBuilder;
+			threadBuilder.SetKernel(bb.GetKernel());
+			threadBuilder.SetMethod(bb.GetMethod());
+			threadBuilder.SetTiming(bb.GetTiming());
+			worker(threadBuilder, workerTimes[i]);
+			workerTimes[i].build = threadBuilder.GetStats();
+		});
+	}
+
+	bool ok = true;
+	auto parseStart = std::chrono::steady_clock::now();
+	try
+	{
+		ParseBufferEach(ReadFile.View(), [&](Entity&& ent)
+		{
+			StreamJob job;
+			job.ent = std::move(ent);
+			result.nEntities++;
+			result.nBrushes += job.ent.brushes.size();
+			if (pCache)
+			{
+				for (const Brush& brush : job.ent.brushes)
+					live.insert(GeometryCache::KeyFor(brush));
+			}
+			pending.Push(job.text.get_future());
+			jobs.Push(std::move(job));
+		});
+	}
+	catch (const std::exception& e)
+	{
+		result.error = std::string("parse error (") + e.what() + ")";
+		ok = false;
+	}
+
+	LapTime(parseStart, result.flParseSeconds);
+
+	// Let everything already parsed drain through, even after an error, so nobody is left waiting on a promise
+	jobs.Close();
+	for (std::thread& thread : workers)
+		thread.join();
+	pending.Close();
+	writer.join();
+	for (int i = 0; i < nWorkers; i++)
+	{
+		result.flFilterSeconds += workerTimes[i].flFilterSeconds;
+		result.flBuildSeconds += workerTimes[i].flBuildSeconds;
+		result.flEmitSeconds += workerTimes[i].flEmitSeconds;
+		result.flMergeSeconds += workerTimes[i].flMergeSeconds;
+		result.merge.Add(workerTimes[i].merge);
+		bb.AddStats(workerTimes[i].build);
+	}
+	result.nEntitiesDrawn = nEntitiesDrawn;
+	result.nBrushesBuilt = nBrushesBuilt;
+	result.nBrushesCached = nBrushesCached;
+	return ok;
+}
+
+// Parses, builds and writes one entity file. Everything it touches besides the settings is owned by the caller,
+// so any number of these can run at once as long as each thread brings its own BrushBuilder.
+// The builder's stats are reset, and end up in result.build
+bool ProcessFile(const std::string& path, const std::string& cfgPath, const Settings& settings, BrushBuilder& bb, const ProcessOptions& options, FileResult& result)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto last = start;
+	result.path = path;
+	result.cfgPath = cfgPath;
+	bb.ResetStats();
+
+	MappedFile ReadFile;
+	if (!ReadFile.Open(path))
+	{
+		result.error = "could not open file";
+		return false;
+	}
+
+	GeometryCache cache;
+	GeometryCache* pCache = nullptr;
+	std::string cachePath;
+	std::unordered_set<uint64_t> live;
+	if (options.useCache)
+	{
+		pCache = &cache;
+		cachePath = CachePathFor(path, options.cacheDir);
+		if (options.clearCache)
+		{
+			std::error_code ec;
+			std::filesystem::remove(cachePath, ec);
+		}
+		else
+			cache.Load(cachePath, GeometryCache::ConfigFor(bb));
+		LapTime(last, result.flCacheSeconds);
+	}
+
+	// A cache that can't be written just means building again next time, so that's not worth failing over
+	auto saveCache = [&]()
+	{
+		if (!pCache || !cache.HasChanges(live))
+			return;
+		std::error_code ec;
+		if (!options.cacheDir.empty())
+			std::filesystem::create_directories(options.cacheDir, ec);
+		cache.Save(cachePath, live);
+		LapTime(last, result.flCacheSeconds);
+	};
+
+	// A .ppbin is loaded in one go quicker than streaming could get started
+	bool binary = IsBinaryMap(path);
+	if (options.stream && !binary && options.format == OutputFormat::Cfg)
+	{
+		std::ofstream writingFile(cfgPath);
+		if (!writingFile.is_open())
+		{
+			result.error = "could not write " + cfgPath;
+			return false;
+		}
+		bool parsed = StreamFile(ReadFile, writingFile, settings, bb, options, pCache, live, result);
+		writingFile.close();
+		result.build = bb.GetStats();
+		last = std::chrono::steady_clock::now();
+		if (!parsed)
+		{
+			// Don't leave half a cfg lying around, the normal path wouldn't have written anything
+			std::error_code ec;
+			std::filesystem::remove(cfgPath, ec);
+			return false;
+		}
+		if (writingFile.fail())
+		{
+			result.error = "failed while writing " + cfgPath;
+			return false;
+		}
+		saveCache();
+		result.flSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.ok = true;
+		return true;
+	}
+
+	// Text goes into a FlatMap, and only entities that are going to be drawn get taken out of it into the Entity
+	// objects everything after filtering works on. A .ppbin is loaded as entities already
+	FlatMap map;
+	std::vector<Entity> entities;
+	bool prebuilt = false;
+	try
+	{
+		if (binary)
+			prebuilt = LoadBinaryMap(ReadFile.View(), entities, GeometryCache::ConfigFor(bb));
+		else
+			ParseBufferFlat(ReadFile.View(), map);
+	}
+	catch (const std::exception& e)
+	{
+		result.error = std::string("parse error (") + e.what() + ")";
+		return false;
+	}
+	ReadFile.Close();
+	LapTime(last, result.flParseSeconds);
+
+	// Its edges are as good as cached ones, and the cache would only be a copy of them
+	if (prebuilt)
+		pCache = nullptr;
+	if (binary)
+	{
+		result.nEntities = entities.size();
+		for (const Entity& ent : entities)
+		{
+			result.nBrushes += ent.brushes.size();
+			if (pCache)
+			{
+				for (const Brush& brush : ent.brushes)
+					live.insert(GeometryCache::KeyFor(brush));
+			}
+		}
+	}
+	else
+	{
+		result.nEntities = map.EntityCount();
+		result.nBrushes = map.BrushCount();
+		if (pCache)
+		{
+			for (size_t iBrush = 0; iBrush < map.BrushCount(); iBrush++)
+			{
+				const FlatBrush& brush = map.GetBrush(iBrush);
+				live.insert(GeometryCache::KeyFor(map.Planes(brush), brush.nPlanes));
+			}
+		}
+	}
+	LapTime(last, result.flCacheSeconds);
+
+	// Filter before building anything, most entities usually don't get drawn
+	std::vector<Bounds> bounds(result.nEntities);
+	for (size_t i = 0; i < result.nEntities; i++)
+		bounds[i] = binary ? EntityBounds(entities[i]) : map.EntityBounds(i);
+	std::vector<char> keep = FindEntitiesInRegions(settings, bounds);
+	for (size_t i = 0; i < result.nEntities; i++)
+		keep[i] = keep[i] && PassesRules(settings, binary ? entities[i] : map.GetEntity(i), bounds[i]);
+	if (!binary)
+		entities = map.TakeEntities(keep);
+	else
+	{
+		size_t nKept = 0;
+		for (size_t i = 0; i < entities.size(); i++)
+		{
+			if (!keep[i])
+				continue;
+			if (nKept != i)
+				entities[nKept] = std::move(entities[i]);
+			nKept++;
+		}
+		entities.resize(nKept);
+	}
+	result.nEntitiesDrawn = entities.size();
+	LapTime(last, result.flFilterSeconds);
+
+	//get line from two intersecting planes
+	//every plane in a brush must be checked against all others in the brush
+	std::vector<Brush*> brushes;
+	std::vector<uint64_t> keys;
+	for (Entity& ent : entities)
+	{
+		if (!DrawsBrushes(settings, ent))
+			continue;
+		if (prebuilt)
+		{
+			result.nBrushesCached += ent.brushes.size();
+			continue;
+		}
+		for (Brush& brush : ent.brushes)
+		{
+			// Anything built on an earlier run doesn't need building again
+			uint64_t key = pCache ? GeometryCache::KeyFor(brush) : 0;
+			if (pCache && cache.Find(key, brush))
+			{
+				result.nBrushesCached++;
+				continue;
+			}
+			brushes.push_back(&brush);
+			keys.push_back(key);
+		}
+	}
+	LapTime(last, result.flCacheSeconds);
+	result.nBrushesBuilt = brushes.size();
+	BuildBrushes(brushes, bb, options.nBuildThreads);
+	result.build = bb.GetStats();
+	LapTime(last, result.flBuildSeconds);
+	if (pCache)
+	{
+		for (size_t i = 0; i < brushes.size(); i++)
+			cache.Store(keys[i], *brushes[i]);
+		LapTime(last, result.flCacheSeconds);
+	}
+
+	if (options.merge)
+	{
+		EdgeMerger merger;
+		for (Entity& ent : entities)
+		{
+			if (DrawsBrushes(settings, ent))
+				merger.Merge(ent);
+		}
+		result.merge = merger.GetStats();
+		LapTime(last, result.flMergeSeconds);
+	}
+
+	ShapeTable shapes;
+	if (options.instance)
+	{
+		shapes.Find(settings, entities);
+		result.nShapes = shapes.ShapeCount();
+		result.nPlacements = shapes.PlacementCount();
+		result.nLinesBefore = shapes.LinesBefore();
+		result.nLinesAfter = shapes.LinesAfter();
+	}
+
+	const OutputFormatInfo& format = GetOutputFormat(options.format);
+	std::ofstream writingFile(cfgPath, format.binary ? std::ios::out | std::ios::binary : std::ios::out);
+	if (!writingFile.is_open())
+	{
+		result.error = "could not write " + cfgPath;
+		return false;
+	}
+	EmitOptions emitOptions;
+	emitOptions.floatStyle = options.floatStyle;
+	emitOptions.nDecimals = options.nDecimals;
+	emitOptions.pShapes = options.instance ? &shapes : nullptr;
+	format.emit(writingFile, settings, entities, emitOptions);
+	writingFile.close();
+	LapTime(last, result.flEmitSeconds);
+	if (writingFile.fail())
+	{
+		result.error = "failed while writing " + cfgPath;
+		return false;
+	}
+	saveCache();
+
+	result.flSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.ok = true;
+	return true;
+}
+
+// Times the line at a time parser against the mapped one on the same file
+int RunParseBenchmark(const std::string& path)
+{
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		std::cout << "Could not open " << path << "\n";
+		return 1;
+	}
+	double flMegabytes = file.View().size() / (1024.0 * 1024.0);
+	file.Close();
+
+	constexpr int nPasses = 10;
+	size_t nStreamEntities = 0;
+	size_t nMappedEntities = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < nPasses; i++)
+	{
+		std::vector<Entity> entities;
+		std::ifstream ReadFile(path);
+		ParseFile(ReadFile, entities);
+		nStreamEntities = entities.size();
+	}
+	double flStreamSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < nPasses; i++)
+	{
+		std::vector<Entity> entities;
+		MappedFile ReadFile;
+		ReadFile.Open(path);
+		ParseBuffer(ReadFile.View(), entities);
+		nMappedEntities = entities.size();
+	}
+	double flMappedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	double flStreamRate = flMegabytes * nPasses / flStreamSeconds;
+	double flMappedRate = flMegabytes * nPasses / flMappedSeconds;
+	std::cout << path << ": " << flMegabytes << " MB, " << nPasses << " passes\n"
+		<< "  getline parser: " << flStreamRate << " MB/s (" << nStreamEntities << " entities)\n"
+		<< "  mapped parser:  " << flMappedRate << " MB/s (" << nMappedEntities << " entities), " << flMappedRate / flStreamRate << "x\n";
+
+	// Both parsers should always agree
+	return nStreamEntities == nMappedEntities ? 0 : 1;
+}
+
+// Times writing a whole file's cfg the old way, through std::ofstream, against CfgWriter. Everything is drawn, cubes too.
+// The ofstream and legacy CfgWriter output have to match byte for byte
+int RunWriteBenchmark(const std::string& path)
+{
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		std::cout << "Could not open " << path << "\n";
+		return 1;
+	}
+	std::vector<Entity> entities;
+	ParseBuffer(file.View(), entities);
+	file.Close();
+
+	std::vector<Brush*> brushes;
+	size_t nLines = 1;
+	for (Entity& ent : entities)
+	{
+		for (Brush& brush : ent.brushes)
+			brushes.push_back(&brush);
+	}
+	BrushBuilder bb;
+	BuildBrushes(brushes, bb, 0);
+
+	Settings settings;
+	settings.drawEntCubes = true;
+	for (const Entity& ent : entities)
+	{
+		nLines++;
+		if (DrawsBrushes(settings, ent))
+		{
+			for (const Brush& brush : ent.brushes)
+				nLines += brush.edges.size();
+		}
+	}
+
+	std::string tempPath = (std::filesystem::temp_directory_path() / "planepoints_benchwrite.cfg").string();
+	constexpr int nPasses = 5;
+	auto time = [&](auto write)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < nPasses; i++)
+		{
+			std::ofstream out(tempPath, std::ios::binary);
+			write(out);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / nPasses;
+	};
+	auto readBack = [&tempPath]()
+	{
+		std::ifstream in(tempPath, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	};
+
+	double flStreamSeconds = time([&](std::ofstream& out) { WriteCfg(out, settings, entities); });
+	std::string streamText = readBack();
+
+	struct Run { const char* name; FloatStyle style; int nDecimals; };
+	std::cout << path << ": " << nLines << " lines, " << nPasses << " passes\n";
+	std::cout << "  ofstream:           " << nLines / flStreamSeconds << " lines/s, " << streamText.size() / flStreamSeconds / (1024 * 1024) << " MB/s\n";
+	bool same = true;
+	for (const Run& run : { Run{ "CfgWriter legacy:   ", FloatStyle::Legacy, 0 }, Run{ "CfgWriter shortest: ", FloatStyle::Shortest, 0 }, Run{ "CfgWriter 2 places: ", FloatStyle::Fixed, 2 } })
+	{
+		double flSeconds = time([&](std::ofstream& out)
+		{
+			CfgWriter writer(&out, run.style, run.nDecimals);
+			WriteCfg(writer, settings, entities);
+		});
+		std::string text = readBack();
+		std::cout << "  " << run.name << nLines / flSeconds << " lines/s, " << text.size() / flSeconds / (1024 * 1024) << " MB/s, " << flStreamSeconds / flSeconds << "x\n";
+		if (run.style == FloatStyle::Legacy && text != streamText)
+		{
+			std::cout << "  legacy output doesn't match ofstream!\n";
+			same = false;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::remove(tempPath, ec);
+	return same ? 0 : 1;
+}
+
+// A round brush with nPlanes faces spread evenly over a sphere, to get as many vertices out of a plane count as possible
+Brush MakeSphereBrush( int nPlanes, const Vector3& center, float flRadius )
+{
+	Brush brush;
+	const double flGoldenAngle = 2.39996322972865332; // pi * ( 3 - sqrt( 5 ) )
+	for ( int i = 0; i < nPlanes; i++ )
+	{
+		double z = 1.0 - 2.0 * ( i + 0.5 ) / nPlanes;
+		double r = sqrt( 1.0 - z * z );
+		Plane plane;
+		plane.normal = { (float)( cos( flGoldenAngle * i ) * r ), (float)( sin( flGoldenAngle * i ) * r ), (float)z };
+		plane.dist = dotProduct( plane.normal, center ) + flRadius;
+		brush.planes.push_back( plane );
+	}
+	return brush;
+}
+
+// Times welding and edge dedup with the hashes against plain scans, on brushes with more and more vertices.
+// Each corner of a brush is found once for every pair of planes meeting there, each a hair off from the others,
+// and each edge is found from both of its faces, so that's what gets fed in
+int RunWeldBenchmark()
+{
+	BrushBuilder bb;
+	bb.SetMethod(BuildMethod::Clip);
+
+	int nFailures = 0;
+	std::cout << "planes  verts  edges   weld scan us   weld hash us   edge scan us   edge hash us\n";
+	for (int nPlanes : { 8, 16, 32, 64, 128, 256, 512, 1024 })
+	{
+		Brush brush = MakeSphereBrush(nPlanes, { 1234.5f, -678.25f, 90.0f }, 512.0f);
+		bb.Build(brush);
+
+		// Corners, each a few times over with some jitter well inside k_flEpsilon, in a scrambled order
+		std::vector<Vector3> corners;
+		for (const Edge& edge : brush.edges)
+		{
+			for (const Vector3& v : { edge.stem, edge.tail })
+			{
+				if (std::find(corners.begin(), corners.end(), v) == corners.end())
+					corners.push_back(v);
+			}
+		}
+		std::vector<Vector3> points;
+		uint32_t seed = 12345;
+		auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+		for (int iCopy = 0; iCopy < 6; iCopy++)
+		{
+			for (const Vector3& v : corners)
+			{
+				float flJitter = ((int)(random() % 65) - 32) * (k_flEpsilon / 128);
+				points.push_back({ v.x + flJitter, v.y - flJitter, v.z + flJitter * 0.5f });
+			}
+		}
+		for (size_t i = points.size() - 1; i > 0; i--)
+			std::swap(points[i], points[random() % (i + 1)]);
+
+		// One extra pass first to get the allocations out of the way
+		int nPasses = std::max(5, 20000000 / (int)(points.size() * corners.size()));
+		std::vector<uint32_t> welded[2];
+		double flWeldSeconds[2];
+		VertexWeldHash hash;
+		for (int iMode = 0; iMode < 2; iMode++)
+		{
+			std::vector<Vector3> verts;
+			auto start = std::chrono::steady_clock::now();
+			for (int iPass = -1; iPass < nPasses; iPass++)
+			{
+				if (iPass == 0)
+					start = std::chrono::steady_clock::now();
+				verts.clear();
+				hash.Clear();
+				welded[iMode].clear();
+				for (const Vector3& v : points)
+					welded[iMode].push_back(WeldVertex(verts, iMode ? &hash : nullptr, v));
+			}
+			flWeldSeconds[iMode] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / nPasses;
+		}
+
+		// Every edge from both sides, as welded indices
+		std::vector<std::pair<uint32_t, uint32_t>> pairs;
+		{
+			std::vector<Vector3> verts;
+			for (const Edge& edge : brush.edges)
+			{
+				uint32_t iVert1 = WeldVertex(verts, nullptr, edge.stem);
+				uint32_t iVert2 = WeldVertex(verts, nullptr, edge.tail);
+				pairs.push_back({ iVert1, iVert2 });
+				pairs.push_back({ iVert2, iVert1 });
+			}
+			for (size_t i = pairs.size() - 1; i > 0; i--)
+				std::swap(pairs[i], pairs[random() % (i + 1)]);
+		}
+
+		size_t nUnique[2] = { 0, 0 };
+		double flEdgeSeconds[2];
+		EdgeIndexSet edgeSet;
+		for (int iMode = 0; iMode < 2; iMode++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (int iPass = -1; iPass < nPasses; iPass++)
+			{
+				if (iPass == 0)
+					start = std::chrono::steady_clock::now();
+				std::vector<std::pair<uint32_t, uint32_t>> kept;
+				edgeSet.Clear();
+				for (const auto& pair : pairs)
+				{
+					bool dupe = false;
+					if (iMode)
+						dupe = !edgeSet.Insert(pair.first, pair.second);
+					else
+					{
+						for (const auto& existing : kept)
+						{
+							if ((existing.first == pair.first && existing.second == pair.second) || (existing.first == pair.second && existing.second == pair.first))
+								dupe = true;
+						}
+					}
+					if (!dupe)
+						kept.push_back(pair);
+				}
+				nUnique[iMode] = kept.size();
+			}
+			flEdgeSeconds[iMode] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / nPasses;
+		}
+
+		bool same = welded[0] == welded[1] && nUnique[0] == nUnique[1] && nUnique[0] == brush.edges.size();
+		char line[128];
+		snprintf(line, sizeof(line), "%6d %6zu %6zu %14.1f %14.1f %14.1f %14.1f", nPlanes, corners.size(), brush.edges.size(),
+			flWeldSeconds[0] * 1e6, flWeldSeconds[1] * 1e6, flEdgeSeconds[0] * 1e6, flEdgeSeconds[1] * 1e6);
+		std::cout << line << (same ? "" : "  MISMATCH") << "\n";
+		if (!same)
+			nFailures++;
+	}
+	return nFailures ? 1 : 0;
+}
+
+bool EdgesNear( const Edge& a, const Edge& b, float eps )
+{
+	auto near = [eps]( const Vector3& l, const Vector3& r )
+	{
+		return IsNear( l.x, r.x, eps ) && IsNear( l.y, r.y, eps ) && IsNear( l.z, r.z, eps );
+	};
+	return ( near( a.stem, b.stem ) && near( a.tail, b.tail ) ) || ( near( a.stem, b.tail ) && near( a.tail, b.stem ) );
+}
+
+// Same edges in the same order, each within eps at both ends
+bool BrushesNear( const Brush& a, const Brush& b, float eps )
+{
+	if ( a.edges.size() != b.edges.size() )
+		return false;
+	for ( size_t i = 0; i < a.edges.size(); i++ )
+	{
+		if ( !EdgesNear( a.edges[i], b.edges[i], eps ) )
+			return false;
+	}
+	return true;
+}
+
+// Same edges in the same order, bit for bit
+bool BrushesIdentical( const Brush& a, const Brush& b )
+{
+	if ( a.edges.size() != b.edges.size() )
+		return false;
+	for ( size_t i = 0; i < a.edges.size(); i++ )
+	{
+		if ( !( a.edges[i].stem == b.edges[i].stem ) || !( a.edges[i].tail == b.edges[i].tail ) )
+			return false;
+	}
+	return true;
+}
+
+// Anything closer than this is just Cramer's rule and elimination rounding differently
+// (the reference's float elimination can be off by more than k_flEpsilon on big coordinates)
+constexpr float k_flVerifyTolerance = 0.01f;
+
+// How a batched kernel's build of a brush compares with the reference's
+enum class ReferenceMatch
+{
+	Same,
+	Reculled,	// Only differs over points the kernel culled again in double
+	Different,
+};
+
+// built is original as a kernel built it, logging what it reculled into reculled, and ref is the reference's build.
+// It only counts as Reculled if the reference comes out the same once it culls those points like the kernel did
+ReferenceMatch CompareToReference( const Brush& original, const Brush& built, const Brush& ref, const std::vector<RecullPoint>& reculled )
+{
+	if ( BrushesNear( built, ref, k_flVerifyTolerance ) )
+		return ReferenceMatch::Same;
+	if ( reculled.empty() )
+		return ReferenceMatch::Different;
+
+	BrushBuilder recheck;
+	recheck.SetKernel( BuildKernel::Reference );
+	recheck.SetMethod( BuildMethod::Triples );
+	recheck.SetCullOverrides( &reculled );
+	Brush redone = original;
+	recheck.Build( redone );
+	return BrushesNear( built, redone, k_flVerifyTolerance ) ? ReferenceMatch::Reculled : ReferenceMatch::Different;
+}
+
+// Builds every brush in a file with the reference solver and with each batched kernel this machine has, and compares them.
+// The batched kernels have to agree with each other exactly, and with the reference to within a small distance.
+// Where a kernel culled points again in double that the reference only ever tested in float, the reference gets a
+// second go with those points culled like the kernel did, and the brush is only let off if that makes them agree.
+// The clipping builder has to match the scalar kernel exactly
+int RunKernelVerify(const std::string& path)
+{
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		std::cout << "Could not open " << path << "\n";
+		return 1;
+	}
+	std::vector<Entity> entities;
+	try
+	{
+		ParseBuffer(file.View(), entities);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Could not parse " << path << ": " << e.what() << "\n";
+		return 1;
+	}
+
+	std::vector<Brush*> brushes;
+	for (Entity& ent : entities)
+		for (Brush& brush : ent.brushes)
+			brushes.push_back(&brush);
+
+	BrushBuilder reference;
+	reference.SetKernel(BuildKernel::Reference);
+	reference.SetMethod(BuildMethod::Triples);
+	std::vector<Brush> referenceBrushes;
+	for (Brush* brush : brushes)
+	{
+		Brush copy = *brush;
+		reference.Build(copy);
+		referenceBrushes.push_back(std::move(copy));
+	}
+
+	int nFailures = 0;
+	std::vector<Brush> firstKernelBrushes;
+	for (BuildKernel kernel : { BuildKernel::Scalar, BuildKernel::SSE2, BuildKernel::AVX2 })
+	{
+		if (!BuildKernelSupported(kernel))
+		{
+			std::cout << BuildKernelName(kernel) << ": not supported here\n";
+			continue;
+		}
+
+		BrushBuilder bb;
+		bb.SetKernel(kernel);
+		bb.SetMethod(BuildMethod::Triples);
+		std::vector<RecullPoint> reculled;
+		bb.SetRecullLog(&reculled);
+		int nMismatched = 0;
+		int nReculled = 0;
+		int nInexact = 0;
+		for (size_t i = 0; i < brushes.size(); i++)
+		{
+			Brush copy = *brushes[i];
+			reculled.clear();
+			bb.Build(copy);
+
+			const Brush& ref = referenceBrushes[i];
+			ReferenceMatch match = CompareToReference(*brushes[i], copy, ref, reculled);
+			if (match == ReferenceMatch::Reculled)
+				nReculled++;
+			else if (match == ReferenceMatch::Different)
+			{
+				if (nMismatched < 5)
+					std::cout << "  brush " << i << " (" << copy.planes.size() << " planes): " << copy.edges.size() << " edges, reference has " << ref.edges.size() << "\n";
+				nMismatched++;
+			}
+
+			// Batched kernels against each other, bit for bit
+			if (firstKernelBrushes.size() < brushes.size())
+				firstKernelBrushes.push_back(copy);
+			else
+			{
+				if (!BrushesIdentical(copy, firstKernelBrushes[i]))
+					nInexact++;
+			}
+		}
+		std::cout << BuildKernelName(kernel) << ": " << brushes.size() - nMismatched - nReculled << " of " << brushes.size() << " brushes match the reference";
+		if (nReculled)
+			std::cout << ", " << nReculled << " more only differ over points too close to a plane for the reference's float culling";
+		if (nMismatched)
+			std::cout << ", " << nMismatched << " don't";
+		if (nInexact)
+			std::cout << ", " << nInexact << " differ from the scalar kernel";
+		std::cout << "\n";
+		nFailures += nMismatched + nInexact;
+	}
+
+	// Clipping only rules out triples that couldn't have made a corner, so on the same kernel it has to come out bit for
+	// bit the same as the triple walk
+	BrushBuilder clipper;
+	clipper.SetKernel(BuildKernel::Scalar);
+	clipper.SetMethod(BuildMethod::Clip);
+	int nMismatched = 0;
+	for (size_t i = 0; i < brushes.size(); i++)
+	{
+		Brush copy = *brushes[i];
+		clipper.Build(copy);
+
+		const Brush& triples = firstKernelBrushes[i];
+		if (!BrushesIdentical(copy, triples))
+		{
+			if (nMismatched < 5)
+				std::cout << "  brush " << i << " (" << copy.planes.size() << " planes): " << copy.edges.size() << " edges, triples has " << triples.edges.size() << "\n";
+			nMismatched++;
+		}
+	}
+	std::cout << "clip: " << brushes.size() - nMismatched << " of " << brushes.size() << " brushes match the scalar kernel";
+	if (nMismatched)
+		std::cout << ", " << nMismatched << " don't";
+	std::cout << "\n";
+	nFailures += nMismatched;
+	return nFailures ? 1 : 0;
+}
+
+void PrintUsage()
+{
+	std::cout << "Usage: planepoints [options] <file.ent | folder>...\n"
+		<< "With no options, every argument is treated as a dropped file and the settings path is asked for.\n"
+		<< "Options (any of these runs without asking for input):\n"
+		<< "  -batch              Run without prompting, using default settings unless -settings is given\n"
+		<< "  -settings <file>    Settings file to use\n"
+		<< "  -threads <n>        Number of threads to use (default: one per core)\n"
+		<< "  -outdir <folder>    Folder to write cfg files to (default: the working directory)\n"
+		<< "  -stream             Build and write each entity as soon as it's parsed, holding only a few hundred at once\n"
+		<< "  -precision <p>      How coordinates are written: shortest (default, exact), legacy (6 digits) or a number of decimal places\n"
+		<< "  -format <name>      What to write: cfg (default), ply, gltf (a .glb) or obj, the last three to look at in other programs\n"
+		<< "  -merge              Draw each entity as one outline rather than brush by brush, leaving out lines brushes share\n"
+		<< "  -instance           Write brushes with the same shape once and draw each copy with a single call\n"
+		<< "  -stats <file>       Write where the time went and what building brushes involved to a JSON file\n"
+		<< "  -watch              Write each cfg, then keep the maps in memory and write them again whenever they or the settings change\n"
+		<< "  -convert            Save each .ent as a .ppbin with every brush built, to load quickly next time, then quit\n"
+		<< "  -nocache            Don't read or write the geometry cache\n"
+		<< "  -clearcache         Throw away the geometry cache for each file and start it over\n"
+		<< "  -cachedir <folder>  Where to keep geometry caches (default: next to each input file)\n"
+		<< "  -kernel <name>      Plane intersection kernel: reference, scalar, sse2 or avx2 (default: fastest available)\n"
+		<< "  -builder <name>     How brushes are built: triples, clip or auto (default: triples)\n"
+		<< "  -benchparse <file>  Compare parsing speed of the line based and mapped parsers, then quit\n"
+		<< "  -verifykernels <file> Check every intersection kernel against the reference solver, then quit\n"
+		<< "  -benchwrite <file>  Compare cfg writing speed of std::ofstream and the buffered writer, then quit\n"
+		<< "  -benchweld          Time vertex welding and edge dedup on brushes with many vertices, then quit\n"
+		<< "Folders are searched for .ent and .ppbin files. A .ppbin is used instead of the .ent it was made from, unless the .ent is newer.\n";
+}
+
+// Expands folders into the .ent files inside them. With binaries, .ppbin files too, and they win over an .ent with the same
+// name unless the .ent was saved after it
+std::vector<std::string> ExpandInputs(const std::vector<std::string>& inputs, bool binaries)
+{
+	// A .ppbin older than its .ent would be the map from before the last edit
+	auto entIsNewer = [](const std::filesystem::path& entPath, const std::filesystem::path& binPath)
+	{
+		std::error_code entError, binError;
+		auto entTime = std::filesystem::last_write_time(entPath, entError);
+		auto binTime = std::filesystem::last_write_time(binPath, binError);
+		return !entError && !binError && entTime > binTime;
+	};
+
+	std::vector<std::string> paths;
+	for (const std::string& input : inputs)
+	{
+		std::error_code ec;
+		if (!std::filesystem::is_directory(input, ec))
+		{
+			paths.push_back(input);
+			continue;
+		}
+
+		std::vector<std::string> found;
+		for (const auto& entry : std::filesystem::directory_iterator(input, ec))
+		{
+			if (!entry.is_regular_file())
+				continue;
+			std::filesystem::path path = entry.path();
+			if (binaries && path.extension() == ".ppbin")
+			{
+				std::filesystem::path entPath = std::filesystem::path(path).replace_extension(".ent");
+				if (!entIsNewer(entPath, path))
+					found.push_back(path.string());
+				else
+					std::cout << "Reading " << entPath.string() << " instead of " << path.string() << ", it's been saved since the .ppbin was made. Convert it again\n";
+			}
+			else if (path.extension() == ".ent")
+			{
+				std::filesystem::path binPath = std::filesystem::path(path).replace_extension(".ppbin");
+				if (!binaries || !std::filesystem::exists(binPath, ec) || entIsNewer(path, binPath))
+					found.push_back(path.string());
+			}
+		}
+		std::sort(found.begin(), found.end());
+		paths.insert(paths.end(), found.begin(), found.end());
+	}
+	return paths;
+}
+
+// Parses and builds every brush of each .ent given, and saves it as a .ppbin next to it, or in outDir
+int RunConvert(const std::vector<std::string>& inputs, const std::string& outDir, int nThreads)
+{
+	std::vector<std::string> paths = ExpandInputs(inputs, false);
+	if (paths.empty())
+	{
+		std::cout << "No input files.\n";
+		return 1;
+	}
+
+	int nFailed = 0;
+	BrushBuilder bb;
+	for (const std::string& path : paths)
+	{
+		std::filesystem::path binPath = std::filesystem::path(path).replace_extension(".ppbin");
+		if (!outDir.empty())
+			binPath = std::filesystem::path(outDir) / binPath.filename();
+
+		MappedFile file;
+		if (!file.Open(path))
+		{
+			std::cout << "FAIL  " << path << ": could not open file\n";
+			nFailed++;
+			continue;
+		}
+
+		std::vector<Entity> entities;
+		try
+		{
+			ParseBuffer(file.View(), entities);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "FAIL  " << path << ": parse error (" << e.what() << ")\n";
+			nFailed++;
+			continue;
+		}
+		file.Close();
+
+		// Build the lot, whatever settings end up being used, any of them could be drawn
+		std::vector<Brush*> brushes;
+		for (Entity& ent : entities)
+			for (Brush& brush : ent.brushes)
+				brushes.push_back(&brush);
+		BuildBrushes(brushes, bb, nThreads);
+
+		if (!WriteBinaryMap(binPath.string(), entities, GeometryCache::ConfigFor(bb)))
+		{
+			std::cout << "FAIL  " << path << ": could not write " << binPath.string() << "\n";
+			nFailed++;
+			continue;
+		}
+		std::cout << "OK    " << path << " -> " << binPath.string() << " (" << entities.size() << " entities, " << brushes.size() << " brushes)\n";
+	}
+	return nFailed ? 1 : 0;
+}
+
+// The parts of a -stats report that are the same for one file or all of them added up
+void WriteStatsBody(std::ostream& out, const FileResult& result, const char* indent)
+{
+	const BuildStats& build = result.build;
+	out << indent << "\"entities\": " << result.nEntities << ", \"entities_drawn\": " << result.nEntitiesDrawn
+		<< ", \"brushes\": " << result.nBrushes << ", \"brushes_built\": " << result.nBrushesBuilt << ", \"brushes_cached\": " << result.nBrushesCached << ",\n"
+		<< indent << "\"seconds\": { \"total\": " << result.flSeconds << ", \"parse\": " << result.flParseSeconds << ", \"filter\": " << result.flFilterSeconds
+		<< ", \"build\": " << result.flBuildSeconds << ", \"merge\": " << result.flMergeSeconds << ", \"emit\": " << result.flEmitSeconds << ", \"cache\": " << result.flCacheSeconds << " },\n"
+		<< indent << "\"build\": { \"brushes\": " << build.nBrushes << ", \"too_few_planes\": " << build.nTooFewPlanes << ", \"boxes\": " << build.nBoxBrushes << ", \"duplicate_planes\": " << build.nDuplicatePlanes << ", \"redundant_planes\": " << build.nRedundantPlanes << ", \"triples\": " << build.nTriples
+		<< ", \"parallel_skips\": " << build.nParallelSkips << ", \"solve_failures\": " << build.nSolveFailures << ", \"points_culled\": " << build.nPointsCulled << ", \"points_reculled\": " << build.nRecullPoints
+		<< ", \"clip_tests\": " << build.nClipTests << ", \"verts_welded\": " << build.nVertsWelded << ", \"edges_dropped\": " << build.nEdgesDropped << " },\n"
+		<< indent << "\"merge\": { \"edges_before\": " << result.merge.nEdgesBefore << ", \"edges_after\": " << result.merge.nEdgesAfter
+		<< ", \"duplicates\": " << result.merge.nDuplicates << ", \"interior\": " << result.merge.nInterior << ", \"collinear\": " << result.merge.nCollinear << " },\n"
+		<< indent << "\"instancing\": { \"shapes\": " << result.nShapes << ", \"placements\": " << result.nPlacements
+		<< ", \"lines_before\": " << result.nLinesBefore << ", \"lines_after\": " << result.nLinesAfter << " },\n"
+		<< indent << "\"histogram\": [";
+	bool first = true;
+	for (int i = 0; i < k_nStatsBuckets; i++)
+	{
+		if (!build.nBucketBrushes[i])
+			continue;
+		out << (first ? "\n" : ",\n") << indent << "\t{ \"min_planes\": " << (i ? k_nStatsBucketLimits[i - 1] + 1 : 4);
+		if (k_nStatsBucketLimits[i] != INT_MAX)
+			out << ", \"max_planes\": " << k_nStatsBucketLimits[i];
+		out << ", \"brushes\": " << build.nBucketBrushes[i] << ", \"seconds\": " << build.nBucketNanos[i] / 1e9
+			<< ", \"mean_us\": " << build.nBucketNanos[i] / 1e3 / build.nBucketBrushes[i] << ", \"max_us\": " << build.nBucketMaxNanos[i] / 1e3 << " }";
+		first = false;
 	}
+	if (!first)
+		out << "\n" << indent;
+	out << "]\n";
+}
+
+// Everything -stats knows about a batch run, per file and in total
+bool WriteStatsReport(const std::string& path, const std::vector<FileResult>& results, double flSeconds, int nThreads)
+{
+	std::ofstream out(path);
+	FileResult total;
+	total.flSeconds = flSeconds;
+	out << "{\n\t\"threads\": " << nThreads << ",\n\t\"files\": [";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const FileResult& result = results[i];
+		out << (i ? ",\n" : "\n") << "\t\t{\n\t\t\t\"path\": ";
+		WriteJsonString(out, result.path);
+		out << ",\n\t\t\t\"ok\": " << (result.ok ? "true" : "false") << ",\n";
+		WriteStatsBody(out, result, "\t\t\t");
+		out << "\t\t}";
+
+		total.nEntities += result.nEntities;
+		total.nEntitiesDrawn += result.nEntitiesDrawn;
+		total.nBrushes += result.nBrushes;
+		total.nBrushesBuilt += result.nBrushesBuilt;
+		total.nBrushesCached += result.nBrushesCached;
+		total.flParseSeconds += result.flParseSeconds;
+		total.flFilterSeconds += result.flFilterSeconds;
+		total.flBuildSeconds += result.flBuildSeconds;
+		total.flEmitSeconds += result.flEmitSeconds;
+		total.flCacheSeconds += result.flCacheSeconds;
+		total.flMergeSeconds += result.flMergeSeconds;
+		total.merge.Add(result.merge);
+		total.nShapes += result.nShapes;
+		total.nPlacements += result.nPlacements;
+		total.nLinesBefore += result.nLinesBefore;
+		total.nLinesAfter += result.nLinesAfter;
+		total.build.Add(result.build);
+	}
+	out << "\n\t],\n\t\"total\": {\n";
+	WriteStatsBody(out, total, "\t\t");
+	out << "\t}\n}\n";
+	out.close();
+	return !out.fail();
+}
+
+bool LoadSettingsFile(const std::string& settingspath, Settings& settings)
+{
+	std::ifstream ReadSettingsFile(settingspath);
+	if (!ReadSettingsFile.is_open())
+	{
+		std::cout << "Could not open settings file " << settingspath << "\n";
+		return false;
+	}
+	return ReadSettings(ReadSettingsFile, settings);
+}
+
+// Where each input's output goes. Two inputs with the same name from different folders, or a map's .ent and .ppbin, would
+// both write the same file, so that's turned away
+bool OutputPathsFor(const std::vector<std::string>& paths, const std::string& outDir, const char* extension, std::vector<std::string>& outPaths)
+{
+	std::unordered_map<std::string, size_t> outputs;
+	outPaths.clear();
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		outPaths.push_back(CfgPathFor(paths[i], outDir, extension));
+		auto [it, added] = outputs.emplace(std::filesystem::path(outPaths[i]).lexically_normal().string(), i);
+		if (!added)
+		{
+			std::cout << paths[it->second] << " and " << paths[i] << " would both be written to " << outPaths[i] << ". Rename one of them.\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+int RunBatch(const std::vector<std::string>& inputs, const std::string& settingspath, const std::string& outDir, int nThreads, ProcessOptions options,
+	const std::string& statsPath)
+{
+	Settings settings;
+	if (!settingspath.empty() && !LoadSettingsFile(settingspath, settings))
+		return 1;
 
-	// Good brush! We can begin!
-	BeginBrush( nPlanes );
+	std::vector<std::string> paths = ExpandInputs(inputs, true);
+	if (paths.empty())
+	{
+		std::cout << "No input files.\n";
+		return 1;
+	}
 
-	// Note: If issues come up with points not combining up properly, then it
-	//       might be worth while to recenter everything for floating point accuracy
+	if (nThreads <= 0)
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+	// Spare cores beyond one per file go to building the brushes within each file
+	options.nBuildThreads = std::max<int>(1, nThreads / (int)paths.size());
+	nThreads = std::min<int>(nThreads, (int)paths.size());
 
+	std::vector<std::string> outPaths;
+	if (!OutputPathsFor(paths, outDir, GetOutputFormat(options.format).extension, outPaths))
+		return 1;
 
-	// Get all plane intersections
-	for (int iPlane1 = 0; iPlane1 < nPlanes - 2; iPlane1++)
+	// Workers pull the next unclaimed file until there are none left
+	std::vector<FileResult> results(paths.size());
+	std::atomic<size_t> nextFile = 0;
+	auto worker = [&]()
 	{
-		Plane& plane1 = brush.planes[iPlane1];
-		if (plane1.skip)
-			continue;
-		
-		for (int iPlane2 = iPlane1 + 1; iPlane2 < nPlanes - 1; iPlane2++)
+		BrushBuilder bb;
+		bb.SetTiming(!statsPath.empty());
+		for (size_t i = nextFile++; i < paths.size(); i = nextFile++)
+			ProcessFile(paths[i], outPaths[i], settings, bb, options, results[i]);
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nThreads; i++)
+		threads.emplace_back(worker);
+	for (std::thread& thread : threads)
+		thread.join();
+	double flSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int nFailed = 0;
+	for (const FileResult& result : results)
+	{
+		if (!result.ok)
 		{
-			Plane& plane2 = brush.planes[iPlane2];
-			if (plane2.skip)
-				continue;
+			std::cout << "FAIL  " << result.path << ": " << result.error << "\n";
+			nFailed++;
+			continue;
+		}
 
-			// Is it parallel or opposing?
-			if ( ShouldSkipPlane( plane1, plane2 ) )
-				continue;
+		std::cout << "OK    " << result.path << " -> " << result.cfgPath << " (" << result.nEntitiesDrawn << " of " << result.nEntities << " entities drawn, "
+			<< result.nBrushes - result.nBrushesBuilt - result.nBrushesCached << " of " << result.nBrushes << " brushes skipped, "
+			<< result.nBrushesCached << " from cache, " << result.flSeconds << "s)\n";
+		if (result.build.nTooFewPlanes)
+			std::cout << "      " << result.build.nTooFewPlanes << " brushes with less than 4 planes left out\n";
+		if (options.merge)
+			std::cout << "      " << result.merge.nEdgesAfter << " of " << result.merge.nEdgesBefore << " lines left after merging brushes ("
+				<< result.merge.nDuplicates << " duplicates, " << result.merge.nInterior << " flat, " << result.merge.nCollinear << " joined into longer lines)\n";
+		if (options.instance)
+			std::cout << "      " << result.nPlacements << " brushes drawn from " << result.nShapes << " shapes ("
+				<< (result.nShapes ? (double)result.nPlacements / result.nShapes : 0) << " each), " << result.nLinesAfter << " lines for them instead of " << result.nLinesBefore << "\n";
+	}
+	std::cout << results.size() - nFailed << " of " << results.size() << " files written in " << flSeconds << "s using " << nThreads << " thread(s).\n";
+	if (!statsPath.empty() && !WriteStatsReport(statsPath, results, flSeconds, nThreads))
+	{
+		std::cout << "Could not write " << statsPath << "\n";
+		return 1;
+	}
+	return nFailed ? 1 : 0;
+}
 
-			// Loop for the other remaining untested planes
-			for (int iPlane3 = iPlane2 + 1; iPlane3 < nPlanes; iPlane3++)
-			{
-				Plane& plane3 = brush.planes[iPlane3];
-				if (plane3.skip)
-					continue;
+// What a WatchedMap had to redo
+struct WatchUpdate
+{
+	std::string error;
+	size_t nEntities = 0;
+	size_t nEntitiesDrawn = 0;
+	size_t nChanged = 0;		// Entities that are new or different, everything when the settings change
+	size_t nRemoved = 0;
+	size_t nBrushesBuilt = 0;
+};
 
-				// Is it parallel or opposing?
-				if ( ShouldSkipPlane( plane3, plane1 ) )
-					continue;
-				if ( ShouldSkipPlane( plane3, plane2 ) )
-					continue;
+// A map kept in memory by -watch, along with every entity's part of the cfg, so an edit only redoes the entities it touched
+class WatchedMap
+{
+public:
+	WatchedMap(const std::string& path, const std::string& cfgPath) : m_path(path), m_cfgPath(cfgPath) {}
 
-				// Do our 3 planes intersect? If not, next plane
-				Vector3 p;
-				if (!PlaneIntersect(plane1, plane2, plane3, &p))
-				{
-#if DEBUG_LOG
-					std::cout << "Intersection between planes " << iPlane1 << ", " << iPlane2 << ", " << iPlane3 << " skipped because they don't intersect\n";
-#endif
-					continue;
-				}
+	const std::string& Path() const { return m_path; }
+	const std::string& CfgPath() const { return m_cfgPath; }
 
-				// Cull points outside of the solid
-				if ( !TestPointInBrush( brush, p ) )
-					continue;
+	// Whether it's ever been read, there's nothing to refilter or write until it has
+	bool Loaded() const { return m_loaded; }
 
-#if DEBUG_LOG
-				std::cout << "Intersection between planes " << iPlane1 << ", " << iPlane2 << ", " << iPlane3 << " found\n";
-#endif
+	// Reads the file again and redoes whichever entities are new or different. If it can't be read, the map stays as it was
+	bool Reload(const Settings& settings, BrushBuilder& bb, const ProcessOptions& options, WatchUpdate& update);
 
-				// Good intersection! Store the point and push the three partial edges
-				uint32_t iVert = StoreVertex( p );
+	// For new settings. Filters every entity again, builds any that are drawn now and weren't before, and redoes every section
+	void Refilter(const Settings& settings, BrushBuilder& bb, const ProcessOptions& options, WatchUpdate& update);
 
-				PushPartialEdge( iPlane3, iPlane1, iVert );
-				PushPartialEdge( iPlane3, iPlane2, iVert );
+	bool Write(const Settings& settings, const ProcessOptions& options, std::string& error) const;
 
-				if ( PushPartialEdge( iPlane2, iPlane1, iVert ) )
-				{
-					// Our pair is full! No need to compute more intersections for iPlane1 and iPlane2
-#if DEBUG_LOG
-					std::cout << "Intersection between planes " << iPlane1 << ", " << iPlane2 << " completed edge\n";
-#endif
-					break;
-				}
-			}
+	// Hash of everything about an entity that goes into its section, for .ppbin maps
+	static uint64_t KeyFor(const Entity& ent);
+
+	// Hash of an entity's text, for everything else
+	static uint64_t HashText(std::string_view text);
+
+private:
+	struct Item
+	{
+		uint64_t key = 0;
+		Entity ent;				// Never merged, so its brushes can be picked up again if only some of them change
+		Bounds bounds;			// From before it was built, same as ProcessFile filters with
+		bool drawn = false;
+		bool built = false;
+		std::string section;	// Its part of the cfg, empty if it's not drawn
+	};
+
+	void Update(const std::vector<size_t>& dirty, const std::unordered_map<uint64_t, const Brush*>& oldBrushes, const Settings& settings,
+		BrushBuilder& bb, const ProcessOptions& options, WatchUpdate& update);
+
+	std::string m_path;
+	std::string m_cfgPath;
+	std::vector<Item> m_items;
+	bool m_loaded = false;
+};
+
+uint64_t WatchedMap::KeyFor(const Entity& ent)
+{
+	// FNV-1a, same as GeometryCache::KeyFor, with that standing in for each brush
+	uint64_t h = 0xCBF29CE484222325ull;
+	auto add = [&h](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			h ^= bytes[i];
+			h *= 0x100000001B3ull;
 		}
+	};
+
+	for (int i = 0; i < k_nEntityStrings; i++)
+	{
+		const std::string& str = *EntityStrings(ent, i);
+		uint32_t nSize = str.size();
+		add(&nSize, sizeof(nSize));
+		add(str.data(), str.size());
+	}
+	add(&ent.origin, sizeof(ent.origin));
+	add(&ent.mins, sizeof(ent.mins));
+	add(&ent.maxs, sizeof(ent.maxs));
+	add(&ent.isTrigger, sizeof(ent.isTrigger));
+	for (const Brush& brush : ent.brushes)
+	{
+		uint64_t brushKey = GeometryCache::KeyFor(brush);
+		add(&brushKey, sizeof(brushKey));
 	}
+	return h;
+}
 
-	// Emit edges
-	int iEdge = 0;
-	for ( int iPlane1 = 0; iPlane1 < nPlanes - 1; iPlane1++ )
+uint64_t WatchedMap::HashText(std::string_view text)
+{
+	// 8 bytes at a time, this goes over the whole file on every save
+	uint64_t h = HashMix(text.size() + 1);
+	size_t i = 0;
+	for (; i + 8 <= text.size(); i += 8)
 	{
-		for ( int iPlane2 = iPlane1 + 1; iPlane2 < nPlanes; iPlane2++ )
+		uint64_t chunk;
+		memcpy(&chunk, text.data() + i, 8);
+		h = HashMix(h ^ chunk) + 0x9E3779B97F4A7C15ull;
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, text.data() + i, text.size() - i);
+	return HashMix(h ^ tail);
+}
+
+bool WatchedMap::Reload(const Settings& settings, BrushBuilder& bb, const ProcessOptions& options, WatchUpdate& update)
+{
+	MappedFile ReadFile;
+	if (!ReadFile.Open(m_path))
+	{
+		update.error = "could not open file";
+		return false;
+	}
+
+	// Text is matched up with what was there before by hashing each entity's lines, and only what's new gets parsed.
+	// A .ppbin can't be split up like that, so it's all loaded and each entity hashed after
+	bool binary = IsBinaryMap(m_path);
+	bool prebuilt = false;
+	std::vector<Entity> entities;
+	std::vector<std::string_view> texts;
+	std::vector<uint64_t> keys;
+	if (binary)
+	{
+		try
 		{
-			EdgePair& edge = m_pEdgePairs[iEdge++];
+			prebuilt = LoadBinaryMap(ReadFile.View(), entities, GeometryCache::ConfigFor(bb));
+		}
+		catch (const std::exception& e)
+		{
+			update.error = std::string("parse error (") + e.what() + ")";
+			return false;
+		}
+		for (const Entity& ent : entities)
+			keys.push_back(KeyFor(ent));
+	}
+	else
+	{
+		SplitEntities(ReadFile.View(), [&](std::string_view text)
+		{
+			texts.push_back(text);
+			keys.push_back(HashText(text));
+		});
+		entities.resize(texts.size());
+	}
 
-			// Skip invalid edges
-			if ( edge.iVertex1 == k_iInvalidVertex || edge.iVertex2 == k_iInvalidVertex )
-				continue;
+	// Old entities by key, for picking up any that haven't changed. Copies of the same entity are handed out in order
+	std::unordered_map<uint64_t, std::vector<size_t>> oldByKey;
+	for (size_t i = m_items.size(); i-- > 0;)
+		oldByKey[m_items[i].key].push_back(i);
+	constexpr size_t nNew = (size_t)-1;
+	std::vector<size_t> iOld(keys.size(), nNew);
+	std::vector<char> reused(m_items.size(), false);
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		auto it = oldByKey.find(keys[i]);
+		if (it == oldByKey.end() || it->second.empty())
+			continue;
+		iOld[i] = it->second.back();
+		reused[iOld[i]] = true;
+		it->second.pop_back();
+	}
 
-			//weed out duplicates
-			bool dupe = false;
-			for (Edge& existingEdge : brush.edges)
+	// Anything new is parsed before the map is touched, so a broken edit leaves it as it was
+	if (!binary)
+	{
+		try
+		{
+			for (size_t i = 0; i < texts.size(); i++)
 			{
-				//stems match and tails match
-				if (m_vecVerts[edge.iVertex1] == existingEdge.stem && m_vecVerts[edge.iVertex2] == existingEdge.tail)
-					dupe = true;
-				//inverse match
-				if (m_vecVerts[edge.iVertex1] == existingEdge.tail && m_vecVerts[edge.iVertex2] == existingEdge.stem)
-					dupe = true;
+				if (iOld[i] == nNew)
+					ParseBufferEach(texts[i], [&](Entity&& ent) { entities[i] = std::move(ent); });
 			}
-			if (dupe)
-				continue;
-
-			// Emit!
-			brush.edges.push_back( { m_vecVerts[edge.iVertex1], m_vecVerts[edge.iVertex2] } );
+		}
+		catch (const std::exception& e)
+		{
+			update.error = std::string("parse error (") + e.what() + ")";
+			return false;
 		}
 	}
-}
-int ReadSettings(std::ifstream& ReadFile, Settings& settings)
-{
-	std::string textLine;
-	bool inComment = false;
-	while (getline(ReadFile, textLine))
+	ReadFile.Close();
+
+	std::vector<Item> old = std::move(m_items);
+	m_items.resize(keys.size());
+	std::vector<size_t> dirty;
+	for (size_t i = 0; i < keys.size(); i++)
 	{
-		//std::cout << textLine << "\n";
-		if (textLine.size() == 0)
+		if (iOld[i] != nNew)
+		{
+			m_items[i] = std::move(old[iOld[i]]);
 			continue;
+		}
 
-		//comments
-		if (textLine[0] == '/' && textLine[1] == '/')
-			continue;
-		else if (textLine[0] == '/' && textLine[1] == '*')//decent but not as good as c++
-			inComment = true;
-		else if (textLine[0] == '*' && textLine[1] == '/')
-			inComment = false;
-		if (inComment)
-			continue;
+		Item& item = m_items[i];
+		item.key = keys[i];
+		item.ent = std::move(entities[i]);
+		item.bounds = EntityBounds(item.ent);
+		item.drawn = PassesRules(settings, item.ent, item.bounds) && InRegions(settings, item.bounds);
+		item.built = prebuilt;
+		dirty.push_back(i);
+	}
+	update.nChanged = dirty.size();
+	update.nRemoved = std::count(reused.begin(), reused.end(), false);
 
-		size_t keyStart = textLine.find('"');
-		size_t keyEnd = textLine.find('"', keyStart + 1);
-		size_t valueStart = textLine.find('"', keyEnd + 1);
-		size_t valueEnd = textLine.find('"', valueStart + 1);
+	// Brushes of entities that went away or changed, for when only a keyvalue or one brush of an entity was edited
+	std::unordered_map<uint64_t, const Brush*> oldBrushes;
+	for (size_t i = 0; i < old.size(); i++)
+	{
+		if (reused[i] || !old[i].built)
+			continue;
+		for (const Brush& brush : old[i].ent.brushes)
+			oldBrushes.emplace(GeometryCache::KeyFor(brush), &brush);
+	}
+	Update(dirty, oldBrushes, settings, bb, options, update);
+	m_loaded = true;
+	return true;
+}
 
-		keyStart++;
-		valueStart++;
+void WatchedMap::Refilter(const Settings& settings, BrushBuilder& bb, const ProcessOptions& options, WatchUpdate& update)
+{
+	std::vector<Bounds> bounds(m_items.size());
+	for (size_t i = 0; i < m_items.size(); i++)
+		bounds[i] = m_items[i].bounds;
+	std::vector<char> inRegion = FindEntitiesInRegions(settings, bounds);
+	std::vector<size_t> dirty(m_items.size());
+	for (size_t i = 0; i < m_items.size(); i++)
+	{
+		m_items[i].drawn = inRegion[i] && PassesRules(settings, m_items[i].ent, bounds[i]);
+		dirty[i] = i;
+	}
+	update.nChanged = dirty.size();
+	Update(dirty, {}, settings, bb, options, update);
+}
 
-		std::string key = textLine.substr(keyStart, keyEnd - keyStart);
-		std::string value = textLine.substr(valueStart, valueEnd - valueStart);
-		//std::cout << "key " << key << " value " << value << "\n";
-		if (key == "default")
+// Builds whatever the dirty entities need and writes their sections again
+void WatchedMap::Update(const std::vector<size_t>& dirty, const std::unordered_map<uint64_t, const Brush*>& oldBrushes, const Settings& settings,
+	BrushBuilder& bb, const ProcessOptions& options, WatchUpdate& update)
+{
+	std::vector<Brush*> brushes;
+	for (size_t i : dirty)
+	{
+		Item& item = m_items[i];
+		if (!item.drawn || item.built || !DrawsBrushes(settings, item.ent))
+			continue;
+		for (Brush& brush : item.ent.brushes)
 		{
-			if (!strcmp(value.c_str(), "allow"))
-				settings.defaultAllow = true;
-			else if (!strcmp(value.c_str(), "disallow"))
-				settings.defaultAllow = false;
+			auto it = oldBrushes.empty() ? oldBrushes.end() : oldBrushes.find(GeometryCache::KeyFor(brush));
+			if (it != oldBrushes.end() && GeometryCache::SamePlanes(brush.planes.data(), brush.planes.size(), it->second->planes.data(), it->second->planes.size()))
+				brush.edges = it->second->edges;
 			else
-			{
-				std::cout << "Unknown setting for " << key << ". Should be either 'allow' or 'disallow'.\n";
-				return 0;
-			}
+				brushes.push_back(&brush);
 		}
-		else if (key == "drawontop")
+		item.built = true;
+	}
+	BuildBrushes(brushes, bb, options.nBuildThreads);
+	update.nBrushesBuilt += brushes.size();
+
+	CfgWriter out(nullptr, options.floatStyle, options.nDecimals);
+	EdgeMerger merger;
+	for (size_t i : dirty)
+	{
+		Item& item = m_items[i];
+		item.section.clear();
+		if (!item.drawn)
+			continue;
+		if (options.merge && DrawsBrushes(settings, item.ent))
 		{
-			if (!strcmp(value.c_str(), "yes"))
-				settings.drawontop = true;
-			else if (!strcmp(value.c_str(), "no"))
-				settings.drawontop = false;
-			else
-			{
-				std::cout << "Unknown setting for " << key << ". Should be either 'yes' or 'no'.\n";
-				return 0;
-			}
+			// Merging empties every brush but the first, and they're still wanted if the entity is edited again
+			Entity merged = item.ent;
+			merger.Merge(merged);
+			WriteEntity(out, settings, merged);
 		}
-		else if (key == "drawtriggeroutlines")
+		else
+			WriteEntity(out, settings, item.ent);
+		item.section = out.TakeText();
+	}
+
+	update.nEntities = m_items.size();
+	update.nEntitiesDrawn = 0;
+	for (const Item& item : m_items)
+		update.nEntitiesDrawn += item.drawn;
+}
+
+bool WatchedMap::Write(const Settings& settings, const ProcessOptions& options, std::string& error) const
+{
+	std::ofstream writingFile(m_cfgPath);
+	if (!writingFile.is_open())
+	{
+		error = "could not write " + m_cfgPath;
+		return false;
+	}
+	{
+		CfgWriter out(&writingFile, options.floatStyle, options.nDecimals);
+		// Just the first line, the entities are already written
+		WriteCfg(out, settings, std::vector<Entity>());
+		for (const Item& item : m_items)
+			out << item.section;
+	}
+	writingFile.close();
+	if (writingFile.fail())
+	{
+		error = "failed while writing " + m_cfgPath;
+		return false;
+	}
+	return true;
+}
+
+// Writes every cfg, then keeps every map in memory and writes its cfg again whenever it or the settings file changes.
+// Runs until it's killed
+int RunWatch(const std::vector<std::string>& inputs, const std::string& settingspath, const std::string& outDir, int nThreads, ProcessOptions options)
+{
+	Settings settings;
+	if (!settingspath.empty() && !LoadSettingsFile(settingspath, settings))
+		return 1;
+
+	std::vector<std::string> paths = ExpandInputs(inputs, true);
+	if (paths.empty())
+	{
+		std::cout << "No input files.\n";
+		return 1;
+	}
+
+	if (nThreads <= 0)
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+	options.nBuildThreads = nThreads;
+
+	std::vector<std::string> outPaths;
+	if (!OutputPathsFor(paths, outDir, ".cfg", outPaths))
+		return 1;
+
+	FileWatcher watcher;
+	std::vector<WatchedMap> maps;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		const std::string& path = paths[i];
+		maps.emplace_back(path, outPaths[i]);
+		if (!watcher.Add(path))
 		{
-			if (!strcmp(value.c_str(), "yes"))
-				settings.drawTriggerOutlines = true;
-			else if (!strcmp(value.c_str(), "no"))
-				settings.drawTriggerOutlines = false;
-			else
-			{
-				std::cout << "Unknown setting for " << key << ". Should be either 'yes' or 'no'.\n";
-				return 0;
-			}
+			std::cout << "Could not watch " << path << "\n";
+			return 1;
 		}
-		else if (key == "drawentcubes")
+	}
+	if (!settingspath.empty() && !watcher.Add(settingspath))
+	{
+		std::cout << "Could not watch " << settingspath << "\n";
+		return 1;
+	}
+
+	BrushBuilder bb;
+	auto update = [&](WatchedMap& map, bool reload, bool refilter)
+	{
+		auto start = std::chrono::steady_clock::now();
+		WatchUpdate result;
+		// Never exits, so anything reading the output through a pipe would otherwise sit waiting for it
+		if (reload && !map.Reload(settings, bb, options, result))
 		{
-			if (!strcmp(value.c_str(), "yes"))
-				settings.drawEntCubes = true;
-			else if (!strcmp(value.c_str(), "no"))
-				settings.drawEntCubes = false;
-			else
+			std::cout << "FAIL  " << map.Path() << ": " << result.error << std::endl;
+			// New settings still apply to the last version that could be read, so the cfg isn't left on the old ones
+			if (!refilter || !map.Loaded())
+				return;
+			result.error.clear();
+		}
+		if (refilter)
+			map.Refilter(settings, bb, options, result);
+		bool ok = map.Write(settings, options, result.error);
+		double flMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (!ok)
+			std::cout << "FAIL  " << map.Path() << ": " << result.error << std::endl;
+		else
+			std::cout << "OK    " << map.Path() << " -> " << map.CfgPath() << " (" << result.nChanged << " entities redone, " << result.nRemoved << " removed, "
+				<< result.nBrushesBuilt << " brushes built, " << result.nEntitiesDrawn << " of " << result.nEntities << " entities drawn, " << flMilliseconds << "ms)" << std::endl;
+	};
+
+	for (WatchedMap& map : maps)
+		update(map, true, false);
+	std::cout << "Watching " << paths.size() << " file(s)" << (settingspath.empty() ? "" : " and the settings") << " for changes. Press Ctrl+C to stop." << std::endl;
+
+	for (;;)
+	{
+		std::vector<std::string> changed = watcher.Wait();
+		bool refilter = false;
+		if (!settingspath.empty() && std::find(changed.begin(), changed.end(), settingspath) != changed.end())
+		{
+			Settings newSettings;
+			if (LoadSettingsFile(settingspath, newSettings))
 			{
-				std::cout << "Unknown setting for " << key << ". Should be either 'yes' or 'no'.\n";
-				return 0;
+				settings = std::move(newSettings);
+				refilter = true;
 			}
+			else
+				std::cout << "Keeping the old settings." << std::endl;
 		}
-		else if (key == "duration")
-			settings.duration = stoi(value);
+		for (WatchedMap& map : maps)
+		{
+			bool reload = std::find(changed.begin(), changed.end(), map.Path()) != changed.end();
+			if (reload || refilter)
+				update(map, reload, refilter);
+		}
+	}
+}
 
-		else if (key == "allow" && !settings.defaultAllow)
-			settings.allows.push_back(value);
+//
+// The library interface, see planepoints.h
+//
 
-		else if (key == "disallow" && settings.defaultAllow)
-			settings.disallows.push_back(value);
+struct pp_map
+{
+	FlatMap map;
+	bool built = false;
+	size_t nTooFewPlanes = 0;	// From the last build, which leaves these brushes without edges
+	std::string error;
+};
 
-		else if (key == "must")
-			settings.musts.push_back(value);
+struct pp_settings
+{
+	Settings settings;
+	std::string error;
+};
 
-		else if (key == "avoid")
-			settings.avoids.push_back(value);
+// Everything that takes settings can be given NULL for these
+const Settings& SettingsOrDefaults(const pp_settings* settings)
+{
+	static const Settings defaults;
+	return settings ? settings->settings : defaults;
+}
 
-		else if (key == "color")
-			settings.clrOverrides.push_back(value);
+int pp_api_version(void)
+{
+	return PP_API_VERSION;
+}
 
-		else if (key == "min_x")
-				settings.min_x = stof(value);
-		else if (key == "max_x")
-				settings.max_x = stof(value);
-		else if (key == "min_y")
-				settings.min_y = stof(value);
-		else if (key == "max_y")
-				settings.max_y = stof(value);
-		else if (key == "min_z")
-				settings.min_z = stof(value);
-		else if (key == "max_z")
-				settings.max_z = stof(value);
-	}
-	return 1;
+pp_map* pp_map_create(void)
+{
+	return new (std::nothrow) pp_map;
 }
 
-bool StringMatch(std::string strEnt, std::string strSetting)
+void pp_map_free(pp_map* map)
 {
-	if (strEnt == strSetting)
-		return true;
-	const char* caEnt = strEnt.c_str();
-	const char* caSetting = strSetting.c_str();
-	while (*caEnt && *caSetting)
+	delete map;
+}
+
+pp_status pp_map_parse(pp_map* map, const char* data, size_t size)
+{
+	if (!map || (!data && size))
+		return PP_ERROR_ARGUMENT;
+	map->map.Clear();
+	map->built = false;
+	map->error.clear();
+	try
 	{
-		unsigned char cEnt = *caEnt;
-		unsigned char cSetting = *caSetting;
-		if (cEnt != cSetting)
-			break;
-		caEnt++;
-		caSetting++;
+		ParseBufferFlat(std::string_view(data, size), map->map);
 	}
-	if (*caSetting == 0 && *caEnt == 0)
-		return true;
-	if (*caSetting == '*' && !strEnt.empty())
-		return true;
-	return false;
+	catch (const std::exception& e)
+	{
+		map->map.Clear();
+		map->error = e.what();
+		return PP_ERROR_PARSE;
+	}
+	return PP_OK;
 }
 
-bool CriteriaMet(std::string& key, std::string& value, Entity& ent)
+pp_status pp_map_load(pp_map* map, const char* path)
 {
-	if (key == "classname")
-		return StringMatch(ent.classname, value);
-	else if (key == "editorclass")
-		return StringMatch(ent.editorclass, value);
-	else if (key == "script_flag")
-		return StringMatch(ent.script_flag, value);
-	else if (key == "script_name")
-		return StringMatch(ent.script_name, value);
-	else if (key == "scr_flagTrueAll")
-		return StringMatch(ent.scr_flagTrueAll, value);
-	else if (key == "scr_flagFalseAll")
-		return StringMatch(ent.scr_flagFalseAll, value);
-	else if (key == "scr_flagSet")
-		return StringMatch(ent.scr_flagSet, value);
-	else if (key == "spawnclass")
-		return StringMatch(ent.spawnclass, value);
-	else if (key == "targetname")
-		return StringMatch(ent.targetname, value);
-	else if (key == "_istrigger")
-		return ent.isTrigger;
-	else
-		std::cout << "Did not recognize property named " << key << ".\n";
-	return false;
+	if (!map || !path)
+		return PP_ERROR_ARGUMENT;
+	MappedFile file;
+	if (!file.Open(path))
+	{
+		map->error = std::string("could not open ") + path;
+		return PP_ERROR_OPEN;
+	}
+	std::string_view data = file.View();
+	return pp_map_parse(map, data.data(), data.size());
 }
 
-int BaseColorOffCoord(float coord)
+const char* pp_map_error(const pp_map* map)
 {
-	return (((abs((int)coord % 64) * 4) + 128) / 1.5);
+	return map ? map->error.c_str() : "";
 }
 
-bool FilterXYZ(Settings& settings, Vector3 origin)
+size_t pp_map_entity_count(const pp_map* map)
 {
-	if (settings.min_x > origin.x ||
-		settings.min_y > origin.y ||
-		settings.min_z > origin.z ||
-		settings.max_x < origin.x ||
-		settings.max_y < origin.y ||
-		settings.max_z < origin.z)
-		return false;
-	return true;
+	return map ? map->map.EntityCount() : 0;
 }
 
-//monstrosity
-void ParsePair(std::string& line, std::string& key, std::string& value, char c1, char c2, char c3, std::string* rest = NULL)
+size_t pp_map_brush_count(const pp_map* map)
 {
-	size_t keyStart = line.find(c1);
-	size_t keyEnd = line.find(c2, keyStart + 1);
-	size_t valueEnd = line.find(c3, keyEnd + 1);
+	return map ? map->map.BrushCount() : 0;
+}
 
-	keyStart++;
-	key = line.substr(keyStart, keyEnd - keyStart);
+pp_status pp_map_entity(const pp_map* map, size_t entity, pp_entity_info* info)
+{
+	if (!map || !info || entity >= map->map.EntityCount())
+		return PP_ERROR_ARGUMENT;
+	const Entity& ent = map->map.GetEntity(entity);
+	Bounds bounds = map->map.EntityBounds(entity);
+	for (int i = 0; i < 3; i++)
+	{
+		info->origin[i] = ent.origin[i];
+		info->mins[i] = bounds.mins[i];
+		info->maxs[i] = bounds.maxs[i];
+	}
+	info->is_trigger = ent.isTrigger;
+	info->first_brush = map->map.FirstBrush(entity);
+	info->brush_count = map->map.EndBrush(entity) - map->map.FirstBrush(entity);
+	return PP_OK;
+}
 
-	keyEnd++;
-	value = line.substr(keyEnd, valueEnd - keyEnd);
+const char* pp_map_entity_value(const pp_map* map, size_t entity, const char* key)
+{
+	if (!map || !key || entity >= map->map.EntityCount())
+		return nullptr;
+	for (int i = 0; i < k_nEntityStrings; i++)
+	{
+		if (!strcmp(key, k_entityStringNames[i]))
+			return EntityStrings(map->map.GetEntity(entity), i)->c_str();
+	}
+	return nullptr;
+}
 
-	if (rest != NULL)
-		*rest = line.substr(valueEnd);
+pp_settings* pp_settings_create(void)
+{
+	return new (std::nothrow) pp_settings;
 }
 
-bool PassesFilters(Settings& settings, Entity& ent)
+void pp_settings_free(pp_settings* settings)
 {
-	//filtering
-	bool allowed = false;
-	bool disallowed = false;
+	delete settings;
+}
 
-	//allow for blacklist
-	if (!settings.defaultAllow)
+// Reads settings text for pp_settings_parse and pp_settings_load, keeping whatever ReadSettings would have printed
+pp_status ReadLibrarySettings(pp_settings* settings, std::istream& in)
+{
+	settings->error.clear();
+	std::ostringstream errors;
+	try
 	{
-		for (std::string& line : settings.allows)
-		{
-			std::string key;
-			std::string value;
-			ParsePair(line, key, value, '"', ' ', '"');
-			allowed = CriteriaMet(key, value, ent);
-			if (allowed)
-				break;//found something that allows us, even one thing
-		}
+		// Properties it doesn't recognize are only warned about, but the warning is still kept for pp_settings_error
+		bool ok = ReadSettings(in, settings->settings, errors);
+		settings->error = errors.str();
+		while (!settings->error.empty() && settings->error.back() == '\n')
+			settings->error.pop_back();
+		if (ok)
+			return PP_OK;
+	}
+	catch (const std::exception& e)
+	{
+		// stoi and stof on something that isn't a number
+		settings->error = std::string("bad number (") + e.what() + ")";
 	}
+	return PP_ERROR_PARSE;
+}
+
+pp_status pp_settings_parse(pp_settings* settings, const char* text, size_t size)
+{
+	if (!settings || (!text && size))
+		return PP_ERROR_ARGUMENT;
+	std::istringstream in(std::string(text ? text : "", size));
+	return ReadLibrarySettings(settings, in);
+}
 
-	//re-dis-allow for blacklist
-	//or
-	//disallow for whitelist
-	for (std::string& line : settings.disallows)
+pp_status pp_settings_load(pp_settings* settings, const char* path)
+{
+	if (!settings || !path)
+		return PP_ERROR_ARGUMENT;
+	std::ifstream in(path);
+	if (!in.is_open())
 	{
-		std::string key;
-		std::string value;
-		ParsePair(line, key, value, '"', ' ', '"');
-		disallowed = CriteriaMet(key, value, ent);
-		if (disallowed)
-			break;
+		settings->error = std::string("could not open ") + path;
+		return PP_ERROR_OPEN;
 	}
+	return ReadLibrarySettings(settings, in);
+}
 
-	//re-allow for whitelist
-	if (settings.defaultAllow)
+const char* pp_settings_error(const pp_settings* settings)
+{
+	return settings ? settings->error.c_str() : "";
+}
+
+size_t pp_map_filter(const pp_map* map, const pp_settings* settings, unsigned char* draw)
+{
+	if (!map || !draw)
+		return 0;
+	const Settings& rules = SettingsOrDefaults(settings);
+	size_t nEntities = map->map.EntityCount();
+	try
 	{
-		for (std::string& line : settings.allows)
+		// The same as ProcessFile, regions for every entity at once and then the rules one by one
+		std::vector<Bounds> bounds(nEntities);
+		for (size_t i = 0; i < nEntities; i++)
+			bounds[i] = map->map.EntityBounds(i);
+		std::vector<char> keep = FindEntitiesInRegions(rules, bounds);
+
+		size_t nDrawn = 0;
+		for (size_t i = 0; i < nEntities; i++)
 		{
-			std::string key;
-			std::string value;
-			ParsePair(line, key, value, '"', ' ', '"');
-			allowed = CriteriaMet(key, value, ent);
-			if (allowed)
-				break;
+			const Entity& ent = map->map.GetEntity(i);
+			if (!keep[i] || !PassesRules(rules, ent, bounds[i]))
+			{
+				draw[i] = PP_DRAW_NONE;
+				continue;
+			}
+			draw[i] = DrawsBrushes(rules, ent) ? PP_DRAW_BRUSHES : PP_DRAW_ENTITY;
+			nDrawn++;
 		}
+		return nDrawn;
 	}
-	//std::cout << ent.classname << " defaultAllow " << (settings.defaultAllow ? "true" : "false") << ", disallowed " << (disallowed ? "true" : "false") << ", allowed " << (allowed ? "true" : "false") << "\n";
-	if (settings.defaultAllow)
+	catch (const std::exception&)
 	{
-		if (disallowed && !allowed)
-			return false;//got disallowed, no re-allow
+		memset(draw, PP_DRAW_NONE, nEntities);
+		return 0;
 	}
-	else
+}
+
+void pp_map_entity_color(const pp_map* map, const pp_settings* settings, size_t entity, int color[3])
+{
+	if (!map || !color || entity >= map->map.EntityCount())
+		return;
+	EntityColor(SettingsOrDefaults(settings), map->map.GetEntity(entity), color);
+}
+
+pp_status pp_map_build(pp_map* map, const pp_build_options* options)
+{
+	if (!map)
+		return PP_ERROR_ARGUMENT;
+	pp_build_options defaults = {};
+	if (!options)
+		options = &defaults;
+
+	// Never the -kernel and -builder globals, which only the command line sets
+	BuildKernel kernel = DetectBuildKernel();
+	switch (options->kernel)
 	{
-		if (!allowed)
-			return false;//never was allowed
+	case PP_KERNEL_REFERENCE:	kernel = BuildKernel::Reference; break;
+	case PP_KERNEL_SCALAR:		kernel = BuildKernel::Scalar; break;
+	case PP_KERNEL_SSE2:		kernel = BuildKernel::SSE2; break;
+	case PP_KERNEL_AVX2:		kernel = BuildKernel::AVX2; break;
+	default:					break;
 	}
-
-	bool goodMusts = true;
-	for (std::string& line : settings.musts)
+	if (!BuildKernelSupported(kernel))
 	{
-		std::string key;
-		std::string value;
-		ParsePair(line, key, value, '"', ' ', '"');
-		goodMusts = CriteriaMet(key, value, ent);
-		if (!goodMusts)
-			break;
+		map->error = std::string("kernel ") + BuildKernelName(kernel) + " isn't available";
+		return PP_ERROR_ARGUMENT;
 	}
-
-	if (!goodMusts)
-		return false;
-
-	bool badAvoids = false;
-	for (std::string& line : settings.avoids)
+	BuildMethod method = BuildMethod::Triples;
+	if (options->builder == PP_BUILDER_CLIP)
+		method = BuildMethod::Clip;
+	else if (options->builder == PP_BUILDER_AUTO)
+		method = BuildMethod::Auto;
+
+	map->built = false;
+	map->nTooFewPlanes = 0;
+	map->error.clear();
+	try
 	{
-		std::string key;
-		std::string value;
-		ParsePair(line, key, value, '"', ' ', '"');
-		badAvoids = CriteriaMet(key, value, ent);
-		if (badAvoids)
-			break;
+		BrushBuilder bb;
+		bb.SetKernel(kernel);
+		bb.SetMethod(method);
+		std::vector<char> build;
+		if (options->draw)
+		{
+			build.resize(map->map.EntityCount());
+			for (size_t i = 0; i < build.size(); i++)
+				build[i] = options->draw[i] == PP_DRAW_BRUSHES;
+		}
+		map->map.Build(bb, options->threads, options->draw ? &build : nullptr);
+		map->nTooFewPlanes = bb.GetStats().nTooFewPlanes;
 	}
+	catch (const std::exception& e)
+	{
+		map->error = e.what();
+		return PP_ERROR_BUILD;
+	}
+	map->built = true;
+	return PP_OK;
+}
 
-	if (badAvoids)
-		return false;
-
-	if (!FilterXYZ(settings, ent.origin))
-		return false;
+size_t pp_map_too_few_planes_count(const pp_map* map)
+{
+	return map && map->built ? map->nTooFewPlanes : 0;
+}
 
-	return true;
+pp_status pp_map_each_brush(const pp_map* map, size_t first, size_t count, pp_brush_callback callback, void* user)
+{
+	static_assert(sizeof(Vector3) == 3 * sizeof(float), "corners are handed out as x, y, z floats");
+	static_assert(sizeof(FlatEdge) == 2 * sizeof(uint16_t), "edges are handed out as pairs of uint16_t");
+	if (!map || !callback || first > map->map.EntityCount() || count > map->map.EntityCount() - first)
+		return PP_ERROR_ARGUMENT;
+	if (!map->built)
+		return PP_ERROR_NOT_BUILT;
+
+	for (size_t iEntity = first; iEntity < first + count; iEntity++)
+	{
+		for (uint32_t iBrush = map->map.FirstBrush(iEntity); iBrush < map->map.EndBrush(iEntity); iBrush++)
+		{
+			const FlatBrush& brush = map->map.GetBrush(iBrush);
+			if (!brush.nEdges)
+				continue;
+			pp_brush_edges edges = { iEntity, iBrush, (const float*)map->map.Verts(brush), brush.nVerts, (const uint16_t*)map->map.Edges(brush), brush.nEdges };
+			if (callback(user, &edges))
+				return PP_OK;
+		}
+	}
+	return PP_OK;
 }
 
-bool ColorOverride(Settings& settings, Entity& ent, int* color)
+size_t pp_map_copy_lines(const pp_map* map, size_t entity, float* lines, size_t max_lines)
 {
-	for (std::string& line : settings.clrOverrides)
+	if (!map || !map->built || entity >= map->map.EntityCount())
+		return 0;
+	const Entity& ent = map->map.GetEntity(entity);
+	size_t nLines = 0;
+	for (uint32_t iBrush = map->map.FirstBrush(entity); iBrush < map->map.EndBrush(entity); iBrush++)
 	{
-		std::string key;
-		std::string value;
-		std::string rest;
-		ParsePair(line, key, value, '"', ' ', ' ', &rest);
-		if (CriteriaMet(key, value, ent))
+		const FlatBrush& brush = map->map.GetBrush(iBrush);
+		for (uint32_t iEdge = 0; iEdge < brush.nEdges; iEdge++, nLines++)
 		{
-			Vector3 vecClr = ParseVector(rest);
-			color[0] = vecClr.x;
-			color[1] = vecClr.y;
-			color[2] = vecClr.z;
-			return true;
+			if (!lines || nLines >= max_lines)
+				continue;
+			Edge edge = map->map.GetEdge(brush, iEdge);
+			Vector3 stem = ent.origin + edge.stem;
+			Vector3 tail = ent.origin + edge.tail;
+			float* line = lines + nLines * 6;
+			memcpy(line, &stem, sizeof(stem));
+			memcpy(line + 3, &tail, sizeof(tail));
 		}
 	}
-	return false;
+	return nLines;
 }
 
-int main(int argc, char* argv[])
+int pp_main(int argc, char* argv[])
 {
+	// Anything that looks like an option means we're being run from a script rather than drag and drop
+	bool batch = false;
+	std::string settingspath;
+	std::string outDir;
+	int nThreads = 0;
+	bool convert = false;
+	bool watch = false;
+	std::string statsPath;
+	ProcessOptions options;
+	std::vector<std::string> inputs;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-batch")
+			batch = true;
+		else if (arg == "-settings" && i + 1 < argc)
+		{
+			batch = true;
+			settingspath = argv[++i];
+		}
+		else if (arg == "-threads" && i + 1 < argc)
+		{
+			batch = true;
+			nThreads = atoi(argv[++i]);
+		}
+		else if (arg == "-stream")
+		{
+			batch = true;
+			options.stream = true;
+		}
+		else if ((arg == "-stats" || arg == "--stats") && i + 1 < argc)
+		{
+			batch = true;
+			statsPath = argv[++i];
+		}
+		else if (arg == "-merge")
+		{
+			batch = true;
+			options.merge = true;
+		}
+		else if (arg == "-instance")
+		{
+			batch = true;
+			options.instance = true;
+		}
+		else if (arg == "-convert")
+			convert = true;
+		else if (arg == "-watch")
+			watch = true;
+		else if (arg == "-nocache")
+		{
+			batch = true;
+			options.useCache = false;
+		}
+		else if (arg == "-clearcache")
+		{
+			batch = true;
+			options.clearCache = true;
+		}
+		else if (arg == "-precision" && i + 1 < argc)
+		{
+			batch = true;
+			std::string value = argv[++i];
+			if (value == "shortest")
+				options.floatStyle = FloatStyle::Shortest;
+			else if (value == "legacy")
+				options.floatStyle = FloatStyle::Legacy;
+			else if (!value.empty() && value.find_first_not_of("0123456789") == std::string::npos)
+			{
+				options.floatStyle = FloatStyle::Fixed;
+				options.nDecimals = std::min(atoi(value.c_str()), 9);
+			}
+			else
+			{
+				std::cout << "Precision should be shortest, legacy or a number of decimal places.\n";
+				return 1;
+			}
+		}
+		else if (arg == "-cachedir" && i + 1 < argc)
+		{
+			batch = true;
+			options.cacheDir = argv[++i];
+		}
+		else if (arg == "-outdir" && i + 1 < argc)
+		{
+			batch = true;
+			outDir = argv[++i];
+		}
+		else if (arg == "-kernel" && i + 1 < argc)
+		{
+			std::string name = argv[++i];
+			bool found = false;
+			for (BuildKernel kernel : { BuildKernel::Reference, BuildKernel::Scalar, BuildKernel::SSE2, BuildKernel::AVX2 })
+			{
+				if (name == BuildKernelName(kernel) && BuildKernelSupported(kernel))
+				{
+					g_defaultBuildKernel = kernel;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				std::cout << "Kernel " << name << " isn't available.\n";
+				return 1;
+			}
+		}
+		else if (arg == "-format" && i + 1 < argc)
+		{
+			batch = true;
+			std::string name = argv[++i];
+			bool found = false;
+			for (int iFormat = 0; iFormat < (int)OutputFormat::Count; iFormat++)
+			{
+				if (name == k_outputFormats[iFormat].name)
+				{
+					options.format = (OutputFormat)iFormat;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				std::cout << "Unknown format " << name << ".\n";
+				return 1;
+			}
+		}
+		else if (arg == "-builder" && i + 1 < argc)
+		{
+			std::string name = argv[++i];
+			bool found = false;
+			for (BuildMethod method : { BuildMethod::Triples, BuildMethod::Clip, BuildMethod::Auto })
+			{
+				if (name == BuildMethodName(method))
+				{
+					g_defaultBuildMethod = method;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				std::cout << "Unknown builder " << name << ".\n";
+				return 1;
+			}
+		}
+		else if (arg == "-verifykernels" && i + 1 < argc)
+			return RunKernelVerify(argv[++i]);
+		else if (arg == "-benchwrite" && i + 1 < argc)
+			return RunWriteBenchmark(argv[++i]);
+		else if (arg == "-benchweld")
+			return RunWeldBenchmark();
+		else if (arg == "-benchparse" && i + 1 < argc)
+			return RunParseBenchmark(argv[++i]);
+		else if (arg == "-help" || arg == "--help" || arg == "-?")
+		{
+			PrintUsage();
+			return 0;
+		}
+		else
+			inputs.push_back(arg);
+	}
+
+	if (options.instance && options.stream)
+	{
+		std::cout << "-instance needs every entity built before anything is written, so it can't be used with -stream.\n";
+		return 1;
+	}
+	if (options.format != OutputFormat::Cfg && (options.instance || options.stream || watch))
+	{
+		std::cout << "-instance, -stream and -watch only work when writing cfgs.\n";
+		return 1;
+	}
+	if (watch && (options.instance || options.stream))
+	{
+		std::cout << "-watch keeps each entity's lines separate and redoes them one at a time, so it can't be used with -instance or -stream.\n";
+		return 1;
+	}
+	if (watch && !statsPath.empty())
+	{
+		std::cout << "-watch never finishes a run to report on, so it can't be used with -stats.\n";
+		return 1;
+	}
+	if (convert)
+		return RunConvert(inputs, outDir, nThreads);
+	if (watch)
+		return RunWatch(inputs, settingspath, outDir, nThreads, options);
+	if (batch)
+		return RunBatch(inputs, settingspath, outDir, nThreads, options, statsPath);
+
 	bool debug = argc == 1;
-	std::vector<Entity> entities;
 	Settings settings;
 
 	//settings
 	std::cout << "Got file(s). Please drag settings file onto window and press ENTER, or just press ENTER to go without one.\n";
-	std::string settingspath;
 	std::getline(std::cin, settingspath);
 	std::ifstream ReadSettingsFile(settingspath);
 	bool n = ReadSettings(ReadSettingsFile, settings);
 	ReadSettingsFile.close();
 
+	options.nBuildThreads = nThreads;
+	BrushBuilder bb;
 	for (int i = 1; debug || i < argc; i++)
 	{
 		debug = false;
-		entities.clear();
 		//read entity data
 		std::string path = argc == 1 ? "filename.txt" : argv[i];
-		std::ifstream ReadFile(path);
-		std::string base_filename = path.substr(path.find_last_of("/\\") + 1);
-		std::string::size_type const p(base_filename.find_last_of('.'));
-		std::string file_without_extension = base_filename.substr(0, p);
-		ParseFile(ReadFile, entities);
-		ReadFile.close();
-
-		BrushBuilder bb;
-
-		//get line from two intersecting planes
-		//every plane in a brush must be checked against all others in the brush
-		for (Entity& ent : entities)
-			for (Brush& brush : ent.brushes)
-				bb.Build(brush);
-
-		std::ofstream writingFile;
-		writingFile.open(file_without_extension + ".cfg");
-		std::cout << "Starting writing to " << file_without_extension << ".cfg\n";
-		writingFile << "sv_cheats 1;enable_debug_overlays 1;\n";
-		//write drawlines
-		for (Entity& ent : entities)
+		std::string cfgPath = CfgPathFor(path, outDir, GetOutputFormat(options.format).extension);
+		std::cout << "Starting writing to " << cfgPath << "\n";
+		FileResult result;
+		if (ProcessFile(path, cfgPath, settings, bb, options, result))
 		{
-			if (!PassesFilters(settings, ent))
-				continue;
-
-			int color[3];
-			if (!ColorOverride(settings, ent, color))
-			{
-				color[0] = BaseColorOffCoord(ent.origin.x);
-				color[1] = BaseColorOffCoord(ent.origin.y);
-				color[2] = BaseColorOffCoord(ent.origin.z);
-			}
-			if (!ent.spawnclass.empty()) writingFile << "//Spawn Class: " << ent.spawnclass << "\n";
-			if (!ent.editorclass.empty()) writingFile << "//Editor Class: " << ent.editorclass << "\n";
-			if (!ent.classname.empty()) writingFile << "//Class Name: " << ent.classname << "\n";
-			if (!ent.targetname.empty()) writingFile << "//Target Name: " << ent.targetname << "\n";
-			if (!ent.script_flag.empty()) writingFile << "//Script Flag: " << ent.script_flag << "\n";
-			if (!ent.script_name.empty()) writingFile << "//Script Name: " << ent.script_name << "\n";
-			if (!ent.scr_flagTrueAll.empty()) writingFile << "//scr_flagTrueAll: " << ent.scr_flagTrueAll << "\n";
-			if (!ent.scr_flagFalseAll.empty()) writingFile << "//scr_flagFalseAll: " << ent.scr_flagFalseAll << "\n";
-			if (!ent.scr_flagSet.empty()) writingFile << "//scr_flagSet: " << ent.scr_flagSet << "\n";
-			if (ent.isTrigger && settings.drawTriggerOutlines)
-			{
-				for (Brush& brush : ent.brushes)
-				{
-					//std::cout << "\n";
-					for (Edge& edge : brush.edges)
-					{
-						Vector3 stem = ent.origin + edge.stem;
-						Vector3 tail = ent.origin + edge.tail;
-#if 1
-
-						writingFile << "script_client DebugDrawLine("
-							<< "Vector(" << stem.x << ", " << stem.y << ", " << stem.z << "), "
-							<< "Vector(" << tail.x << ", " << tail.y << ", " << tail.z << "), "
-							<< color[0] << ", "
-							<< color[1] << ", "
-							<< color[2] << ", "
-							<< (!settings.drawontop ? "true" : "false") << ", "
-							<< settings.duration << ");\n";
-#else
-						// Desmos 3D lol
-						std::cout << "["
-							<< "(" << stem.x << ", " << stem.y << ", " << stem.z << "), "
-							<< "(" << tail.x << ", " << tail.y << ", " << tail.z << ")"
-							<< "]\n";
-#endif
-					}
-				}
-			}
-			if (settings.drawEntCubes)
-			{
-				writingFile << "script_client DebugDrawCube("
-					<< "Vector(" << ent.origin.x << ", " << ent.origin.y << ", " << ent.origin.z << "), "
-					<< "16, "
-					<< color[0] << ", "
-					<< color[1] << ", "
-					<< color[2] << ", "
-					<< (!settings.drawontop ? "true" : "false") << ", "
-					<< settings.duration << ");\n";
-			}
+			std::cout << "Finished writing to " << cfgPath << "\n";
+			std::cout << "Drew " << result.nEntitiesDrawn << " of " << result.nEntities << " entities, skipped building " << result.nBrushes - result.nBrushesBuilt << " of " << result.nBrushes << " brushes ("
+				<< result.nBrushesCached << " were cached)\n";
+			if (result.build.nTooFewPlanes)
+				std::cout << "Left out " << result.build.nTooFewPlanes << " brushes with less than 4 planes\n";
 		}
-		std::cout << "Finished writing to " << file_without_extension << ".cfg\n";
-		writingFile.close();
+		else
+			std::cout << "Could not process " << path << ": " << result.error << "\n";
 	}
 	std::cout << "Done. Press ENTER or the X button to close.\n";
 	std::cin.get();
+	return 0;
+}
+
+// planepoints_bench.cpp brings in this whole file and has its own. The CMake build makes the library without it and
+// gets main from planepoints_main.cpp instead
+#ifndef PLANEPOINTS_NO_MAIN
+int main(int argc, char* argv[])
+{
+	return pp_main(argc, argv);
 }
+#endif
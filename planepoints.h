@@ -0,0 +1,168 @@
+// planepoints as a library, for tools that want trigger geometry without running the program and reading its cfgs back.
+// Plain C so it can be used from anything. Nothing here touches global state: any number of maps can be worked on at once
+// from different threads, as long as each map is only used by one thread at a time. Settings are never changed once
+// they're read, so one pp_settings can be shared by every thread
+#ifndef PLANEPOINTS_H
+#define PLANEPOINTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Goes up whenever anything below changes in a way that would break a caller built against an older one
+#define PP_API_VERSION 1
+
+typedef struct pp_map pp_map;
+typedef struct pp_settings pp_settings;
+
+typedef enum pp_status
+{
+	PP_OK = 0,
+	PP_ERROR_ARGUMENT,		// A null handle, or an entity that isn't in the map
+	PP_ERROR_OPEN,			// Couldn't read a file
+	PP_ERROR_PARSE,			// Bad entity lump or settings, pp_map_error or pp_settings_error says what
+	PP_ERROR_BUILD,			// A brush couldn't be built, see pp_map_error
+	PP_ERROR_NOT_BUILT,		// Asked for edges before pp_map_build
+} pp_status;
+
+// PP_API_VERSION as it was when the library was built
+int pp_api_version(void);
+
+// The whole command line program, taking the same arguments. It's all this library's planepoints executable does
+int pp_main(int argc, char* argv[]);
+
+//
+// Maps
+//
+
+pp_map* pp_map_create(void);
+void pp_map_free(pp_map* map);
+
+// Reads an entity lump, replacing whatever the map had. data doesn't need to be kept around afterwards
+pp_status pp_map_parse(pp_map* map, const char* data, size_t size);
+
+// The same for an .ent file. A .ppbin can't be read this way
+pp_status pp_map_load(pp_map* map, const char* path);
+
+// What went wrong last time something on this map failed, or "" if nothing has
+const char* pp_map_error(const pp_map* map);
+
+size_t pp_map_entity_count(const pp_map* map);
+size_t pp_map_brush_count(const pp_map* map);
+
+typedef struct pp_entity_info
+{
+	float origin[3];
+	float mins[3];				// World space bounds, the same ones the filters go by
+	float maxs[3];
+	int is_trigger;
+	uint32_t first_brush;		// Brushes are numbered across the whole map
+	uint32_t brush_count;
+} pp_entity_info;
+
+pp_status pp_map_entity(const pp_map* map, size_t entity, pp_entity_info* info);
+
+// One of the keyvalues planepoints keeps (classname, targetname, editorclass, spawnclass, script_name, script_flag,
+// scr_flagTrueAll, scr_flagFalseAll, scr_flagSet). "" if the entity doesn't have it, NULL if it isn't one of those
+const char* pp_map_entity_value(const pp_map* map, size_t entity, const char* key);
+
+//
+// Settings and filters
+//
+
+pp_settings* pp_settings_create(void);
+void pp_settings_free(pp_settings* settings);
+
+// The same text as a settings file. Rules add on to any already read
+pp_status pp_settings_parse(pp_settings* settings, const char* text, size_t size);
+pp_status pp_settings_load(pp_settings* settings, const char* path);
+// Why the last parse or load failed. Also has warnings from one that worked, like a rule on a property it doesn't know
+const char* pp_settings_error(const pp_settings* settings);
+
+// What the settings do with an entity
+typedef enum pp_draw
+{
+	PP_DRAW_NONE = 0,			// Filtered out
+	PP_DRAW_ENTITY = 1,			// Drawn, but not its brushes
+	PP_DRAW_BRUSHES = 2,		// Drawn along with its brushes, which need building
+} pp_draw;
+
+// Runs every entity in the map through the settings, writing a pp_draw for each into draw, which holds
+// pp_map_entity_count bytes. settings can be NULL for the defaults. Returns how many entities are drawn at all
+size_t pp_map_filter(const pp_map* map, const pp_settings* settings, unsigned char* draw);
+
+// The color an entity's lines would be drawn in, from a color rule or its position
+void pp_map_entity_color(const pp_map* map, const pp_settings* settings, size_t entity, int color[3]);
+
+//
+// Building
+//
+
+typedef enum pp_kernel
+{
+	PP_KERNEL_DEFAULT = 0,		// The quickest one the CPU has
+	PP_KERNEL_REFERENCE,
+	PP_KERNEL_SCALAR,
+	PP_KERNEL_SSE2,
+	PP_KERNEL_AVX2,
+} pp_kernel;
+
+typedef enum pp_builder
+{
+	PP_BUILDER_DEFAULT = 0,		// Triples
+	PP_BUILDER_TRIPLES,
+	PP_BUILDER_CLIP,
+	PP_BUILDER_AUTO,
+} pp_builder;
+
+// The same choices as -threads, -kernel and -builder. Zeroed is the defaults
+typedef struct pp_build_options
+{
+	int threads;					// 0 for one per core
+	pp_kernel kernel;
+	pp_builder builder;
+	const unsigned char* draw;		// From pp_map_filter, only brushes of PP_DRAW_BRUSHES entities are built. NULL builds them all
+} pp_build_options;
+
+// Builds the map's brushes, replacing any edges from before. options can be NULL. Fails with PP_ERROR_ARGUMENT if the
+// kernel asked for isn't supported
+pp_status pp_map_build(pp_map* map, const pp_build_options* options);
+
+// How many brushes the last build left without edges because they have less than 4 planes. Nothing is ever printed
+// about them
+size_t pp_map_too_few_planes_count(const pp_map* map);
+
+//
+// Edges
+//
+
+// One brush's edges, pointing straight into the map. They stay valid until the map is parsed, built or freed again.
+// Corners are x, y, z relative to the entity's origin and each edge is two indices into them
+typedef struct pp_brush_edges
+{
+	size_t entity;
+	size_t brush;
+	const float* verts;
+	uint32_t vert_count;
+	const uint16_t* edges;
+	uint32_t edge_count;
+} pp_brush_edges;
+
+// Return nonzero to stop early
+typedef int (*pp_brush_callback)(void* user, const pp_brush_edges* brush);
+
+// Calls back with every brush of entities first to first + count - 1 that has edges, in order
+pp_status pp_map_each_brush(const pp_map* map, size_t first, size_t count, pp_brush_callback callback, void* user);
+
+// Writes an entity's edges as world space lines, 6 floats each, into lines, which has room for max_lines of them.
+// Returns how many lines the entity has in all, even if that's more than would fit
+size_t pp_map_copy_lines(const pp_map* map, size_t entity, float* lines, size_t max_lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
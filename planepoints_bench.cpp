@@ -0,0 +1,864 @@
+// Benchmarks for planepoints: a synthetic entity lump generator, microbenchmarks of each stage and a whole-file run.
+// Everything is printed as JSON so runs can be saved and compared against each other with -baseline.
+//
+// planepoints.cpp is pulled in whole so nothing has to be exported from it just for this
+#define PLANEPOINTS_NO_MAIN
+#include "planepoints.cpp"
+
+#include <cstddef>
+
+#ifdef __linux__
+#include <malloc.h>
+#include <sys/wait.h>
+#endif
+
+// Every allocation goes through here so the memory benchmarks can count them, over-aligned ones included. The array and
+// nothrow forms are left to the standard library, which forwards them to these. Each block keeps its size and how far
+// in from what malloc gave the caller's pointer is, just in front of that pointer
+std::atomic<uint64_t> g_nAllocations = 0;
+std::atomic<int64_t> g_nHeapBytes = 0;
+std::atomic<int64_t> g_nPeakHeapBytes = 0;
+constexpr size_t k_nAllocHeader = 2 * sizeof(size_t);
+
+// Only malloc and free are used on the blocks themselves, new and delete just go through these, so the two never get mixed
+void* CountedAlloc(size_t nSize, size_t nAlign)
+{
+	nAlign = std::max(nAlign, alignof(std::max_align_t));
+	char* pBlock = (char*)malloc(nSize + k_nAllocHeader + nAlign);
+	if (!pBlock)
+		throw std::bad_alloc();
+	char* p = (char*)(((uintptr_t)pBlock + k_nAllocHeader + nAlign - 1) & ~(uintptr_t)(nAlign - 1));
+	size_t header[2] = { nSize, (size_t)(p - pBlock) };
+	memcpy(p - k_nAllocHeader, header, sizeof(header));
+	g_nAllocations.fetch_add(1, std::memory_order_relaxed);
+	int64_t nNow = g_nHeapBytes.fetch_add(nSize, std::memory_order_relaxed) + nSize;
+	int64_t nPeak = g_nPeakHeapBytes.load(std::memory_order_relaxed);
+	while (nNow > nPeak && !g_nPeakHeapBytes.compare_exchange_weak(nPeak, nNow, std::memory_order_relaxed))
+		;
+	return p;
+}
+
+void CountedFree(void* p)
+{
+	if (!p)
+		return;
+	size_t header[2];
+	memcpy(header, (char*)p - k_nAllocHeader, sizeof(header));
+	g_nHeapBytes.fetch_sub(header[0], std::memory_order_relaxed);
+	free((char*)p - header[1]);
+}
+
+void* operator new(size_t nSize)
+{
+	return CountedAlloc(nSize, alignof(std::max_align_t));
+}
+
+void* operator new(size_t nSize, std::align_val_t align)
+{
+	return CountedAlloc(nSize, (size_t)align);
+}
+
+void operator delete(void* p) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+	CountedFree(p);
+}
+
+// What gets generated. The same options and seed always give the same lump, byte for byte
+struct GenOptions
+{
+	int nEntities = 2000;
+	int nBrushes = 2;			// Per trigger
+	int nRoundPlanes = 32;		// Planes in each round brush
+	int nBevelPlanes = 12;		// Extra planes on a bevelled box
+	uint32_t seed = 1;
+};
+
+// The kinds of brush mixed into a generated lump
+enum class GenBrushKind
+{
+	Box,		// Just the 6 bounding planes, like most triggers
+	Bevel,		// A box with its edges and corners cut off at 45 degrees, some of them only just touching
+	Sliver,		// A box with extra planes a fraction of a degree off from its faces
+	Round,		// Planes spread evenly over a sphere
+
+	Count,
+};
+
+const char* GenBrushKindName(GenBrushKind kind)
+{
+	switch (kind)
+	{
+	case GenBrushKind::Box: return "box";
+	case GenBrushKind::Bevel: return "bevel";
+	case GenBrushKind::Sliver: return "sliver";
+	case GenBrushKind::Round: return "round";
+	default: return "unknown";
+	}
+}
+
+// Small fixed random number generator so lumps come out the same on every compiler and platform
+struct GenRandom
+{
+	uint64_t state;
+
+	explicit GenRandom(uint32_t seed) : state(HashMix(seed + 1)) {}
+	uint32_t Next() { state = state * 6364136223846793005ull + 1442695040888963407ull; return (uint32_t)(state >> 33); }
+	float Range(float lo, float hi) { return lo + (hi - lo) * (Next() / 2147483648.0f); }
+	int Index(int n) { return (int)(Next() % (uint32_t)n); }
+};
+
+// The planes of one brush of the given kind, relative to its entity's origin
+std::vector<Plane> GenerateBrushPlanes(GenBrushKind kind, const GenOptions& options, GenRandom& random)
+{
+	Vector3 center = { random.Range(-512, 512), random.Range(-512, 512), random.Range(-256, 256) };
+	Vector3 half = { random.Range(16, 512), random.Range(16, 512), random.Range(16, 256) };
+	if (kind == GenBrushKind::Round)
+		return MakeSphereBrush(options.nRoundPlanes, center, random.Range(32, 512)).planes;
+
+	// Always the bounding box first, the parser expects that
+	std::vector<Plane> planes;
+	planes.push_back({ { 1, 0, 0 }, center.x + half.x });
+	planes.push_back({ { -1, 0, 0 }, -(center.x - half.x) });
+	planes.push_back({ { 0, 1, 0 }, center.y + half.y });
+	planes.push_back({ { 0, -1, 0 }, -(center.y - half.y) });
+	planes.push_back({ { 0, 0, 1 }, center.z + half.z });
+	planes.push_back({ { 0, 0, -1 }, -(center.z - half.z) });
+
+	auto addPlane = [&](Vector3 normal, float flDepth)
+	{
+		normal *= 1.0f / sqrtf(dotProduct(normal, normal));
+		// How far the box reaches along the normal, less however deep the cut is
+		float flReach = fabsf(normal.x) * half.x + fabsf(normal.y) * half.y + fabsf(normal.z) * half.z;
+		planes.push_back({ normal, dotProduct(normal, center) + flReach - flDepth });
+	};
+
+	if (kind == GenBrushKind::Bevel)
+	{
+		float flMaxDepth = std::min(half.x, std::min(half.y, half.z)) * 0.5f;
+		for (int i = 0; i < options.nBevelPlanes; i++)
+		{
+			// Edges first, then corners. A quarter of them are left touching the box without cutting anything, like real bevel planes
+			Vector3 normal;
+			int iCut = i % 20;
+			if (iCut < 12)
+			{
+				float a = (iCut & 1) ? 1.0f : -1.0f;
+				float b = (iCut & 2) ? 1.0f : -1.0f;
+				int iAxis = iCut / 4;
+				normal = iAxis == 0 ? Vector3{ 0, a, b } : iAxis == 1 ? Vector3{ a, 0, b } : Vector3{ a, b, 0 };
+			}
+			else
+			{
+				int iCorner = iCut - 12;
+				normal = { (iCorner & 1) ? 1.0f : -1.0f, (iCorner & 2) ? 1.0f : -1.0f, (iCorner & 4) ? 1.0f : -1.0f };
+			}
+			addPlane(normal, random.Index(4) == 0 ? 0.0f : random.Range(1, flMaxDepth));
+		}
+	}
+	else if (kind == GenBrushKind::Sliver)
+	{
+		// Each face gets a twin tilted by a few thousandths of a radian, some cutting in and some not
+		for (int iFace = 0; iFace < 6; iFace++)
+		{
+			Vector3 normal = planes[iFace].normal;
+			float flTilt = random.Range(0.0002f, 0.004f);
+			if (normal.x != 0)
+				normal.y += flTilt;
+			else if (normal.y != 0)
+				normal.z += flTilt;
+			else
+				normal.x += flTilt;
+			addPlane(normal, random.Range(-0.5f, 2.0f));
+		}
+	}
+	return planes;
+}
+
+// Writes an entity lump in the same form as the *_script.ent files the tool is normally given.
+// A quarter of the entities aren't triggers, and the triggers cycle through each kind of brush
+void GenerateLump(const GenOptions& options, std::string& out)
+{
+	static const char* const s_classnames[] = { "trigger_multiple", "trigger_hurt", "trigger_out_of_bounds", "trigger_flag_set" };
+	static const char* const s_others[] = { "info_target", "prop_dynamic", "info_node", "script_ref" };
+	GenRandom random(options.seed);
+	char line[256];
+	int iKind = 0;
+	for (int iEnt = 0; iEnt < options.nEntities; iEnt++)
+	{
+		bool trigger = random.Index(4) != 0;
+		out += "{\n";
+		snprintf(line, sizeof(line), "\"origin\" \"%.3f %.3f %.3f\"\n", random.Range(-12000, 12000), random.Range(-12000, 12000), random.Range(-4000, 4000));
+		out += line;
+		if (random.Index(3) == 0)
+		{
+			snprintf(line, sizeof(line), "\"targetname\" \"target_%d\"\n", iEnt);
+			out += line;
+		}
+		if (random.Index(5) == 0)
+		{
+			snprintf(line, sizeof(line), "\"script_flag\" \"flag_%d\"\n", random.Index(16));
+			out += line;
+		}
+		if (!trigger)
+		{
+			snprintf(line, sizeof(line), "\"classname\" \"%s\"\n}\n", s_others[random.Index(4)]);
+			out += line;
+			continue;
+		}
+
+		const char* classname = s_classnames[random.Index(4)];
+		snprintf(line, sizeof(line), "\"editorclass\" \"%s\"\n\"classname\" \"%s\"\n", classname, classname);
+		out += line;
+		for (int iBrush = 0; iBrush < options.nBrushes; iBrush++)
+		{
+			GenBrushKind kind = (GenBrushKind)(iKind++ % (int)GenBrushKind::Count);
+			std::vector<Plane> planes = GenerateBrushPlanes(kind, options, random);
+			for (size_t iPlane = 0; iPlane < planes.size(); iPlane++)
+			{
+				const Plane& plane = planes[iPlane];
+				snprintf(line, sizeof(line), "\"*trigger_brush_%d_plane_%d\" \"%.6g %.6g %.6g %.6g\"\n", iBrush, (int)iPlane, plane.normal.x, plane.normal.y, plane.normal.z, plane.dist);
+				out += line;
+			}
+		}
+		out += "\"*trigger_bounds_mins\" \"-1024 -1024 -512\"\n\"*trigger_bounds_maxs\" \"1024 1024 512\"\n}\n";
+	}
+}
+
+// One timed thing. Rates are per item (brushes, entities, lines...), with bytes too where they mean something
+struct BenchResult
+{
+	std::string name;
+	std::string unit;
+	uint64_t nItems = 0;		// Per pass
+	uint64_t nBytes = 0;		// Per pass
+	int nPasses = 0;
+	double flSeconds = 0;		// Best pass
+
+	double NsPerItem() const { return flSeconds * 1e9 / std::max<uint64_t>(nItems, 1); }
+};
+
+// Times fn, which does nItems worth of work each call, over and over for at least flMinSeconds, and keeps the quickest pass.
+// The first call is a warm-up and not counted
+template <typename Fn>
+BenchResult RunBench(const std::string& name, const std::string& unit, uint64_t nItems, uint64_t nBytes, double flMinSeconds, Fn&& fn)
+{
+	BenchResult result;
+	result.name = name;
+	result.unit = unit;
+	result.nItems = nItems;
+	result.nBytes = nBytes;
+	result.flSeconds = INFINITY;
+	fn();
+
+	double flTotal = 0;
+	while (flTotal < flMinSeconds || result.nPasses < 3)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		double flSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.flSeconds = std::min(result.flSeconds, flSeconds);
+		result.nPasses++;
+		flTotal += flSeconds;
+	}
+	std::cerr << "  " << name << ": " << result.NsPerItem() << " ns/" << unit << "\n";
+	return result;
+}
+
+// Stops the optimizer throwing away work whose result isn't otherwise used
+volatile uint64_t g_benchSink;
+
+// What one way of holding a map costs in memory
+struct MemoryResult
+{
+	std::string name;
+	uint64_t nAllocations = 0;
+	int64_t nPeakBytes = 0;		// Most heap in use at once, over what there was before
+	int64_t nKeptBytes = 0;		// Heap still in use once it's done, for the map itself
+	long nPeakRssKB = -1;		// Growth in peak RSS, measured in a fresh child process. Linux only
+};
+
+#ifdef __linux__
+// A "VmRSS:" style line from /proc/self/status, in KB
+long ReadProcStatusKB(const char* field)
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t nField = strlen(field);
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, nField, field) == 0)
+			return atol(line.c_str() + nField);
+	}
+	return -1;
+}
+#endif
+
+// Runs fn, which builds some layout of a map and returns it, counting the allocations and heap it took
+template <typename Fn>
+MemoryResult RunMemory(const std::string& name, Fn&& fn)
+{
+	MemoryResult result;
+	result.name = name;
+	int64_t nStartBytes = g_nHeapBytes.load();
+	uint64_t nStartAllocations = g_nAllocations.load();
+	g_nPeakHeapBytes = nStartBytes;
+	{
+		auto kept = fn();
+		result.nAllocations = g_nAllocations.load() - nStartAllocations;
+		result.nKeptBytes = g_nHeapBytes.load() - nStartBytes;
+		result.nPeakBytes = g_nPeakHeapBytes.load() - nStartBytes;
+	}
+
+#ifdef __linux__
+	// Freed memory the allocator holds onto would hide the growth, so hand it back and do it again in a child
+	int fds[2];
+	if (pipe(fds) == 0)
+	{
+		std::cout.flush();
+		malloc_trim(0);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			std::ofstream("/proc/self/clear_refs") << "5";
+			long nStartKB = ReadProcStatusKB("VmRSS:");
+			{
+				auto kept = fn();
+				long nGrowthKB = ReadProcStatusKB("VmHWM:") - nStartKB;
+				if (write(fds[1], &nGrowthKB, sizeof(nGrowthKB)) != sizeof(nGrowthKB))
+					_exit(1);
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		if (pid > 0)
+		{
+			long nGrowthKB;
+			if (read(fds[0], &nGrowthKB, sizeof(nGrowthKB)) == sizeof(nGrowthKB))
+				result.nPeakRssKB = nGrowthKB;
+			waitpid(pid, nullptr, 0);
+		}
+		close(fds[0]);
+	}
+#endif
+
+	std::cerr << "  " << name << ": " << result.nAllocations << " allocations, " << result.nPeakBytes / (1024.0 * 1024.0) << " MB peak heap\n";
+	return result;
+}
+
+// One result per line, so they're easy to pick back out with -baseline, or with grep
+void WriteResults(std::ostream& out, const GenOptions& gen, const std::vector<BenchResult>& results, const std::vector<MemoryResult>& memory)
+{
+	out << "{\n\t\"version\": 1,\n"
+		<< "\t\"kernel\": \"" << BuildKernelName(g_defaultBuildKernel) << "\",\n"
+		<< "\t\"builder\": \"" << BuildMethodName(g_defaultBuildMethod) << "\",\n"
+		<< "\t\"generator\": { \"entities\": " << gen.nEntities << ", \"brushes\": " << gen.nBrushes << ", \"roundplanes\": " << gen.nRoundPlanes
+		<< ", \"bevelplanes\": " << gen.nBevelPlanes << ", \"seed\": " << gen.seed << " },\n"
+		<< "\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& result = results[i];
+		out << "\t\t{ \"name\": ";
+		WriteJsonString(out, result.name);
+		out << ", \"unit\": ";
+		WriteJsonString(out, result.unit);
+		out << ", \"items\": " << result.nItems << ", \"passes\": " << result.nPasses << ", \"seconds\": " << result.flSeconds
+			<< ", \"ns_per_item\": " << result.NsPerItem() << ", \"items_per_second\": " << result.nItems / result.flSeconds;
+		if (result.nBytes)
+			out << ", \"mb_per_second\": " << result.nBytes / (1024.0 * 1024.0) / result.flSeconds;
+		out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "\t],\n\t\"memory\": [\n";
+	for (size_t i = 0; i < memory.size(); i++)
+	{
+		const MemoryResult& result = memory[i];
+		out << "\t\t{ \"name\": ";
+		WriteJsonString(out, result.name);
+		out << ", \"allocations\": " << result.nAllocations << ", \"peak_heap_bytes\": " << result.nPeakBytes << ", \"kept_heap_bytes\": " << result.nKeptBytes;
+		if (result.nPeakRssKB >= 0)
+			out << ", \"peak_rss_kb\": " << result.nPeakRssKB;
+		out << " }" << (i + 1 < memory.size() ? "," : "") << "\n";
+	}
+	out << "\t]\n}\n";
+}
+
+// Pulls name and ns_per_item back out of each result line of an earlier run
+bool ReadBaseline(const std::string& path, std::unordered_map<std::string, double>& baseline)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+		return false;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t nameStart = line.find("\"name\": \"");
+		size_t nsStart = line.find("\"ns_per_item\": ");
+		if (nameStart == std::string::npos || nsStart == std::string::npos)
+			continue;
+		nameStart += 9;
+		size_t nameEnd = line.find('"', nameStart);
+		nsStart += 15;
+		double flNs = 0;
+		std::from_chars(line.data() + nsStart, line.data() + line.size(), flNs);
+		baseline[line.substr(nameStart, nameEnd - nameStart)] = flNs;
+	}
+	return true;
+}
+
+void PrintBenchUsage()
+{
+	std::cout << "Usage: planepoints_bench [options]\n"
+		<< "  -entities n         Entities to generate (default 2000)\n"
+		<< "  -brushes n          Brushes in each trigger (default 2)\n"
+		<< "  -roundplanes n      Planes in each round brush (default 32)\n"
+		<< "  -bevelplanes n      Extra planes on each bevelled box (default 12)\n"
+		<< "  -seed n             Generator seed (default 1)\n"
+		<< "  -gen file           Just write the generated lump to a file and quit\n"
+		<< "  -only name          Only run benchmarks whose name starts with this\n"
+		<< "  -time seconds       Minimum time spent on each benchmark (default 0.5)\n"
+		<< "  -out file           Write the JSON results here instead of to stdout\n"
+		<< "  -baseline file      Compare against the results of an earlier run, exiting with 1 if anything got slower\n"
+		<< "  -tolerance percent  How much slower counts as slower for -baseline (default 10)\n"
+		<< "  -kernel name        As for planepoints\n"
+		<< "  -builder name       As for planepoints\n";
+}
+
+int main(int argc, char* argv[])
+{
+	GenOptions gen;
+	std::string genPath;
+	std::string only;
+	std::string outPath;
+	std::string baselinePath;
+	double flMinSeconds = 0.5;
+	double flTolerance = 10;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-entities" && hasValue)
+			gen.nEntities = std::max(1, atoi(argv[++i]));
+		else if (arg == "-brushes" && hasValue)
+			gen.nBrushes = std::max(1, atoi(argv[++i]));
+		else if (arg == "-roundplanes" && hasValue)
+			gen.nRoundPlanes = std::max(4, atoi(argv[++i]));
+		else if (arg == "-bevelplanes" && hasValue)
+			gen.nBevelPlanes = std::max(0, atoi(argv[++i]));
+		else if (arg == "-seed" && hasValue)
+			gen.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-gen" && hasValue)
+			genPath = argv[++i];
+		else if (arg == "-only" && hasValue)
+			only = argv[++i];
+		else if (arg == "-time" && hasValue)
+			flMinSeconds = atof(argv[++i]);
+		else if (arg == "-out" && hasValue)
+			outPath = argv[++i];
+		else if (arg == "-baseline" && hasValue)
+			baselinePath = argv[++i];
+		else if (arg == "-tolerance" && hasValue)
+			flTolerance = atof(argv[++i]);
+		else if (arg == "-kernel" && hasValue)
+		{
+			std::string name = argv[++i];
+			bool found = false;
+			for (BuildKernel kernel : { BuildKernel::Reference, BuildKernel::Scalar, BuildKernel::SSE2, BuildKernel::AVX2 })
+			{
+				if (name == BuildKernelName(kernel) && BuildKernelSupported(kernel))
+				{
+					g_defaultBuildKernel = kernel;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				std::cout << "Kernel " << name << " isn't available.\n";
+				return 1;
+			}
+		}
+		else if (arg == "-builder" && hasValue)
+		{
+			std::string name = argv[++i];
+			bool found = false;
+			for (BuildMethod method : { BuildMethod::Triples, BuildMethod::Clip, BuildMethod::Auto })
+			{
+				if (name == BuildMethodName(method))
+				{
+					g_defaultBuildMethod = method;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				std::cout << "Unknown builder " << name << ".\n";
+				return 1;
+			}
+		}
+		else
+		{
+			PrintBenchUsage();
+			return arg == "-help" || arg == "--help" ? 0 : 1;
+		}
+	}
+
+	std::string lump;
+	GenerateLump(gen, lump);
+	if (!genPath.empty())
+	{
+		std::ofstream file(genPath, std::ios::binary);
+		file << lump;
+		file.close();
+		if (file.fail())
+		{
+			std::cout << "Could not write " << genPath << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	std::vector<BenchResult> results;
+	auto wanted = [&only](const std::string& name) { return name.compare(0, only.size(), only) == 0; };
+
+	// Parsing
+	std::vector<Entity> entities;
+	ParseBuffer(lump, entities);
+	if (wanted("parse/getline"))
+	{
+		results.push_back(RunBench("parse/getline", "entity", entities.size(), lump.size(), flMinSeconds, [&]()
+		{
+			std::istringstream stream(lump);
+			std::vector<Entity> parsed;
+			ParseFile(stream, parsed);
+			g_benchSink = parsed.size();
+		}));
+	}
+	if (wanted("parse/mapped"))
+	{
+		results.push_back(RunBench("parse/mapped", "entity", entities.size(), lump.size(), flMinSeconds, [&]()
+		{
+			std::vector<Entity> parsed;
+			ParseBuffer(lump, parsed);
+			g_benchSink = parsed.size();
+		}));
+	}
+
+	if (wanted("parse/flat"))
+	{
+		results.push_back(RunBench("parse/flat", "entity", entities.size(), lump.size(), flMinSeconds, [&]()
+		{
+			FlatMap parsed;
+			ParseBufferFlat(lump, parsed);
+			g_benchSink = parsed.EntityCount();
+		}));
+	}
+
+	// What holding the whole map takes, as a vector of Entity and as a FlatMap, parsed and then with every brush built
+	std::vector<MemoryResult> memory;
+	if (wanted("memory/"))
+	{
+		BrushBuilder memoryBuilder;
+		memory.push_back(RunMemory("memory/parse/entities", [&]()
+		{
+			std::vector<Entity> parsed;
+			ParseBuffer(lump, parsed);
+			return parsed;
+		}));
+		memory.push_back(RunMemory("memory/parse/flat", [&]()
+		{
+			FlatMap parsed;
+			ParseBufferFlat(lump, parsed);
+			return parsed;
+		}));
+		memory.push_back(RunMemory("memory/build/entities", [&]()
+		{
+			std::vector<Entity> parsed;
+			ParseBuffer(lump, parsed);
+			std::vector<Brush*> brushes;
+			for (Entity& ent : parsed)
+			{
+				for (Brush& brush : ent.brushes)
+					brushes.push_back(&brush);
+			}
+			BuildBrushes(brushes, memoryBuilder, 1);
+			return parsed;
+		}));
+		memory.push_back(RunMemory("memory/build/flat", [&]()
+		{
+			FlatMap parsed;
+			ParseBufferFlat(lump, parsed);
+			parsed.Build(memoryBuilder, 1);
+			return parsed;
+		}));
+	}
+
+	// Every brush sorted by kind. The generator hands the kinds out in turn
+	std::vector<Brush*> brushesByKind[(int)GenBrushKind::Count];
+	std::vector<Brush*> allBrushes;
+	int iKind = 0;
+	for (Entity& ent : entities)
+	{
+		for (Brush& brush : ent.brushes)
+		{
+			brushesByKind[iKind++ % (int)GenBrushKind::Count].push_back(&brush);
+			allBrushes.push_back(&brush);
+		}
+	}
+
+	// Three plane solves, on every triple of the first few box and bevel brushes
+	if (wanted("solve/"))
+	{
+		std::vector<const Plane*> triples;
+		for (int iKindSolve : { (int)GenBrushKind::Box, (int)GenBrushKind::Bevel })
+		{
+			for (size_t iBrush = 0; iBrush < brushesByKind[iKindSolve].size() && iBrush < 64; iBrush++)
+			{
+				const std::vector<Plane>& planes = brushesByKind[iKindSolve][iBrush]->planes;
+				for (size_t i = 0; i < planes.size(); i++)
+					for (size_t j = i + 1; j < planes.size(); j++)
+						for (size_t k = j + 1; k < planes.size(); k++)
+							triples.insert(triples.end(), { &planes[i], &planes[j], &planes[k] });
+			}
+		}
+		size_t nTriples = triples.size() / 3;
+		results.push_back(RunBench("solve/mat3x3_solve", "triple", nTriples, 0, flMinSeconds, [&]()
+		{
+			uint64_t nSolved = 0;
+			Vector3 p;
+			for (size_t i = 0; i < triples.size(); i += 3)
+			{
+				Matrix3x3 m = { triples[i]->normal, triples[i + 1]->normal, triples[i + 2]->normal };
+				nSolved += mat3x3_solve(m, { triples[i]->dist, triples[i + 1]->dist, triples[i + 2]->dist }, &p);
+			}
+			g_benchSink = nSolved;
+		}));
+		results.push_back(RunBench("solve/PlaneIntersect", "triple", nTriples, 0, flMinSeconds, [&]()
+		{
+			uint64_t nSolved = 0;
+			Vector3 p;
+			for (size_t i = 0; i < triples.size(); i += 3)
+				nSolved += PlaneIntersect(*triples[i], *triples[i + 1], *triples[i + 2], &p);
+			g_benchSink = nSolved;
+		}));
+	}
+
+	// Building, each kind of brush with each kernel, then everything with the default settings
+	BrushBuilder bb;
+	for (int iKindBuild = 0; iKindBuild < (int)GenBrushKind::Count; iKindBuild++)
+	{
+		std::vector<Brush*>& brushes = brushesByKind[iKindBuild];
+		for (BuildKernel kernel : { BuildKernel::Reference, BuildKernel::Scalar, BuildKernel::SSE2, BuildKernel::AVX2 })
+		{
+			std::string name = std::string("build/") + GenBrushKindName((GenBrushKind)iKindBuild) + "/" + BuildKernelName(kernel);
+			if (!BuildKernelSupported(kernel) || !wanted(name) || brushes.empty())
+				continue;
+			bb.SetKernel(kernel);
+			results.push_back(RunBench(name, "brush", brushes.size(), 0, flMinSeconds, [&]()
+			{
+				for (Brush* pBrush : brushes)
+				{
+					pBrush->edges.clear();
+					bb.Build(*pBrush);
+				}
+			}));
+		}
+	}
+	bb.SetKernel(g_defaultBuildKernel);
+	for (Brush* pBrush : allBrushes)
+	{
+		pBrush->edges.clear();
+		bb.Build(*pBrush);
+	}
+
+	// Filtering, with a typical mix of rules
+	Settings settings;
+	settings.defaultAllow = false;
+	settings.allows.Add("classname trigger_*", std::cout);
+	settings.allows.Add("editorclass trigger_flag_set", std::cout);
+	settings.allows.Add("script_flag flag_3", std::cout);
+	settings.avoids.Add("targetname target_1*", std::cout);
+	settings.clrOverrides.Add("classname trigger_hurt 255 0 0", std::cout, true);
+	settings.min_z = -3000;
+	if (wanted("filter/PassesFilters"))
+	{
+		results.push_back(RunBench("filter/PassesFilters", "entity", entities.size(), 0, flMinSeconds, [&]()
+		{
+			uint64_t nPassed = 0;
+			for (const Entity& ent : entities)
+				nPassed += PassesFilters(settings, ent);
+			g_benchSink = nPassed;
+		}));
+	}
+
+	// Picking out the entities in a lot of small areas, one region at a time against every entity versus through the tree
+	if (wanted("filter/regions/"))
+	{
+		Settings regionSettings;
+		GenRandom random(gen.seed);
+		for (int i = 0; i < 256; i++)
+		{
+			float x = random.Range(-12000, 12000), y = random.Range(-12000, 12000), z = random.Range(-4000, 4000);
+			regionSettings.regionBoxes.push_back({ { x, y, z }, { x + 1024, y + 1024, z + 1024 } });
+		}
+		std::vector<Bounds> bounds(entities.size());
+		for (size_t i = 0; i < entities.size(); i++)
+			bounds[i] = EntityBounds(entities[i]);
+		results.push_back(RunBench("filter/regions/scan", "entity", entities.size(), 0, flMinSeconds, [&]()
+		{
+			uint64_t nInside = 0;
+			for (const Bounds& entBounds : bounds)
+				nInside += InRegions(regionSettings, entBounds);
+			g_benchSink = nInside;
+		}));
+		results.push_back(RunBench("filter/regions/tree", "entity", entities.size(), 0, flMinSeconds, [&]()
+		{
+			std::vector<char> inRegion = FindEntitiesInRegions(regionSettings, bounds);
+			g_benchSink = std::count(inRegion.begin(), inRegion.end(), 1);
+		}));
+	}
+
+	// Writing the cfg text, into memory so the disk stays out of it
+	settings.drawEntCubes = true;
+	if (wanted("emit/"))
+	{
+		uint64_t nLines = 0;
+		{
+			CfgWriter out;
+			WriteCfg(out, settings, entities);
+			std::string text = out.TakeText();
+			nLines = std::count(text.begin(), text.end(), '\n');
+		}
+		for (FloatStyle style : { FloatStyle::Legacy, FloatStyle::Shortest })
+		{
+			std::string name = style == FloatStyle::Legacy ? "emit/cfg/legacy" : "emit/cfg/shortest";
+			if (!wanted(name))
+				continue;
+			results.push_back(RunBench(name, "line", nLines, 0, flMinSeconds, [&]()
+			{
+				CfgWriter out(nullptr, style);
+				WriteCfg(out, settings, entities);
+				g_benchSink = out.TakeText().size();
+			}));
+		}
+	}
+
+	// The whole thing on a file, as the command line would do it, with and without streaming
+	if (wanted("e2e/"))
+	{
+		std::error_code ec;
+		std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / ("planepoints_bench_" + std::to_string(gen.seed));
+		std::filesystem::create_directories(dir, ec);
+		std::string lumpPath = (dir / "bench_script.ent").string();
+		std::string cfgPath = (dir / "bench_script.cfg").string();
+		{
+			std::ofstream file(lumpPath, std::ios::binary);
+			file << lump;
+		}
+
+		settings.drawEntCubes = false;
+		for (bool stream : { false, true })
+		{
+			std::string name = stream ? "e2e/stream" : "e2e/file";
+			if (!wanted(name))
+				continue;
+			ProcessOptions options;
+			options.useCache = false;
+			options.stream = stream;
+			bool ok = true;
+			results.push_back(RunBench(name, "entity", entities.size(), lump.size(), flMinSeconds, [&]()
+			{
+				FileResult result;
+				ok &= ProcessFile(lumpPath, cfgPath, settings, bb, options, result);
+			}));
+			if (!ok)
+			{
+				std::cout << name << " failed\n";
+				return 1;
+			}
+		}
+		std::filesystem::remove_all(dir, ec);
+
+		// The same through the library, straight from memory to the edges, with no file either way
+		if (wanted("e2e/api"))
+		{
+			pp_settings apiSettings;
+			apiSettings.settings = settings;
+			std::vector<unsigned char> draw;
+			bool ok = true;
+			results.push_back(RunBench("e2e/api", "entity", entities.size(), lump.size(), flMinSeconds, [&]()
+			{
+				pp_map* map = pp_map_create();
+				ok &= pp_map_parse(map, lump.data(), lump.size()) == PP_OK;
+				draw.resize(pp_map_entity_count(map));
+				pp_map_filter(map, &apiSettings, draw.data());
+				pp_build_options buildOptions = {};
+				buildOptions.draw = draw.data();
+				ok &= pp_map_build(map, &buildOptions) == PP_OK;
+				uint64_t nEdges = 0;
+				pp_map_each_brush(map, 0, draw.size(), [](void* user, const pp_brush_edges* brush)
+				{
+					*(uint64_t*)user += brush->edge_count;
+					return 0;
+				}, &nEdges);
+				g_benchSink = nEdges;
+				pp_map_free(map);
+			}));
+			if (!ok)
+			{
+				std::cout << "e2e/api failed\n";
+				return 1;
+			}
+		}
+	}
+
+	if (outPath.empty())
+		WriteResults(std::cout, gen, results, memory);
+	else
+	{
+		std::ofstream file(outPath);
+		WriteResults(file, gen, results, memory);
+		if (file.fail())
+		{
+			std::cout << "Could not write " << outPath << "\n";
+			return 1;
+		}
+	}
+
+	if (baselinePath.empty())
+		return 0;
+	std::unordered_map<std::string, double> baseline;
+	if (!ReadBaseline(baselinePath, baseline))
+	{
+		std::cerr << "Could not read " << baselinePath << "\n";
+		return 1;
+	}
+	int nSlower = 0;
+	for (const BenchResult& result : results)
+	{
+		auto it = baseline.find(result.name);
+		if (it == baseline.end() || it->second <= 0)
+			continue;
+		double flChange = (result.NsPerItem() / it->second - 1) * 100;
+		if (flChange > flTolerance)
+		{
+			std::cerr << "SLOWER  " << result.name << ": " << it->second << " -> " << result.NsPerItem() << " ns/" << result.unit << " (+" << flChange << "%)\n";
+			nSlower++;
+		}
+	}
+	std::cerr << nSlower << " of " << results.size() << " benchmarks slower than " << baselinePath << "\n";
+	return nSlower ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+// The planepoints program. Everything it does is in the library, see planepoints.h
+#include "planepoints.h"
+
+int main(int argc, char* argv[])
+{
+	return pp_main(argc, argv);
+}
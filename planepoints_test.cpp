@@ -0,0 +1,425 @@
+// Tests for planepoints. Run by ctest, or on their own; the exit code is how many failed.
+//
+// planepoints.cpp is pulled in whole, like planepoints_bench does, so the tests can get at anything in it
+#define PLANEPOINTS_NO_MAIN
+#include "planepoints.cpp"
+
+int g_nChecks = 0;
+int g_nFailures = 0;
+
+#define CHECK(cond, what) \
+	do \
+	{ \
+		g_nChecks++; \
+		if (!(cond)) \
+		{ \
+			g_nFailures++; \
+			std::cout << "FAIL  " << __FUNCTION__ << ": " << what << " (" #cond ")\n"; \
+		} \
+	} while (0)
+
+// Same generator as the bench's, so a failing seed can be looked at again
+struct TestRandom
+{
+	uint64_t state;
+
+	explicit TestRandom(uint32_t seed) : state(HashMix(seed + 1)) {}
+	uint32_t Next() { state = state * 6364136223846793005ull + 1442695040888963407ull; return (uint32_t)(state >> 33); }
+	float Range(float lo, float hi) { return lo + (hi - lo) * (Next() / 2147483648.0f); }
+	int Index(int n) { return (int)(Next() % (uint32_t)n); }
+	Vector3 Direction()
+	{
+		for (;;)
+		{
+			Vector3 v = { Range(-1, 1), Range(-1, 1), Range(-1, 1) };
+			float flLength = sqrtf(dotProduct(v, v));
+			if (flLength > 0.1f && flLength <= 1)
+				return v * (1 / flLength);
+		}
+	}
+};
+
+// A lump of triggers with one random brush each, parsed the same way a real map is. Half are boxes with random cuts
+// through them, half are planes touching a sphere from random directions inside its box. A quarter sit thousands of
+// units out, where float culling gets too close to call and the kernels have to recull in double
+std::vector<Entity> RandomBrushEntities(int nBrushes, uint32_t seed)
+{
+	TestRandom random(seed);
+	std::string lump;
+	char line[256];
+	for (int iBrush = 0; iBrush < nBrushes; iBrush++)
+	{
+		// Planes are relative to the entity's origin, so even big maps rarely have them much further out than this
+		float flReach = random.Index(4) == 0 ? 4096.0f : 512.0f;
+		Vector3 center = { random.Range(-flReach, flReach), random.Range(-flReach, flReach), random.Range(-flReach, flReach) };
+		bool round = iBrush & 1;
+		float flRadius = random.Range(16, 512);
+		Vector3 half = round ? Vector3{ flRadius, flRadius, flRadius } : Vector3{ random.Range(8, 512), random.Range(8, 512), random.Range(8, 512) };
+
+		// Always the bounding box first, like every trigger has
+		std::vector<Plane> planes;
+		planes.push_back({ { 1, 0, 0 }, center.x + half.x });
+		planes.push_back({ { -1, 0, 0 }, -(center.x - half.x) });
+		planes.push_back({ { 0, 1, 0 }, center.y + half.y });
+		planes.push_back({ { 0, -1, 0 }, -(center.y - half.y) });
+		planes.push_back({ { 0, 0, 1 }, center.z + half.z });
+		planes.push_back({ { 0, 0, -1 }, -(center.z - half.z) });
+		int nCuts = round ? 4 + random.Index(27) : random.Index(13);
+		for (int i = 0; i < nCuts; i++)
+		{
+			Vector3 normal = random.Direction();
+			if (round)
+				planes.push_back({ normal, dotProduct(normal, center) + flRadius });
+			else
+			{
+				float flBoxReach = fabsf(normal.x) * half.x + fabsf(normal.y) * half.y + fabsf(normal.z) * half.z;
+				planes.push_back({ normal, dotProduct(normal, center) + flBoxReach * random.Range(0.3f, 1.0f) });
+			}
+		}
+
+		lump += "{\n\"origin\" \"0 0 0\"\n\"classname\" \"trigger_multiple\"\n";
+		for (size_t i = 0; i < planes.size(); i++)
+		{
+			const Plane& plane = planes[i];
+			snprintf(line, sizeof(line), "\"*trigger_brush_0_plane_%d\" \"%.9g %.9g %.9g %.9g\"\n", (int)i, plane.normal.x, plane.normal.y, plane.normal.z, plane.dist);
+			lump += line;
+		}
+		lump += "}\n";
+	}
+
+	std::vector<Entity> entities;
+	ParseBuffer(lump, entities);
+	return entities;
+}
+
+// Every batched kernel this machine has against the others, bit for bit, and against the reference solver edge for edge
+void TestKernelsMatchReference()
+{
+	std::vector<Entity> entities = RandomBrushEntities(3000, 1);
+	CHECK(entities.size() == 3000, "every brush parsed");
+
+	BrushBuilder reference;
+	reference.SetKernel(BuildKernel::Reference);
+	reference.SetMethod(BuildMethod::Triples);
+	std::vector<BrushBuilder> kernels(3);
+	std::vector<RecullPoint> reculled[3];
+	const BuildKernel kinds[3] = { BuildKernel::Scalar, BuildKernel::SSE2, BuildKernel::AVX2 };
+	for (int k = 0; k < 3; k++)
+	{
+		kernels[k].SetKernel(kinds[k]);
+		kernels[k].SetMethod(BuildMethod::Triples);
+		kernels[k].SetRecullLog(&reculled[k]);
+	}
+
+	int nSame = 0, nReculled = 0, nDifferent = 0, nInexact = 0, nEmpty = 0;
+	size_t nRecullPoints = 0;
+	for (const Entity& ent : entities)
+	{
+		const Brush& brush = ent.brushes[0];
+		Brush ref = brush;
+		reference.Build(ref);
+		if (ref.edges.empty())
+			nEmpty++;
+
+		Brush scalar;
+		for (int k = 0; k < 3; k++)
+		{
+			if (!BuildKernelSupported(kinds[k]))
+				continue;
+			Brush built = brush;
+			reculled[k].clear();
+			kernels[k].Build(built);
+			nRecullPoints += reculled[k].size();
+			if (k == 0)
+				scalar = built;
+			else if (!BrushesIdentical(built, scalar))
+				nInexact++;
+
+			switch (CompareToReference(brush, built, ref, reculled[k]))
+			{
+			case ReferenceMatch::Same:		nSame++; break;
+			case ReferenceMatch::Reculled:	nReculled++; break;
+			default:						nDifferent++; break;
+			}
+		}
+	}
+	CHECK(nEmpty == 0, nEmpty << " brushes came out with no edges");
+	CHECK(nDifferent == 0, nDifferent << " kernel builds differ from the reference");
+	CHECK(nInexact == 0, nInexact << " SIMD builds differ from the scalar kernel");
+	CHECK(nSame > 0, "nothing was compared");
+	std::cout << "      kernels: " << nSame << " builds match the reference, " << nReculled << " only differ over reculled points, "
+		<< nRecullPoints << " points reculled\n";
+}
+
+// Clip only tells the triple walk which pairs to leave out, so it has to come out bit for bit the same. Besides the
+// usual random brushes, boxes with a face tilted a hair off, which triples don't solve against the face it's nearly
+// parallel to, and spheres big enough for auto to clip
+void TestClipMatchesTriples()
+{
+	std::vector<Entity> entities = RandomBrushEntities(1000, 2);
+
+	TestRandom random(3);
+	std::string lump;
+	char line[256];
+	for (int iBrush = 0; iBrush < 200; iBrush++)
+	{
+		Vector3 center = { random.Range(-512, 512), random.Range(-512, 512), random.Range(-512, 512) };
+		Vector3 half = { random.Range(8, 512), random.Range(8, 512), random.Range(8, 512) };
+		std::vector<Plane> planes;
+		planes.push_back({ { 1, 0, 0 }, center.x + half.x });
+		planes.push_back({ { -1, 0, 0 }, -(center.x - half.x) });
+		planes.push_back({ { 0, 1, 0 }, center.y + half.y });
+		planes.push_back({ { 0, -1, 0 }, -(center.y - half.y) });
+		planes.push_back({ { 0, 0, 1 }, center.z + half.z });
+		planes.push_back({ { 0, 0, -1 }, -(center.z - half.z) });
+		for (int i = 0; i < 6; i++)
+		{
+			Vector3 normal = planes[i].normal;
+			normal[( i / 2 + 1 ) % 3] += random.Range(-0.004f, 0.004f);
+			normal = normal * (1 / sqrtf(dotProduct(normal, normal)));
+			planes.push_back({ normal, dotProduct(normal, center) + fabsf(dotProduct(normal, half)) - random.Range(0, 2) });
+		}
+
+		lump += "{\n\"origin\" \"0 0 0\"\n\"classname\" \"trigger_multiple\"\n";
+		for (size_t i = 0; i < planes.size(); i++)
+		{
+			const Plane& plane = planes[i];
+			snprintf(line, sizeof(line), "\"*trigger_brush_0_plane_%d\" \"%.9g %.9g %.9g %.9g\"\n", (int)i, plane.normal.x, plane.normal.y, plane.normal.z, plane.dist);
+			lump += line;
+		}
+		lump += "}\n";
+	}
+	ParseBuffer(lump, entities);
+
+	std::vector<Brush> brushes;
+	for (const Entity& ent : entities)
+		brushes.push_back(ent.brushes[0]);
+	for (int nPlanes : { 24, 32, 64, 128 })
+		brushes.push_back(MakeSphereBrush(nPlanes, { 1234.5f, -678.25f, 90.0f }, 512.0f));
+
+	int nDifferent = 0;
+	for (BuildKernel kernel : { BuildKernel::Reference, BuildKernel::Scalar })
+	{
+		BrushBuilder triples;
+		triples.SetKernel(kernel);
+		triples.SetMethod(BuildMethod::Triples);
+		BrushBuilder clip;
+		clip.SetKernel(kernel);
+		clip.SetMethod(BuildMethod::Clip);
+		for (const Brush& brush : brushes)
+		{
+			Brush a = brush, b = brush;
+			triples.Build(a);
+			clip.Build(b);
+			if (!BrushesIdentical(a, b))
+				nDifferent++;
+		}
+	}
+	CHECK(brushes.size() == 1204, "every brush parsed");
+	CHECK(nDifferent == 0, nDifferent << " clip builds differ from triples");
+}
+
+// Boxes only get their edges read straight off their planes when they're thick enough that the full build wouldn't weld
+// their corners together. Either way they have to come out like the reference builds them
+void TestThinBoxes()
+{
+	BrushBuilder reference;
+	reference.SetKernel(BuildKernel::Reference);
+	reference.SetMethod(BuildMethod::Triples);
+	BrushBuilder bb;
+	bb.SetMethod(BuildMethod::Triples);
+
+	for (float flOffset : { 0.0f, 100.0f, 3000.0f })
+	{
+		for (float flThickness : { 0.0f, 0.0005f, 0.001f, 0.0015f, 0.002f, 0.0025f, 0.004f, 0.01f, 1.0f })
+		{
+			char lump[512];
+			snprintf(lump, sizeof(lump), "{\n\"origin\" \"0 0 0\"\n\"classname\" \"trigger_multiple\"\n"
+				"\"*trigger_brush_0_plane_0\" \"1 0 0 %.9g\"\n\"*trigger_brush_0_plane_1\" \"-1 0 0 %.9g\"\n"
+				"\"*trigger_brush_0_plane_2\" \"0 1 0 64\"\n\"*trigger_brush_0_plane_3\" \"0 -1 0 64\"\n"
+				"\"*trigger_brush_0_plane_4\" \"0 0 1 64\"\n\"*trigger_brush_0_plane_5\" \"0 0 -1 64\"\n}\n",
+				flOffset + flThickness, -flOffset);
+			std::vector<Entity> entities;
+			ParseBuffer(lump, entities);
+			Brush& brush = entities[0].brushes[0];
+			bool box = brush.shape == BrushShape::Box;
+			CHECK(box == (flThickness > 2 * k_flEpsilon), "a box " << flThickness << " thick at " << flOffset << (box ? " is" : " isn't") << " read off its planes");
+
+			Brush ref = brush;
+			reference.Build(ref);
+			Brush built = brush;
+			bb.Build(built);
+			CHECK(BrushesNear(built, ref, k_flVerifyTolerance), "a box " << flThickness << " thick at " << flOffset << " has " << built.edges.size()
+				<< " edges, the reference gives it " << ref.edges.size());
+		}
+	}
+}
+
+// -merge only drops an edge every plane of which is hidden by another brush when the brushes close all the way around it.
+// Two boxes touching along one edge, corner to corner, still have to draw it
+void TestMergeKeepsTouchingEdges()
+{
+	// Boxes 64 units on a side and 64 high, with their corner at (x, y)
+	auto boxes = [](std::initializer_list<std::pair<int, int>> corners)
+	{
+		std::string lump = "{\n\"origin\" \"0 0 0\"\n\"classname\" \"trigger_multiple\"\n";
+		char line[128];
+		int iBrush = 0;
+		for (const auto& corner : corners)
+		{
+			const int planes[6][4] = { { 1, 0, 0, corner.first + 64 }, { -1, 0, 0, -corner.first }, { 0, 1, 0, corner.second + 64 },
+				{ 0, -1, 0, -corner.second }, { 0, 0, 1, 64 }, { 0, 0, -1, 0 } };
+			for (int i = 0; i < 6; i++)
+			{
+				snprintf(line, sizeof(line), "\"*trigger_brush_%d_plane_%d\" \"%d %d %d %d\"\n", iBrush, i, planes[i][0], planes[i][1], planes[i][2], planes[i][3]);
+				lump += line;
+			}
+			iBrush++;
+		}
+		lump += "}\n";
+		std::vector<Entity> entities;
+		ParseBuffer(lump, entities);
+		BrushBuilder bb;
+		for (Brush& brush : entities[0].brushes)
+			bb.Build(brush);
+		return entities;
+	};
+	auto hasEdge = [](const Entity& ent, Vector3 a, Vector3 b)
+	{
+		for (const Edge& edge : ent.brushes[0].edges)
+		{
+			if ((edge.stem == a && edge.tail == b) || (edge.stem == b && edge.tail == a))
+				return true;
+		}
+		return false;
+	};
+
+	std::vector<Entity> touching = boxes({ { 0, 0 }, { 64, 64 } });
+	EdgeMerger merger;
+	merger.Merge(touching[0]);
+	CHECK(merger.GetStats().nInterior == 0, merger.GetStats().nInterior << " edges of two boxes corner to corner were dropped as flat");
+	CHECK(touching[0].brushes[0].edges.size() == 23, "two boxes corner to corner merged into " << touching[0].brushes[0].edges.size() << " lines, not 23");
+	CHECK(hasEdge(touching[0], { 64, 64, 0 }, { 64, 64, 64 }), "the edge the boxes touch along was dropped");
+
+	// With all four around it, there's nothing to see there
+	std::vector<Entity> around = boxes({ { 0, 0 }, { 64, 0 }, { 0, 64 }, { 64, 64 } });
+	merger.ResetStats();
+	merger.Merge(around[0]);
+	CHECK(!hasEdge(around[0], { 64, 64, 0 }, { 64, 64, 64 }), "the edge four boxes meet along was kept");
+	CHECK(around[0].brushes[0].edges.size() == 12, "four boxes in a square merged into " << around[0].brushes[0].edges.size() << " lines, not 12");
+}
+
+// The cache is looked up by a hash, but only hands edges back for the planes they were built from
+void TestCacheChecksPlanes()
+{
+	std::vector<Entity> entities = RandomBrushEntities(2, 2);
+	Brush& a = entities[0].brushes[0];
+	Brush& b = entities[1].brushes[0];
+	BrushBuilder bb;
+	bb.Build(a);
+	bb.Build(b);
+
+	// Both under the same key, as if they collided. The second store of it is dropped
+	std::string path = (std::filesystem::temp_directory_path() / "planepoints_test.ppcache").string();
+	uint64_t key = GeometryCache::KeyFor(a);
+	GeometryCache cache;
+	cache.Load(path + ".none", GeometryCache::ConfigFor(bb));
+	cache.Store(key, a);
+	cache.Store(key, b);
+	CHECK(cache.Save(path, { key }), "the cache saved to " << path);
+
+	GeometryCache loaded;
+	CHECK(loaded.Load(path, GeometryCache::ConfigFor(bb)), "the cache loaded");
+	Brush foundA = a, foundB = b;
+	foundA.edges.clear();
+	foundB.edges.clear();
+	CHECK(loaded.Find(key, foundA) && BrushesIdentical(foundA, a), "the brush that was stored got its edges back");
+	CHECK(!loaded.Find(key, foundB) && foundB.edges.empty(), "a different brush under the same key was handed edges");
+
+	// Already there, so saving again writes the same file
+	loaded.Store(key, b);
+	CHECK(!loaded.HasChanges({ key }), "storing a key that was loaded changed the cache");
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+}
+
+// A .ppbin with counts that would wrap around in 32 bits is turned away, not read past the end of
+void TestBinaryMapCounts()
+{
+	std::vector<Entity> entities = RandomBrushEntities(4, 3);
+	std::string path = (std::filesystem::temp_directory_path() / "planepoints_test.ppbin").string();
+	CHECK(WriteBinaryMap(path, entities, 0), "wrote " << path);
+	std::ifstream in(path, std::ios::binary);
+	std::string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+
+	auto loads = [](const std::string& data)
+	{
+		std::vector<Entity> loaded;
+		try
+		{
+			LoadBinaryMap(data, loaded, 0);
+			return true;
+		}
+		catch (const std::runtime_error&)
+		{
+			return false;
+		}
+	};
+	CHECK(loads(good), "the map loads as written");
+
+	for (size_t field : { offsetof(BinaryHeader, nStrings), offsetof(BinaryHeader, nStringBytes) })
+	{
+		for (uint32_t count : { UINT32_MAX, UINT32_MAX - 1, UINT32_MAX - 2 })
+		{
+			std::string bad = good;
+			memcpy(&bad[field], &count, sizeof(count));
+			CHECK(!loads(bad), "a count of " << count << " at byte " << field << " loaded");
+		}
+	}
+}
+
+// The library says what went wrong through its return values and never prints, even for bad brushes and settings
+void TestLibraryDoesntPrint()
+{
+	std::ostringstream printed;
+	std::streambuf* pOld = std::cout.rdbuf(printed.rdbuf());
+
+	const char lump[] = "{\n\"origin\" \"0 0 0\"\n\"classname\" \"trigger_multiple\"\n"
+		"\"*trigger_brush_0_plane_0\" \"1 0 0 8\"\n\"*trigger_brush_0_plane_1\" \"0 1 0 8\"\n\"*trigger_brush_0_plane_2\" \"0 0 1 8\"\n"
+		"\"*trigger_brush_1_plane_0\" \"1 0 0 8\"\n\"*trigger_brush_1_plane_1\" \"-1 0 0 8\"\n\"*trigger_brush_1_plane_2\" \"0 1 0 8\"\n"
+		"\"*trigger_brush_1_plane_3\" \"0 -1 0 8\"\n\"*trigger_brush_1_plane_4\" \"0 0 1 8\"\n\"*trigger_brush_1_plane_5\" \"0 0 -1 8\"\n}\n";
+	pp_map* map = pp_map_create();
+	pp_status parsed = pp_map_parse(map, lump, sizeof(lump) - 1);
+	pp_status built = pp_map_build(map, nullptr);
+	size_t nTooFewPlanes = pp_map_too_few_planes_count(map);
+	pp_map_free(map);
+
+	const char settingsText[] = "\"must\" \"nonsense trigger_*\"\n";
+	pp_settings* settings = pp_settings_create();
+	pp_status read = pp_settings_parse(settings, settingsText, sizeof(settingsText) - 1);
+	std::string warning = pp_settings_error(settings);
+	pp_settings_free(settings);
+
+	std::cout.rdbuf(pOld);
+	CHECK(parsed == PP_OK && built == PP_OK, "the map parsed and built");
+	CHECK(nTooFewPlanes == 1, nTooFewPlanes << " brushes counted as having too few planes");
+	CHECK(read == PP_OK && warning.find("nonsense") != std::string::npos, "the unknown property was warned about with \"" << warning << "\"");
+	CHECK(printed.str().empty(), "printed \"" << printed.str() << "\"");
+}
+
+int main()
+{
+	std::cout << "Kernels: " << BuildKernelName(DetectBuildKernel()) << " is the best this machine has\n";
+	TestKernelsMatchReference();
+	TestClipMatchesTriples();
+	TestThinBoxes();
+	TestMergeKeepsTouchingEdges();
+	TestCacheChecksPlanes();
+	TestBinaryMapCounts();
+	TestLibraryDoesntPrint();
+	std::cout << g_nChecks - g_nFailures << " of " << g_nChecks << " checks passed\n";
+	return g_nFailures;
+}